@@ -0,0 +1,263 @@
+#include "app_history.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char* TAG = "HISTORY";
+
+// Bucket đang mở của một tier; sum theo số mẫu thô để mean của tier trên vẫn đúng trọng số
+typedef struct {
+    bool open;
+    uint32_t bucket; // time_s / period_s
+    uint32_t samples;
+    int16_t min[APP_HISTORY_METRICS];
+    int16_t max[APP_HISTORY_METRICS];
+    int64_t sum[APP_HISTORY_METRICS];
+} history_acc_t;
+
+typedef struct {
+    app_history_point_t* points;
+    uint32_t stored; // Số bucket đã ghi từ lúc init, ô ghi kế tiếp là stored % capacity
+    uint32_t count;
+} history_ring_t;
+
+// Toàn bộ ring nằm trong một vùng PSRAM cấp phát lúc init
+static struct {
+    app_history_tier_t tiers[APP_HISTORY_MAX_TIERS];
+    uint8_t num_tiers;
+    app_history_point_t* buf;
+    size_t bytes;
+    history_ring_t rings[TOTAL_SLOT][APP_HISTORY_MAX_TIERS];
+    history_acc_t acc[TOTAL_SLOT][APP_HISTORY_MAX_TIERS];
+    uint32_t samples;
+    uint32_t overwritten;
+    portMUX_TYPE lock;
+} hist_ctx = {.lock = portMUX_INITIALIZER_UNLOCKED};
+
+esp_err_t
+app_history_init(const app_history_tier_t* tiers, uint8_t num_tiers) {
+    if (!tiers || num_tiers == 0 || num_tiers > APP_HISTORY_MAX_TIERS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t total = 0;
+    for (uint8_t t = 0; t < num_tiers; t++) {
+        if (tiers[t].period_s == 0 || tiers[t].points == 0
+            || (t > 0 && tiers[t].period_s % tiers[t - 1].period_s != 0)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        total += tiers[t].points;
+    }
+
+    app_history_deinit();
+    size_t bytes = total * TOTAL_SLOT * sizeof(app_history_point_t);
+    app_history_point_t* buf = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        ESP_LOGE(TAG, "No PSRAM for %u KB of history", (unsigned)(bytes / 1024));
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&hist_ctx.lock);
+    memcpy(hist_ctx.tiers, tiers, num_tiers * sizeof(app_history_tier_t));
+    hist_ctx.num_tiers = num_tiers;
+    hist_ctx.buf = buf;
+    hist_ctx.bytes = bytes;
+    memset(hist_ctx.rings, 0, sizeof(hist_ctx.rings));
+    memset(hist_ctx.acc, 0, sizeof(hist_ctx.acc));
+    for (uint8_t slot = 0; slot < TOTAL_SLOT; slot++) {
+        for (uint8_t t = 0; t < num_tiers; t++) {
+            hist_ctx.rings[slot][t].points = buf;
+            buf += tiers[t].points;
+        }
+    }
+    hist_ctx.samples = 0;
+    hist_ctx.overwritten = 0;
+    portEXIT_CRITICAL(&hist_ctx.lock);
+
+    for (uint8_t t = 0; t < num_tiers; t++) {
+        ESP_LOGI(TAG, "Tier %u: %lus x %lu (%lu min)", t, (unsigned long)tiers[t].period_s,
+                 (unsigned long)tiers[t].points, (unsigned long)(tiers[t].period_s * tiers[t].points / 60));
+    }
+    ESP_LOGI(TAG, "History of %d slots in %u KB of PSRAM", TOTAL_SLOT, (unsigned)(bytes / 1024));
+    return ESP_OK;
+}
+
+void
+app_history_deinit(void) {
+    portENTER_CRITICAL(&hist_ctx.lock);
+    app_history_point_t* buf = hist_ctx.buf;
+    hist_ctx.buf = NULL;
+    hist_ctx.bytes = 0;
+    hist_ctx.num_tiers = 0;
+    portEXIT_CRITICAL(&hist_ctx.lock);
+
+    heap_caps_free(buf);
+}
+
+static void
+history_merge(history_acc_t* acc, const history_acc_t* in, uint32_t bucket) {
+    if (!acc->open) {
+        *acc = *in;
+        acc->open = true;
+        acc->bucket = bucket;
+        return;
+    }
+    for (int m = 0; m < APP_HISTORY_METRICS; m++) {
+        acc->min[m] = in->min[m] < acc->min[m] ? in->min[m] : acc->min[m];
+        acc->max[m] = in->max[m] > acc->max[m] ? in->max[m] : acc->max[m];
+        acc->sum[m] += in->sum[m];
+    }
+    acc->samples += in->samples;
+}
+
+// Ghi bucket đã đóng vào ring của tier, ghi đè điểm cũ nhất khi đầy
+static void
+history_store(uint8_t slot, uint8_t tier, const history_acc_t* acc) {
+    history_ring_t* ring = &hist_ctx.rings[slot][tier];
+    uint32_t capacity = hist_ctx.tiers[tier].points;
+    app_history_point_t* p = &ring->points[ring->stored % capacity];
+
+    p->time_s = acc->bucket * hist_ctx.tiers[tier].period_s;
+    p->samples = acc->samples < UINT16_MAX ? acc->samples : UINT16_MAX;
+    for (int m = 0; m < APP_HISTORY_METRICS; m++) {
+        p->v[m].min = acc->min[m];
+        p->v[m].max = acc->max[m];
+        p->v[m].mean = (int16_t)(acc->sum[m] / (int64_t)acc->samples);
+    }
+
+    ring->stored++;
+    if (ring->count < capacity) {
+        ring->count++;
+    } else {
+        hist_ctx.overwritten++;
+    }
+}
+
+// Gộp vào bucket đang mở; sang bucket mới thì đóng bucket cũ và cuộn nó lên tier kế tiếp
+static void
+history_fold(uint8_t slot, uint32_t time_s, const history_acc_t* sample) {
+    history_acc_t cur = *sample;
+    history_acc_t closed;
+
+    for (uint8_t t = 0; t < hist_ctx.num_tiers; t++) {
+        history_acc_t* acc = &hist_ctx.acc[slot][t];
+        uint32_t bucket = time_s / hist_ctx.tiers[t].period_s;
+        bool close = acc->open && acc->bucket != bucket;
+
+        if (close) {
+            closed = *acc;
+            acc->open = false;
+        }
+        history_merge(acc, &cur, bucket);
+        if (!close) {
+            return;
+        }
+
+        history_store(slot, t, &closed);
+        cur = closed;
+        time_s = closed.bucket * hist_ctx.tiers[t].period_s;
+    }
+}
+
+static int16_t
+history_sat16(int32_t value) {
+    return value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : (int16_t)value);
+}
+
+void
+app_history_append(uint8_t slot, const BMS_Data_t* data, int64_t now_us) {
+    if (slot >= TOTAL_SLOT || !data || !hist_ctx.buf) {
+        return;
+    }
+
+    int16_t v[APP_HISTORY_METRICS];
+    v[APP_HISTORY_PACK_VOLT] = history_sat16(data->pack_volt / 10);
+    v[APP_HISTORY_PACK_CURRENT] = history_sat16(data->pack_current / 10);
+    v[APP_HISTORY_TEMP1] = history_sat16(data->temp1);
+    v[APP_HISTORY_TEMP2] = history_sat16(data->temp2);
+    v[APP_HISTORY_TEMP3] = history_sat16(data->temp3);
+    v[APP_HISTORY_SOC] = data->soc_percent;
+
+    // Cell chưa đo (0) không tính vào min
+    uint16_t cell_min = UINT16_MAX;
+    uint16_t cell_max = 0;
+    for (int i = 0; i < 13; i++) {
+        uint16_t cell = data->cell_volt[i];
+        if (cell) {
+            cell_min = cell < cell_min ? cell : cell_min;
+            cell_max = cell > cell_max ? cell : cell_max;
+        }
+    }
+    v[APP_HISTORY_CELL_MIN] = history_sat16(cell_max ? cell_min : 0);
+    v[APP_HISTORY_CELL_MAX] = history_sat16(cell_max);
+
+    history_acc_t sample = {.samples = 1};
+    for (int m = 0; m < APP_HISTORY_METRICS; m++) {
+        sample.min[m] = v[m];
+        sample.max[m] = v[m];
+        sample.sum[m] = v[m];
+    }
+
+    portENTER_CRITICAL(&hist_ctx.lock);
+    if (hist_ctx.buf) {
+        history_fold(slot, (uint32_t)(now_us / 1000000), &sample);
+        hist_ctx.samples++;
+    }
+    portEXIT_CRITICAL(&hist_ctx.lock);
+}
+
+size_t
+app_history_read(uint8_t slot, uint8_t tier, size_t skip, app_history_point_t* out, size_t max) {
+    size_t n = 0;
+    if (slot >= TOTAL_SLOT || !out) {
+        return 0;
+    }
+
+    // Chốt vị trí bucket mới nhất rồi chép từng điểm một, không giữ spinlock suốt cả đoạn
+    const history_ring_t* ring = &hist_ctx.rings[slot][tier < APP_HISTORY_MAX_TIERS ? tier : 0];
+    portENTER_CRITICAL(&hist_ctx.lock);
+    bool valid = hist_ctx.buf && tier < hist_ctx.num_tiers && skip < ring->count;
+    uint32_t newest = valid ? ring->stored - 1 - (uint32_t)skip : 0;
+    portEXIT_CRITICAL(&hist_ctx.lock);
+    if (!valid) {
+        return 0;
+    }
+
+    while (n < max && n <= newest) {
+        uint32_t seq = newest - (uint32_t)n;
+        bool copied = false;
+        portENTER_CRITICAL(&hist_ctx.lock);
+        // Dừng khi bucket đã bị ghi đè hoặc store vừa được init lại
+        if (hist_ctx.buf && tier < hist_ctx.num_tiers && seq < ring->stored && ring->stored - seq <= ring->count) {
+            out[n] = ring->points[seq % hist_ctx.tiers[tier].points];
+            copied = true;
+        }
+        portEXIT_CRITICAL(&hist_ctx.lock);
+        if (!copied) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+void
+app_history_get_stats(app_history_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    portENTER_CRITICAL(&hist_ctx.lock);
+    stats->bytes = hist_ctx.bytes;
+    for (uint8_t t = 0; t < hist_ctx.num_tiers; t++) {
+        stats->capacity[t] = hist_ctx.tiers[t].points;
+        for (uint8_t slot = 0; slot < TOTAL_SLOT; slot++) {
+            stats->used[t] += hist_ctx.rings[slot][t].count;
+        }
+    }
+    stats->samples = hist_ctx.samples;
+    stats->overwritten = hist_ctx.overwritten;
+    portEXIT_CRITICAL(&hist_ctx.lock);
+}
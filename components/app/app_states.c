@@ -1,4 +1,5 @@
 #include "app_states.h"
+#include <string.h>
 #include "esp_timer.h"
 
 static const char* TAG = "HSM";
@@ -35,6 +36,102 @@ esp_timer_handle_t timer_loading;
 esp_timer_handle_t timer_update;
 esp_timer_handle_t timer_clock;
 
+// HEVT_TIMER_UPDATE chỉ đến từ task esp_timer nên các màn hình dùng chung một bản sao
+static app_station_snapshot_t timer_snap;
+
+/* Station snapshot */
+void
+app_station_publish(app_state_hsm_t* me) {
+    uint32_t seq = atomic_load_explicit(&me->station_seq, memory_order_relaxed);
+    app_station_snapshot_t* back = &me->station[(seq + 1) & 1];
+
+    // Lần tăng seq trước phải thấy được trước khi ghi đè buffer mà reader cũ có thể đang đọc
+    atomic_thread_fence(memory_order_release);
+    back->version = seq + 1;
+    memcpy(back->bms_data, me->bms_data, sizeof(back->bms_data));
+    back->bms_info = me->bms_info;
+    memcpy(back->slot_rx, me->slot_rx, sizeof(back->slot_rx));
+    back->info_rx = me->info_rx;
+    back->num_extra = me->num_extra;
+    memcpy(back->extra, me->extra, sizeof(back->extra));
+    atomic_store_explicit(&me->station_seq, seq + 1, memory_order_release);
+}
+
+void
+app_station_read(app_state_hsm_t* me, app_station_snapshot_t* snap) {
+    uint32_t seq;
+
+    // Writer luôn ghi buffer còn lại nên chỉ đọc lại khi có publish xen giữa
+    do {
+        seq = atomic_load_explicit(&me->station_seq, memory_order_acquire);
+        memcpy(snap, &me->station[seq & 1], sizeof(*snap));
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&me->station_seq, memory_order_relaxed) != seq);
+}
+
+int32_t
+app_station_slot_age_ms(const app_station_snapshot_t* snap, uint8_t slot, int64_t now_us) {
+    if (slot >= TOTAL_SLOT || snap->slot_rx[slot].time_us == 0) {
+        return INT32_MAX;
+    }
+    int64_t age_ms = (now_us - snap->slot_rx[slot].time_us) / 1000;
+    return age_ms < INT32_MAX ? (int32_t)age_ms : INT32_MAX;
+}
+
+// Mất kết nối: coi mọi slot là trống để màn hình không hiển thị số liệu cũ
+static void
+app_station_blank_if_lost(const app_state_hsm_t* me, app_station_snapshot_t* snap) {
+    if (me->is_bms_not_connected) {
+        for (int i = 0; i < TOTAL_SLOT; i++) {
+            snap->bms_info.slot_state[i] = BMS_SLOT_EMPTY;
+        }
+    }
+}
+
+/* Modbus writes - staged or queued, never block the HSM on the bus */
+static void
+app_modbus_write_done(const modbus_master_request_t* req, esp_err_t err, void* arg) {
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Write reg %u = %u failed: %s", req->reg_addr, req->values[0], esp_err_to_name(err));
+    }
+}
+
+// Trả về số thứ tự lệnh khi được gom (theo dõi được qua modbus_master_get_command_state), 0 nếu xếp hàng
+static uint32_t
+app_modbus_write(modbus_master_lane_t lane, uint16_t reg_addr, uint16_t value) {
+    uint32_t seq = 0;
+
+    // Lệnh vận hành (1006-1008) được gom lại và ghi cùng lần đọc trạng thái trạm kế tiếp
+    if (lane == MODBUS_MASTER_LANE_COMMAND
+        && modbus_master_stage_register(APP_MODBUS_SLAVE_ID, reg_addr, value, app_modbus_write_done, NULL, &seq)
+               == ESP_OK) {
+        return seq;
+    }
+
+    // Không gom được thì xếp hàng: worker ghi vùng gom chứa thanh ghi này trước, nên không vượt giá trị cũ
+    esp_err_t err = modbus_master_write_register_async(lane, APP_MODBUS_SLAVE_ID, reg_addr, value,
+                                                       app_modbus_write_done, NULL, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Queue write reg %u failed: %s", reg_addr, esp_err_to_name(err));
+    }
+    return 0;
+}
+
+// Lệnh đã được trạm đọc lại đúng giá trị, hoặc chờ quá lâu (ghi lỗi đã được log ở app_modbus_write_done)
+static bool
+app_modbus_command_settled(uint16_t reg_addr, uint32_t seq, int64_t sent_us) {
+    modbus_master_command_state_t state;
+    if (modbus_master_get_command_state(APP_MODBUS_SLAVE_ID, reg_addr, &state) != ESP_OK
+        || state.seq_confirmed >= seq) {
+        return true;
+    }
+    if (esp_timer_get_time() - sent_us > (int64_t)APP_COMMAND_CONFIRM_MS * 1000) {
+        ESP_LOGW(TAG, "Command #%lu on reg %u not read back", (unsigned long)seq, reg_addr);
+        return true;
+    }
+    return false;
+}
+
 void
 app_state_hsm_init(app_state_hsm_t* me) {
     /* Create timer */
@@ -65,7 +162,7 @@ app_state_hsm_init(app_state_hsm_t* me) {
     hsm_state_create(&app_state_manual1, "s_manual1", app_state_manual1_handler, &app_state_main_common);
     hsm_state_create(&app_state_manual2, "s_manual2", app_state_manual2_handler, &app_state_main_common);
     hsm_state_create(&app_state_process, "s_process", app_state_process_handler, &app_state_main_common);
-    hsm_state_create(&app_state_setting, "s_setting", app_state_setting_handler, NULL);
+    hsm_state_create(&app_state_setting, "s_setting", app_state_setting_handler, &app_state_main_common);
 
     /* Init HSM */
     hsm_init((hsm_t *)me, "app", &app_state_loading);
@@ -110,7 +207,7 @@ app_state_loading_handler(hsm_t* hsm, hsm_event_t event, void* data) {
 
 static hsm_event_t
 app_state_main_common_handler(hsm_t* hsm, hsm_event_t event, void* data) {
-    // app_state_hsm_t* me = (app_state_hsm_t *)hsm;
+    app_state_hsm_t* me = (app_state_hsm_t *)hsm;
     switch (event) {
         case HSM_EVENT_ENTRY: break;
         case HSM_EVENT_EXIT: break;
@@ -121,10 +218,12 @@ app_state_main_common_handler(hsm_t* hsm, hsm_event_t event, void* data) {
 
             break;
         case HEVT_MODBUS_CONNECTED: 
-
+            me->is_bms_not_connected = 0;
+            scrmainnotconnectedimg_update(false);
             break;
         case HEVT_MODBUS_NOTCONNECTED: 
-
+            me->is_bms_not_connected = 1;
+            scrmainnotconnectedimg_update(true);
             break;
         default: 
             return event;
@@ -138,43 +237,58 @@ app_state_main_handler(hsm_t* hsm, hsm_event_t event, void* data) {
     switch (event) {
         case HSM_EVENT_ENTRY:
             ui_load_screen(ui_scrMain);
+            me->poll_view = APP_POLL_VIEW_MAIN;
             esp_timer_start_periodic(timer_update, UPDATE_SCREEN_VALUE_MS*1000);
             me->last_time_run = me->time_run;
             me->time_run = 0;
             ESP_LOGI(TAG, "Entered Main State");
             break;
         case HSM_EVENT_EXIT: 
+            me->poll_view = APP_POLL_VIEW_DEFAULT;
             esp_timer_stop(timer_update);
             break;
         case HEVT_TIMER_UPDATE:
+            app_station_read(me, &timer_snap);
             bool slots[5] = {
-                me->bms_info.slot_state[0], 
-                me->bms_info.slot_state[1], 
-                me->bms_info.slot_state[2], 
-                me->bms_info.slot_state[3], 
-                me->bms_info.slot_state[4]
+                timer_snap.bms_info.slot_state[0], 
+                timer_snap.bms_info.slot_state[1], 
+                timer_snap.bms_info.slot_state[2], 
+                timer_snap.bms_info.slot_state[3], 
+                timer_snap.bms_info.slot_state[4]
             };
+            if (me->is_bms_not_connected) {
+                // Mất kết nối: không hiển thị số liệu cũ
+                for (int i = 0; i < 5; i++) slots[i] = false;
+            }
             float voltages[5] = {
-                me->bms_data[0].stack_volt/1000.0, 
-                me->bms_data[1].stack_volt/1000.0, 
-                me->bms_data[2].stack_volt/1000.0, 
-                me->bms_data[3].stack_volt/1000.0, 
-                me->bms_data[4].stack_volt/1000.0
+                timer_snap.bms_data[0].stack_volt/1000.0, 
+                timer_snap.bms_data[1].stack_volt/1000.0, 
+                timer_snap.bms_data[2].stack_volt/1000.0, 
+                timer_snap.bms_data[3].stack_volt/1000.0, 
+                timer_snap.bms_data[4].stack_volt/1000.0
             };
             float percents[5] = {
-                me->bms_data[0].pin_percent, 
-                me->bms_data[1].pin_percent, 
-                me->bms_data[2].pin_percent, 
-                me->bms_data[3].pin_percent, 
-                me->bms_data[4].pin_percent
+                timer_snap.bms_data[0].pin_percent, 
+                timer_snap.bms_data[1].pin_percent, 
+                timer_snap.bms_data[2].pin_percent, 
+                timer_snap.bms_data[3].pin_percent, 
+                timer_snap.bms_data[4].pin_percent
             };
-            scrmainbatslotscontainer_update(slots, voltages, percents);
+            bool stale[5];
+            int64_t now_us = esp_timer_get_time();
+            for (int i = 0; i < 5; i++) {
+                stale[i] = app_station_slot_age_ms(&timer_snap, i, now_us) > BMS_DATA_STALE_MS;
+            }
+            scrmainbatslotscontainer_update(slots, voltages, percents, stale);
             scrmainlasttimelabel_update(me->last_time_run);
-            scrmainstateofchargervalue_update(me->bms_info.swap_state);
+            scrmainstateofchargervalue_update(timer_snap.bms_info.swap_state);
             break;
         case HEVT_TRANS_MAIN_TO_DETAIL:
             hsm_transition((hsm_t *)me, &app_state_detail, NULL, NULL);
             break;
+        case HEVT_TRANS_MAIN_TO_SETTING:
+            hsm_transition((hsm_t *)me, &app_state_setting, NULL, NULL);
+            break;
         case HEVT_TRANS_MAIN_TO_MANUAL1:
             hsm_transition((hsm_t *)me, &app_state_manual1, NULL, NULL);
             break;
@@ -191,20 +305,26 @@ static hsm_event_t app_state_detail_handler(hsm_t* hsm, hsm_event_t event, void*
     
     switch (event) {
         case HSM_EVENT_ENTRY:
+            me->poll_view = APP_POLL_VIEW_DETAIL;
             esp_timer_start_periodic(timer_update, UPDATE_SCREEN_VALUE_MS*1000);
             ESP_LOGI(TAG, "Entered Detail State");
             break;
         case HSM_EVENT_EXIT: 
+            me->poll_view = APP_POLL_VIEW_DEFAULT;
             esp_timer_stop(timer_update);
             break;
         case HEVT_TIMER_UPDATE:
+            app_station_read(me, &timer_snap);
+            app_station_blank_if_lost(me, &timer_snap);
             scrdetaildataslottitlelabel_update(me->present_slot_display);
             scrdetaildataslotvalue_update(
-                        &me->bms_data[me->present_slot_display],
-                        me->bms_info.slot_state[me->present_slot_display]);
+                        &timer_snap.bms_data[me->present_slot_display],
+                        timer_snap.bms_info.slot_state[me->present_slot_display],
+                        app_station_slot_age_ms(&timer_snap, me->present_slot_display, esp_timer_get_time())
+                            > BMS_DATA_STALE_MS);
             scrdetailslotssttcontainer_update(
-                        me->bms_info.slot_state,
-                        me->bms_data,
+                        timer_snap.bms_info.slot_state,
+                        timer_snap.bms_data,
                         me->present_slot_display);
             break;
         case HEVT_TRANS_DETAIL_TO_MAIN:
@@ -260,71 +380,66 @@ app_state_manual2_handler(hsm_t* hsm, hsm_event_t event, void* data) {
             esp_timer_stop(timer_update);
             break;
         case HEVT_TIMER_UPDATE:
+            app_station_read(me, &timer_snap);
         bool slots[5] = {
-                me->bms_info.slot_state[0], 
-                me->bms_info.slot_state[1], 
-                me->bms_info.slot_state[2], 
-                me->bms_info.slot_state[3], 
-                me->bms_info.slot_state[4]
+                timer_snap.bms_info.slot_state[0], 
+                timer_snap.bms_info.slot_state[1], 
+                timer_snap.bms_info.slot_state[2], 
+                timer_snap.bms_info.slot_state[3], 
+                timer_snap.bms_info.slot_state[4]
             };
+            if (me->is_bms_not_connected) {
+                // Mất kết nối: không hiển thị số liệu cũ
+                for (int i = 0; i < 5; i++) slots[i] = false;
+            }
             float voltages[5] = {
-                me->bms_data[0].stack_volt/1000.0, 
-                me->bms_data[1].stack_volt/1000.0, 
-                me->bms_data[2].stack_volt/1000.0, 
-                me->bms_data[3].stack_volt/1000.0, 
-                me->bms_data[4].stack_volt/1000.0
+                timer_snap.bms_data[0].stack_volt/1000.0, 
+                timer_snap.bms_data[1].stack_volt/1000.0, 
+                timer_snap.bms_data[2].stack_volt/1000.0, 
+                timer_snap.bms_data[3].stack_volt/1000.0, 
+                timer_snap.bms_data[4].stack_volt/1000.0
             };
             float percents[5] = {
-                me->bms_data[0].pin_percent, 
-                me->bms_data[1].pin_percent, 
-                me->bms_data[2].pin_percent, 
-                me->bms_data[3].pin_percent, 
-                me->bms_data[4].pin_percent
+                timer_snap.bms_data[0].pin_percent, 
+                timer_snap.bms_data[1].pin_percent, 
+                timer_snap.bms_data[2].pin_percent, 
+                timer_snap.bms_data[3].pin_percent, 
+                timer_snap.bms_data[4].pin_percent
             };
             scrmanual2slotinfolabel_update(slots, voltages, percents);
             break;
         case HEVT_MANUAL2_SELECT_SLOT1:
-            me->bms_info.manual_swap_request = (me->manual_robot_bat_select - 1)*5 + 1;
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_MANUAL_CONTROL_REG, 
-                        me->bms_info.manual_swap_request);
+            app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_MANUAL_CONTROL_REG,
+                        (me->manual_robot_bat_select - 1)*5 + 1);
             me->manual_robot_bat_select = 0;
             hsm_transition((hsm_t *)me, &app_state_process, NULL, NULL);
             break;
         case HEVT_MANUAL2_SELECT_SLOT2:
-            me->bms_info.manual_swap_request = (me->manual_robot_bat_select - 1)*5 + 2;
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_MANUAL_CONTROL_REG, 
-                        me->bms_info.manual_swap_request);
+            app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_MANUAL_CONTROL_REG,
+                        (me->manual_robot_bat_select - 1)*5 + 2);
             me->manual_robot_bat_select = 0;
             hsm_transition((hsm_t *)me, &app_state_process, NULL, NULL);
             break;
         case HEVT_MANUAL2_SELECT_SLOT3:
-            me->bms_info.manual_swap_request = (me->manual_robot_bat_select - 1)*5 + 3;
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_MANUAL_CONTROL_REG, 
-                        me->bms_info.manual_swap_request);
+            app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_MANUAL_CONTROL_REG,
+                        (me->manual_robot_bat_select - 1)*5 + 3);
             me->manual_robot_bat_select = 0;
             hsm_transition((hsm_t *)me, &app_state_process, NULL, NULL);
             break;
         case HEVT_MANUAL2_SELECT_SLOT4:
-            me->bms_info.manual_swap_request = (me->manual_robot_bat_select - 1)*5 + 4;
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_MANUAL_CONTROL_REG, 
-                        me->bms_info.manual_swap_request);
+            app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_MANUAL_CONTROL_REG,
+                        (me->manual_robot_bat_select - 1)*5 + 4);
             me->manual_robot_bat_select = 0;
             hsm_transition((hsm_t *)me, &app_state_process, NULL, NULL);
             break;
         case HEVT_MANUAL2_SELECT_SLOT5: 
-            me->bms_info.manual_swap_request = (me->manual_robot_bat_select - 1)*5 + 5;
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_MANUAL_CONTROL_REG, 
-                        me->bms_info.manual_swap_request);
+            app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_MANUAL_CONTROL_REG,
+                        (me->manual_robot_bat_select - 1)*5 + 5);
             me->manual_robot_bat_select = 0;
             hsm_transition((hsm_t *)me, &app_state_process, NULL, NULL);
             break;
@@ -340,27 +455,38 @@ app_state_manual2_handler(hsm_t* hsm, hsm_event_t event, void* data) {
 static hsm_event_t app_state_process_handler(hsm_t* hsm, hsm_event_t event, void* data) {
     app_state_hsm_t* me = (app_state_hsm_t *)hsm;
     static bool is_paused = false;
+    static uint32_t pause_seq = 0; // Lệnh pause/resume chưa được trạm đọc lại
+    static int64_t pause_sent_us = 0;
     switch (event) {
         case HSM_EVENT_ENTRY: 
+            me->poll_view = APP_POLL_VIEW_PROCESS;
             esp_timer_start_periodic(timer_update, UPDATE_SCREEN_VALUE_MS*1000);
             esp_timer_start_periodic(timer_clock, 1000*1000);
             break;
         case HSM_EVENT_EXIT: 
+            me->poll_view = APP_POLL_VIEW_DEFAULT;
             esp_timer_stop(timer_update);
             esp_timer_stop(timer_clock);
             is_paused = false;
+            pause_seq = 0;
+            scrprocessprbutton_update(false, false);
             break;
         case HEVT_TIMER_UPDATE:
-            scrprocessslotssttcontainer_update(me->bms_info.slot_state, me->bms_data);
+            app_station_read(me, &timer_snap);
+            app_station_blank_if_lost(me, &timer_snap);
+            scrprocessslotssttcontainer_update(timer_snap.bms_info.slot_state, timer_snap.bms_data);
             scrprocessruntimevalue_update(me->time_run);
-            scrprocessstatevalue_update(me->bms_info.swap_state);
-
-            if(me->bms_info.complete_swap) {
-                me->bms_info.complete_swap = 0;
-                modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_COMPLETE_SWAP_REG, 
-                        me->bms_info.complete_swap);
+            scrprocessstatevalue_update(timer_snap.bms_info.swap_state);
+            if (pause_seq && app_modbus_command_settled(MB_COMMON_PAUSE_RESUME_REG, pause_seq, pause_sent_us)) {
+                pause_seq = 0;
+                scrprocessprbutton_update(is_paused, false);
+            }
+
+            if(timer_snap.bms_info.complete_swap && !me->is_bms_not_connected) {
+                // Bản làm việc thuộc task poll; lần đọc kế tiếp sẽ thấy thanh ghi đã về 0
+                app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_COMPLETE_SWAP_REG,
+                        0);
                 hsm_transition((hsm_t *)me, &app_state_main, NULL, NULL);
             }
             break;
@@ -372,31 +498,26 @@ static hsm_event_t app_state_process_handler(hsm_t* hsm, hsm_event_t event, void
             }
             break;
         case HEVT_PROCESS_PR_BUTTON_CLICKED:
-            lv_obj_t* button = ui_comp_get_child(ui_scrprocessprcontainer, UI_COMP_BUTTONCONTAINER_BUTTON);
-            lv_obj_t* label = ui_comp_get_child(ui_scrprocessprcontainer, UI_COMP_BUTTONCONTAINER_BUTONLABEL);
-            if(!is_paused) {
-                // Pause
-                is_paused = true;
-                lv_obj_set_style_bg_color(button, lv_color_hex(0x1A6538), LV_PART_MAIN);
-                lv_label_set_text(label, "resume");
+            if (pause_seq) {
+                break; // Lệnh trước chưa được trạm xác nhận
+            }
+            is_paused = !is_paused;
+            if (is_paused) {
                 esp_timer_stop(timer_clock);
             } else {
-                // Resume
-                is_paused = false;
-                lv_obj_set_style_bg_color(button, lv_color_hex(0x2095F6), LV_PART_MAIN);
-                lv_label_set_text(label, "pause");
                 esp_timer_start_periodic(timer_clock, 1000*1000);
             }
 
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_PAUSE_RESUME_REG, 
+            // Nút bị khoá tới khi trạm đọc lại đúng giá trị vừa ghi
+            pause_seq = app_modbus_write(MODBUS_MASTER_LANE_COMMAND,
+                        MB_COMMON_PAUSE_RESUME_REG,
                         is_paused);
+            pause_sent_us = esp_timer_get_time();
+            scrprocessprbutton_update(is_paused, pause_seq != 0);
             break;
         case HEVT_PROCESS_ST_BUTTON_CLICKED:
-            modbus_master_write_single_register(
-                        APP_MODBUS_SLAVE_ID, 
-                        MB_COMMON_E_STOP_REG, 
+            app_modbus_write(MODBUS_MASTER_LANE_SAFETY,
+                        MB_COMMON_E_STOP_REG,
                         1);
             hsm_transition((hsm_t *)me, &app_state_main, NULL, NULL);            
             break;
@@ -414,8 +535,27 @@ app_state_setting_handler(hsm_t* hsm, hsm_event_t event, void* data) {
     switch (event) {
         case HSM_EVENT_ENTRY:
             ESP_LOGI(TAG, "Entered Setting State");
+            esp_timer_start_periodic(timer_update, UPDATE_SCREEN_VALUE_MS*1000);
             break;
         case HSM_EVENT_EXIT: 
+            esp_timer_stop(timer_update);
+            break;
+        case HEVT_TIMER_UPDATE:
+            modbus_master_slave_stats_t stats;
+            modbus_master_recovery_stats_t recovery;
+            modbus_master_link_info_t link;
+            bool has_stats = modbus_master_get_stats(APP_MODBUS_SLAVE_ID, &stats) == ESP_OK;
+            bool has_link = modbus_master_get_link_info(APP_MODBUS_SLAVE_ID, &link) == ESP_OK;
+            modbus_master_get_recovery_stats(&recovery);
+
+            // Trạm phụ chưa có giao dịch nào thì link để Unknown
+            modbus_master_link_info_t extra_link[APP_MAX_EXTRA_STATIONS] = {0};
+            app_station_read(me, &timer_snap);
+            for (uint8_t i = 0; i < timer_snap.num_extra; i++) {
+                modbus_master_get_link_info(timer_snap.extra[i].slave_addr, &extra_link[i]);
+            }
+            scrsettingmodbusstats_update(has_stats ? &stats : NULL, &recovery, has_link ? &link : NULL,
+                                         timer_snap.extra, extra_link, timer_snap.num_extra, esp_timer_get_time());
             break;
         case HEVT_TRANS_BACK_TO_MAIN:
             hsm_transition((hsm_t *)me, &app_state_main, NULL, NULL);
@@ -23,10 +23,21 @@ static const char* TAG = "UI_HELPERS";
 
 #define TAG "UI"
 
+// Chỉ đổi text khi nội dung khác, tránh invalidate và vẽ lại label không đổi
+static void label_set_text_if_changed(lv_obj_t* label, const char* text)
+{
+    const char* current = lv_label_get_text(label);
+    if (current && strcmp(current, text) == 0) {
+        return;
+    }
+    lv_label_set_text(label, text);
+}
+
 void scrmainbatslotscontainer_update(
     const bool has_slot[5],
     const float voltages[5],
-    const float percents[5])
+    const float percents[5],
+    const bool stale[5])
 {
     if (!ui_lock(-1)) {
         ESP_LOGE(TAG, "Failed to lock UI");
@@ -36,10 +47,21 @@ void scrmainbatslotscontainer_update(
     char summaryText[256];
     summaryText[0] = '\0';
 
+    // Số liệu cũ tô xám bằng recolor, cả 5 slot chung một label
+    if (!lv_label_get_recolor(ui_scrmainbatslotslabel)) {
+        lv_label_set_recolor(ui_scrmainbatslotslabel, true);
+    }
+    lv_obj_t* bars[5] = {ui_scrmainbatslot1bar, ui_scrmainbatslot2bar, ui_scrmainbatslot3bar,
+                         ui_scrmainbatslot4bar, ui_scrmainbatslot5bar};
+
     for (int i = 0; i < 5; i++) {
         char line[64];
 
-        if (has_slot[i]) {
+        if (has_slot[i] && stale[i]) {
+            snprintf(line, sizeof(line),
+                     "#%06X %.1fV#\n#%06X %.1f%%#",
+                     COLOR_OTHER, voltages[i], COLOR_OTHER, percents[i]);
+        } else if (has_slot[i]) {
             snprintf(line, sizeof(line),
                      "%.1fV\n%.1f%%",
                      voltages[i], percents[i]);
@@ -64,11 +86,16 @@ void scrmainbatslotscontainer_update(
             }
         }
 
+        lv_opa_t bar_opa = has_slot[i] && stale[i] ? LV_OPA_50 : LV_OPA_COVER;
+        if (lv_obj_get_style_opa(bars[i], LV_PART_MAIN) != bar_opa) {
+            lv_obj_set_style_opa(bars[i], bar_opa, LV_PART_MAIN);
+        }
+
         strcat(summaryText, line);
         if (i < 4) strcat(summaryText, "\n\n");
     }
 
-    lv_label_set_text(ui_scrmainbatslotslabel, summaryText);
+    label_set_text_if_changed(ui_scrmainbatslotslabel, summaryText);
 
     ui_unlock();
 }
@@ -93,7 +120,23 @@ void scrmainlasttimelabel_update(uint16_t seconds)
         snprintf(timeText, sizeof(timeText), "%us", secs);
     }
 
-    lv_label_set_text(ui_scrmainlasttimelabel, timeText);
+    label_set_text_if_changed(ui_scrmainlasttimelabel, timeText);
+
+    ui_unlock();
+}
+
+void scrmainnotconnectedimg_update(bool not_connected)
+{
+    if (!ui_lock(-1)) {
+        ESP_LOGE(TAG, "Failed to lock UI");
+        return;
+    }
+
+    if (not_connected) {
+        lv_obj_clear_flag(ui_scrmainnotconnectedimg, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        lv_obj_add_flag(ui_scrmainnotconnectedimg, LV_OBJ_FLAG_HIDDEN);
+    }
 
     ui_unlock();
 }
@@ -143,7 +186,7 @@ void scrmainstateofchargervalue_update(BMS_Swap_State_t state)
             break;
     }
 
-    lv_label_set_text(ui_scrmainstateofchargervalue, stateText);
+    label_set_text_if_changed(ui_scrmainstateofchargervalue, stateText);
 
     ui_unlock();
 }
@@ -164,7 +207,7 @@ void scrdetaildataslottitlelabel_update(SlotIndex_t index)
     char buf[16]; // đủ để chứa "SLOT X"
     snprintf(buf, sizeof(buf), "SLOT %d", index + 1);
 
-    lv_label_set_text(ui_scrdetaildataslottitlelabel, buf);
+    label_set_text_if_changed(ui_scrdetaildataslottitlelabel, buf);
 
     ui_unlock();
 }
@@ -215,7 +258,7 @@ void scrdetailslotssttcontainer_update(
     ui_unlock();
 }
 
-void scrdetaildataslotvalue_update(const BMS_Data_t* data, BMS_Slot_State_t state)
+void scrdetaildataslotvalue_update(const BMS_Data_t* data, BMS_Slot_State_t state, bool stale)
 {
     if (!ui_lock(-1)) {
         ESP_LOGE(TAG, "Failed to lock UI");
@@ -373,9 +416,18 @@ void scrdetaildataslotvalue_update(const BMS_Data_t* data, BMS_Slot_State_t stat
         );
     }
 
-    lv_label_set_text(ui_scrdetaildataslotvalue1, col1);
-    lv_label_set_text(ui_scrdetaildataslotvalue2, col2);
-    lv_label_set_text(ui_scrdetaildataslotvalue3, col3);
+    label_set_text_if_changed(ui_scrdetaildataslotvalue1, col1);
+    label_set_text_if_changed(ui_scrdetaildataslotvalue2, col2);
+    label_set_text_if_changed(ui_scrdetaildataslotvalue3, col3);
+
+    // Số liệu cũ hơn BMS_DATA_STALE_MS: làm mờ chữ, opa của object vẫn dành cho hiệu ứng chuyển slot
+    lv_opa_t text_opa = (state != BMS_SLOT_EMPTY && stale) ? LV_OPA_50 : LV_OPA_COVER;
+    lv_obj_t* values[3] = {ui_scrdetaildataslotvalue1, ui_scrdetaildataslotvalue2, ui_scrdetaildataslotvalue3};
+    for (int i = 0; i < 3; i++) {
+        if (lv_obj_get_style_text_opa(values[i], LV_PART_MAIN) != text_opa) {
+            lv_obj_set_style_text_opa(values[i], text_opa, LV_PART_MAIN);
+        }
+    }
 
     ui_unlock();
 }
@@ -408,7 +460,7 @@ void scrmanual2slotinfolabel_update(
         if (i < 4) strcat(summaryText, "\n\n");
     }
 
-    lv_label_set_text(ui_scrmanual2slotinfolabel, summaryText);
+    label_set_text_if_changed(ui_scrmanual2slotinfolabel, summaryText);
 
     ui_unlock();
 }
@@ -452,6 +504,27 @@ void scrprocessslotssttcontainer_update(
 
     ui_unlock();
 }
+void scrprocessprbutton_update(bool paused, bool pending)
+{
+    if (!ui_lock(-1)) {
+        ESP_LOGE(TAG, "Failed to lock UI");
+        return;
+    }
+
+    lv_obj_t* button = ui_comp_get_child(ui_scrprocessprcontainer, UI_COMP_BUTTONCONTAINER_BUTTON);
+    lv_obj_t* label = ui_comp_get_child(ui_scrprocessprcontainer, UI_COMP_BUTTONCONTAINER_BUTONLABEL);
+
+    lv_obj_set_style_bg_color(button, lv_color_hex(paused ? 0x1A6538 : 0x2095F6), LV_PART_MAIN);
+    label_set_text_if_changed(label, paused ? "resume" : "pause");
+    // Chờ trạm xác nhận lệnh: không cho bấm tiếp
+    if (pending) {
+        lv_obj_add_state(button, LV_STATE_DISABLED);
+    } else {
+        lv_obj_clear_state(button, LV_STATE_DISABLED);
+    }
+
+    ui_unlock();
+}
 void scrprocessruntimevalue_update(uint16_t seconds)
 {
     if (!ui_lock(-1)) {
@@ -472,7 +545,7 @@ void scrprocessruntimevalue_update(uint16_t seconds)
         snprintf(timeText, sizeof(timeText), "%us", secs);
     }
 
-    lv_label_set_text(ui_scrprocessruntimevalue, timeText);
+    label_set_text_if_changed(ui_scrprocessruntimevalue, timeText);
 
     ui_unlock();
 }
@@ -522,7 +595,109 @@ void scrprocessstatevalue_update(BMS_Swap_State_t state)
             break;
     }
 
-    lv_label_set_text(ui_scrprocessstatevalue, stateText);
+    label_set_text_if_changed(ui_scrprocessstatevalue, stateText);
+
+    ui_unlock();
+}
+void scrsettingmodbusstats_update(const modbus_master_slave_stats_t* stats,
+                                  const modbus_master_recovery_stats_t* recovery,
+                                  const modbus_master_link_info_t* link,
+                                  const app_extra_station_t* extra, const modbus_master_link_info_t* extra_link,
+                                  uint8_t num_extra, int64_t now_us)
+{
+    static const char* link_text[] = {"Unknown", "Online", "Suspect", "Offline"};
+    static char text[1536]; // Chỉ gọi từ HSM, tránh chiếm stack timer
+    size_t len = 0;
+
+    if (link) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        "Slave %d: %s   timeout %lums   p99 %.1fms   late %lu   probes %lu\n",
+                        APP_MODBUS_SLAVE_ID, link_text[link->state], link->timeout_ms,
+                        link->rtt_p99_us / 1000.0, link->late, link->probes);
+    } else {
+        len += snprintf(text + len, sizeof(text) - len, "Slave %d: no traffic\n", APP_MODBUS_SLAVE_ID);
+    }
+
+    // Trạm phụ: link và nhóm trạng thái trạm đọc được lần cuối
+    for (uint8_t i = 0; i < num_extra && len < sizeof(text); i++) {
+        const BMS_Information_t* info = &extra[i].bms_info;
+        if (!extra[i].info_rx.time_us) {
+            len += snprintf(text + len, sizeof(text) - len, "Slave %d: %s   no data\n", extra[i].slave_addr,
+                            link_text[extra_link[i].state]);
+            continue;
+        }
+        len += snprintf(text + len, sizeof(text) - len,
+                        "Slave %d: %s   swap %d   slots %d %d %d %d %d   age %lldms\n",
+                        extra[i].slave_addr, link_text[extra_link[i].state], info->swap_state,
+                        info->slot_state[IDX_SLOT_1], info->slot_state[IDX_SLOT_2], info->slot_state[IDX_SLOT_3],
+                        info->slot_state[IDX_SLOT_4], info->slot_state[IDX_SLOT_5],
+                        (now_us - extra[i].info_rx.time_us) / 1000);
+    }
+
+    if (stats) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        "Since %lus\nFC   req      ok       timeout  crc    exc    error  retry  tx/rx kB       avg/max ms\n",
+                        stats->since_ms / 1000);
+
+        for (int i = 0; i < MODBUS_MASTER_STATS_FCS && stats->fc[i].fc && len < sizeof(text); i++) {
+            const modbus_master_fc_stats_t* fc = &stats->fc[i];
+            float avg_ms = fc->ok ? (float)fc->latency_sum_us / fc->ok / 1000.0f : 0.0f;
+            len += snprintf(text + len, sizeof(text) - len,
+                            "%02X   %-8lu %-8lu %-8lu %-6lu %-6lu %-6lu %-6lu %.1f/%.1f     %.1f/%.1f\n",
+                            fc->fc, fc->requests, fc->ok, fc->timeouts, fc->crc_errors, fc->exceptions,
+                            fc->errors, fc->retries,
+                            fc->tx_bytes / 1024.0f, fc->rx_bytes / 1024.0f,
+                            avg_ms, fc->latency_max_us / 1000.0f);
+        }
+
+        // Histogram: <1 <2 <5 <10 <20 <50 <100 <200 <500 >=500 ms
+        if (len < sizeof(text)) {
+            len += snprintf(text + len, sizeof(text) - len, "Latency ms  <1 <2 <5 <10 <20 <50 <100 <200 <500 >500\n");
+        }
+        for (int i = 0; i < MODBUS_MASTER_STATS_FCS && stats->fc[i].fc && len < sizeof(text); i++) {
+            len += snprintf(text + len, sizeof(text) - len, "%02X  ", stats->fc[i].fc);
+            for (int b = 0; b < MODBUS_MASTER_LATENCY_BUCKETS && len < sizeof(text); b++) {
+                len += snprintf(text + len, sizeof(text) - len, " %lu", stats->fc[i].latency_hist[b]);
+            }
+            if (len < sizeof(text)) {
+                len += snprintf(text + len, sizeof(text) - len, "\n");
+            }
+        }
+    }
+
+    if (recovery && len < sizeof(text)) {
+        snprintf(text + len, sizeof(text) - len,
+                 "Recovery ok/attempt: resync %lu/%lu  retry %lu/%lu  rebuild %lu/%lu  last %.1fms",
+                 recovery->resync_ok, recovery->resync_attempts,
+                 recovery->retry_ok, recovery->retry_attempts,
+                 recovery->rebuild_ok, recovery->rebuild_attempts,
+                 recovery->last_recovery_us / 1000.0);
+    }
+
+    if (!ui_lock(-1)) {
+        ESP_LOGE(TAG, "Failed to lock UI");
+        return;
+    }
+
+    // Label tạo ở đây thay vì trong ui_scrSetting.c, file đó do SquareLine sinh lại
+    static lv_obj_t* stats_label = NULL;
+    if (!stats_label || !lv_obj_is_valid(stats_label)) {
+        stats_label = NULL;
+        if (ui_scrSetting) {
+            stats_label = lv_label_create(ui_scrSetting);
+            lv_obj_set_width(stats_label, 760);
+            lv_obj_set_height(stats_label, LV_SIZE_CONTENT);
+            lv_obj_set_x(stats_label, 20);
+            lv_obj_set_y(stats_label, 20);
+            lv_obj_set_style_text_color(stats_label, lv_color_hex(0x314C83), LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_set_style_text_opa(stats_label, 255, LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_set_style_text_align(stats_label, LV_TEXT_ALIGN_LEFT, LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_set_style_text_font(stats_label, &lv_font_montserrat_14, LV_PART_MAIN | LV_STATE_DEFAULT);
+        }
+    }
+    if (stats_label) {
+        label_set_text_if_changed(stats_label, text);
+    }
 
     ui_unlock();
-}
\ No newline at end of file
+}
@@ -14,6 +14,9 @@ extern "C" {
 #define APP_IO_UART_RX_PIN        15 // RS485_RX
 #define APP_IO_UART_RTS_PIN       -1 // Auto direction switching
 #define APP_MODBUS_SLAVE_ID       1  // Modbus slave ID for BMS
+#define APP_MODBUS_BAUDRATE       115200
+#define APP_MODBUS_SLAVE_WEIGHT   2  // Bus share of the displayed station vs. supervised ones
+#define APP_MODBUS_MAX_STATIONS   4  // Stations polled on the RS485 segment
 // ============================================
 // Hardware Pin Definitions
 // ============================================
@@ -0,0 +1,128 @@
+#ifndef APP_HISTORY_H
+#define APP_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "app_states.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define APP_HISTORY_MAX_TIERS 4
+
+/**
+ * @brief Recorded values, stored as int16_t
+ */
+typedef enum {
+    APP_HISTORY_PACK_VOLT = 0, // 10 mV
+    APP_HISTORY_PACK_CURRENT,  // 10 mA, signed
+    APP_HISTORY_TEMP1,         // 0.1 °C
+    APP_HISTORY_TEMP2,         // 0.1 °C
+    APP_HISTORY_TEMP3,         // 0.1 °C
+    APP_HISTORY_SOC,           // %
+    APP_HISTORY_CELL_MIN,      // mV, lowest non-zero cell
+    APP_HISTORY_CELL_MAX,      // mV, highest cell
+    APP_HISTORY_METRICS,
+} app_history_metric_t;
+
+/**
+ * @brief Resolution and length of one tier
+ *
+ * Tier 0 folds raw samples into period_s buckets; each following tier folds
+ * the closed buckets of the previous one, so its period must be a multiple of
+ * the previous period.
+ */
+typedef struct {
+    uint32_t period_s; // Bucket length
+    uint32_t points;   // Buckets kept, oldest overwritten
+} app_history_tier_t;
+
+/**
+ * @brief Min/max/mean of one value over a bucket
+ */
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+} app_history_agg_t;
+
+/**
+ * @brief One closed bucket
+ */
+typedef struct {
+    uint32_t time_s;                          // Bucket start, seconds of esp_timer time
+    uint16_t samples;                         // Raw samples folded in (saturates at 65535)
+    app_history_agg_t v[APP_HISTORY_METRICS];
+} app_history_point_t;
+
+/**
+ * @brief Memory and counters of the store
+ */
+typedef struct {
+    size_t bytes;                             // PSRAM held by the rings
+    uint32_t capacity[APP_HISTORY_MAX_TIERS]; // Buckets per slot and tier
+    uint32_t used[APP_HISTORY_MAX_TIERS];     // Buckets held, summed over slots
+    uint32_t samples;                         // Raw samples appended
+    uint32_t overwritten;                     // Buckets lost to ring wrap, all tiers
+} app_history_stats_t;
+
+/**
+ * @brief Allocate the rings in PSRAM
+ *
+ * Memory is fixed at init: TOTAL_SLOT * sum(points) * sizeof(app_history_point_t).
+ *
+ * @param tiers Tiers, finest first (copied)
+ * @param num_tiers 1..APP_HISTORY_MAX_TIERS
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if PSRAM is short
+ */
+esp_err_t app_history_init(const app_history_tier_t* tiers, uint8_t num_tiers);
+
+/**
+ * @brief Free the rings
+ */
+void app_history_deinit(void);
+
+/**
+ * @brief Record one sample of a slot (called from the poll path)
+ *
+ * O(number of tiers): the sample is folded into the open tier 0 bucket; a
+ * bucket is closed into its ring and rolled up into the next tier when a
+ * sample of a later bucket arrives.
+ *
+ * @param slot Slot index
+ * @param data Decoded BMS data
+ * @param now_us esp_timer time of the sample
+ */
+void app_history_append(uint8_t slot, const BMS_Data_t* data, int64_t now_us);
+
+/**
+ * @brief Copy closed buckets of a slot and tier, newest first
+ *
+ * The lock is held for one bucket at a time, so max may be large. Buckets
+ * closed during the call are not returned; the copy stops early at a bucket
+ * overwritten during the call.
+ *
+ * @param slot Slot index
+ * @param tier Tier index
+ * @param skip Newest buckets to skip
+ * @param out Destination
+ * @param max Buckets to copy at most
+ * @return Buckets copied
+ */
+size_t app_history_read(uint8_t slot, uint8_t tier, size_t skip, app_history_point_t* out, size_t max);
+
+/**
+ * @brief Get the memory use and counters
+ *
+ * @param stats Output
+ */
+void app_history_get_stats(app_history_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APP_HISTORY_H
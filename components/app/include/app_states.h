@@ -1,6 +1,7 @@
 #ifndef APP_STATES_H
 #define APP_STATES_H
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include "sdkconfig.h"
 
@@ -38,6 +39,8 @@ extern "C" {
 
 #define LOADING_1PERCENT_MS             100     
 #define UPDATE_SCREEN_VALUE_MS          1000     
+#define BMS_DATA_STALE_MS               10000    // Slot không nhận được lâu hơn thế này thì hiển thị mờ
+#define APP_COMMAND_CONFIRM_MS          3000     // Chờ trạm đọc lại lệnh vận hành tối đa chừng này
 
 
 #define BMS_RUN_TIMEOUT                 (60*3)
@@ -196,6 +199,32 @@ typedef struct {
     uint16_t complete_swap;
 } BMS_Information_t;
 
+// Lần nhận gần nhất của một block thanh ghi, kể cả khi giá trị không đổi
+typedef struct {
+    int64_t time_us; // esp_timer (đơn điệu), 0 = chưa nhận lần nào
+    uint32_t seq;    // Số lần nhận
+} app_block_rx_t;
+
+// Trạm phụ trên cùng segment RS485: chỉ đọc nhóm trạng thái trạm
+typedef struct {
+    uint8_t slave_addr;
+    BMS_Information_t bms_info;
+    app_block_rx_t info_rx;
+} app_extra_station_t;
+
+#define APP_MAX_EXTRA_STATIONS (APP_MODBUS_MAX_STATIONS - 1)
+
+// Ảnh dữ liệu trạm nhất quán cho UI: mọi trường cùng một lần publish
+typedef struct {
+    uint32_t version; // Số lần publish
+    BMS_Data_t bms_data[TOTAL_SLOT];
+    BMS_Information_t bms_info;
+    app_block_rx_t slot_rx[TOTAL_SLOT];
+    app_block_rx_t info_rx;
+    uint8_t num_extra;
+    app_extra_station_t extra[APP_MAX_EXTRA_STATIONS];
+} app_station_snapshot_t;
+
 typedef enum {
     HEVT_LOOP = HSM_EVENT_USER,
 
@@ -213,6 +242,7 @@ typedef enum {
 
     HEVT_TRANS_MAIN_TO_DETAIL,
     HEVT_TRANS_MAIN_TO_MANUAL1,
+    HEVT_TRANS_MAIN_TO_SETTING,
 
     HEVT_TRANS_DETAIL_TO_MAIN,
     HEVT_TRANS_DETAIL_TO_MANUAL1,
@@ -239,11 +269,29 @@ typedef enum {
 
 
 
+// Màn hình đang xem, task poll chọn profile theo đó
+typedef enum {
+    APP_POLL_VIEW_DEFAULT = 0, // Loading, manual, setting: chu kỳ mặc định
+    APP_POLL_VIEW_MAIN,
+    APP_POLL_VIEW_DETAIL,      // Ưu tiên slot present_slot_display
+    APP_POLL_VIEW_PROCESS,
+    TOTAL_POLL_VIEW,
+} app_poll_view_t;
+
 typedef struct {
     hsm_t parent;
 
+    // Bản làm việc, chỉ task poll Modbus ghi; UI đọc qua app_station_read()
     BMS_Data_t bms_data[TOTAL_SLOT];
     BMS_Information_t bms_info;
+    app_block_rx_t slot_rx[TOTAL_SLOT];
+    app_block_rx_t info_rx;
+    uint8_t num_extra;
+    app_extra_station_t extra[APP_MAX_EXTRA_STATIONS];
+
+    // Seqlock 2 buffer: station[station_seq & 1] là ảnh hiện hành, publish ghi buffer kia rồi tăng seq
+    atomic_uint_fast32_t station_seq;
+    app_station_snapshot_t station[2];
     
     uint16_t time_run;
     uint16_t last_time_run;
@@ -253,19 +301,28 @@ typedef struct {
     uint8_t manual_robot_bat_select;
 
     uint8_t is_bms_not_connected;
+
+    volatile app_poll_view_t poll_view; // Ghi bởi HSM, đọc bởi task poll
 } app_state_hsm_t;
 
 void app_state_hsm_init(app_state_hsm_t* me);
 
+// Station snapshot: one writer (Modbus poll task), any number of readers without a mutex
+void app_station_publish(app_state_hsm_t* me);
+void app_station_read(app_state_hsm_t* me, app_station_snapshot_t* snap);
+int32_t app_station_slot_age_ms(const app_station_snapshot_t* snap, uint8_t slot, int64_t now_us); // INT32_MAX = never
+
 
 // UI main screen
-void scrmainbatslotscontainer_update(const bool has_slot[5], const float voltages[5], const float percents[5]);
+void scrmainbatslotscontainer_update(const bool has_slot[5], const float voltages[5], const float percents[5],
+                                     const bool stale[5]);
 void scrmainlasttimelabel_update(uint16_t seconds);
 void scrmainstateofchargervalue_update(BMS_Swap_State_t state);
+void scrmainnotconnectedimg_update(bool not_connected);
 // UI detail screen
 void scrdetaildataslottitlelabel_update(SlotIndex_t index);
 void scrdetailslotssttcontainer_update(const BMS_Slot_State_t state[TOTAL_SLOT], const BMS_Data_t data[TOTAL_SLOT], uint16_t current_slot);
-void scrdetaildataslotvalue_update(const BMS_Data_t* data, BMS_Slot_State_t state);
+void scrdetaildataslotvalue_update(const BMS_Data_t* data, BMS_Slot_State_t state, bool stale);
 // UI manual 2 screen
 void scrmanual2slotinfolabel_update(const bool has_slot[5], const float voltages[5], const float percents[5]);
 
@@ -273,6 +330,14 @@ void scrmanual2slotinfolabel_update(const bool has_slot[5], const float voltages
 void scrprocessslotssttcontainer_update(const BMS_Slot_State_t state[TOTAL_SLOT], const BMS_Data_t data[TOTAL_SLOT]);
 void scrprocessruntimevalue_update(uint16_t seconds);
 void scrprocessstatevalue_update(BMS_Swap_State_t state);
+void scrprocessprbutton_update(bool paused, bool pending);
+
+// UI Setting screen
+void scrsettingmodbusstats_update(const modbus_master_slave_stats_t* stats,
+                                  const modbus_master_recovery_stats_t* recovery,
+                                  const modbus_master_link_info_t* link,
+                                  const app_extra_station_t* extra, const modbus_master_link_info_t* extra_link,
+                                  uint8_t num_extra, int64_t now_us);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,123 @@
+#ifndef MODBUS_MASTER_CAPTURE_H
+#define MODBUS_MASTER_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_MASTER_CAPTURE_TAG "MBCAP" // Prefix of dumped lines
+
+/**
+ * @brief Direction of a captured frame
+ */
+typedef enum {
+    MODBUS_MASTER_CAPTURE_TX = 0, // Request, master to slave
+    MODBUS_MASTER_CAPTURE_RX,     // Response, slave to master
+} modbus_master_capture_dir_t;
+
+/**
+ * @brief One captured frame
+ *
+ * Frames are kept in RTU form (address + PDU + CRC) whatever the transport.
+ * Only frames heard by the sniffer are the bytes seen on the wire. Frames of
+ * the manager's own transactions are re-encoded from the transaction on
+ * every transport, and a response is only recorded when it decoded, so
+ * corrupt or malformed replies never appear in the capture.
+ */
+typedef struct {
+    int64_t timestamp_us;            // esp_timer time
+    modbus_master_capture_dir_t dir;
+    uint16_t len;                    // ADU length, CRC included
+    const uint8_t* adu;
+} modbus_master_capture_rec_t;
+
+/**
+ * @brief Counters of the capture ring
+ */
+typedef struct {
+    size_t size;      // Ring size in bytes
+    uint32_t frames;  // Frames held
+    uint32_t total;   // Frames recorded since start
+    uint32_t dropped; // Oldest frames overwritten, or frames missed during a dump
+} modbus_master_capture_stats_t;
+
+/**
+ * @brief Allocate the capture ring in PSRAM and start recording
+ *
+ * Once full, the oldest frames are overwritten.
+ *
+ * @param size Ring size in bytes
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if PSRAM is short
+ */
+esp_err_t modbus_master_capture_start(size_t size);
+
+/**
+ * @brief Stop recording, captured frames are kept
+ */
+void modbus_master_capture_stop(void);
+
+/**
+ * @brief Stop recording and free the ring
+ */
+void modbus_master_capture_free(void);
+
+/**
+ * @brief Drop the captured frames, recording continues
+ */
+void modbus_master_capture_clear(void);
+
+/**
+ * @brief Check whether frames are being recorded
+ *
+ * @return true if recording
+ */
+bool modbus_master_capture_active(void);
+
+/**
+ * @brief Record one frame (called by the manager)
+ *
+ * @param dir Direction
+ * @param adu RTU frame, CRC included
+ * @param len Frame length
+ */
+void modbus_master_capture_record(modbus_master_capture_dir_t dir, const uint8_t* adu, uint16_t len);
+
+/**
+ * @brief Print the captured frames to the console, oldest first
+ *
+ * One line per frame: "MBCAP <timestamp_us> <T|R> <hex>". Recording pauses
+ * while dumping; frames missed meanwhile are counted as dropped.
+ *
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if nothing was captured
+ */
+esp_err_t modbus_master_capture_dump(void);
+
+/**
+ * @brief Get the ring counters
+ *
+ * @param stats Output counters
+ */
+void modbus_master_capture_get_stats(modbus_master_capture_stats_t* stats);
+
+/**
+ * @brief Parse one dumped line
+ *
+ * Anything before the "MBCAP" tag (e.g. a monitor prefix) is ignored.
+ *
+ * @param line Text line
+ * @param rec Filled on success, rec->adu points to buf
+ * @param buf Frame buffer, 256 bytes
+ * @return true if the line held a frame
+ */
+bool modbus_master_capture_parse_line(const char* line, modbus_master_capture_rec_t* rec, uint8_t* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODBUS_MASTER_CAPTURE_H
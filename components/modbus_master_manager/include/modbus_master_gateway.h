@@ -0,0 +1,104 @@
+#ifndef MODBUS_MASTER_GATEWAY_H
+#define MODBUS_MASTER_GATEWAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_MASTER_GATEWAY_MAX_BLOCKS  8
+#define MODBUS_MASTER_GATEWAY_AGE_UNIT_MS 100    // Resolution of the age registers
+#define MODBUS_MASTER_GATEWAY_AGE_NEVER   0xFFFF // Age of a block never read from the station
+#define MODBUS_MASTER_GATEWAY_STACK_SIZE  4096
+#define MODBUS_MASTER_GATEWAY_PRIORITY    3      // Below the poll task
+
+/**
+ * @brief Link the gateway answers on
+ */
+typedef enum {
+    MODBUS_MASTER_GATEWAY_TCP = 0, // Modbus TCP server
+    MODBUS_MASTER_GATEWAY_RTU,     // Modbus RTU slave on a second UART
+} modbus_master_gateway_link_t;
+
+/**
+ * @brief Holding register block mirrored from the station
+ */
+typedef struct {
+    uint16_t reg_addr;
+    uint16_t reg_count;
+} modbus_master_gateway_block_t;
+
+/**
+ * @brief Gateway configuration
+ *
+ * The blocks keep the station's own addresses, so downstream masters read the
+ * same map as on the station. Block k's age, in MODBUS_MASTER_GATEWAY_AGE_UNIT_MS
+ * since the oldest of its registers was read, is served at age_reg_addr + k.
+ */
+typedef struct {
+    modbus_master_gateway_link_t link;
+    uint8_t unit_id;                             // Slave address / unit identifier answered
+    uint8_t source_addr;                         // Station whose responses are mirrored
+    const modbus_master_gateway_block_t* blocks; // Copied, may be temporary
+    uint8_t num_blocks;                          // 1..MODBUS_MASTER_GATEWAY_MAX_BLOCKS
+    uint16_t age_reg_addr;                       // First age register, must not overlap a block
+    // TCP
+    void* netif;                                 // esp_netif_t* to listen on
+    uint16_t tcp_port;                           // 0 = 502
+    // RTU
+    int uart_port;                               // Must differ from the station bus
+    int tx_pin;                                  // Required, no UART_PIN_NO_CHANGE
+    int rx_pin;                                  // Required, no UART_PIN_NO_CHANGE
+    int rts_pin;                                 // DE/RE, -1 for auto direction
+    uint32_t baudrate;                           // 8N1
+} modbus_master_gateway_config_t;
+
+/**
+ * @brief Gateway counters
+ */
+typedef struct {
+    uint32_t frames;  // Station responses mirrored
+    uint32_t dropped; // Responses overwritten in the frame ring before the gateway took them
+} modbus_master_gateway_stats_t;
+
+/**
+ * @brief Start serving the cached station registers as a Modbus slave
+ *
+ * Every successful holding register read of source_addr published by the
+ * manager (own polls, sniffed and replayed responses) is copied into the
+ * gateway image. Reads are answered from the image, so downstream masters add
+ * no traffic to the station bus. The image is read only.
+ *
+ * @param config Configuration
+ * @return ESP_OK if successful, ESP_ERR_INVALID_ARG on a bad configuration
+ *         (e.g. RTU without TX or RX pin)
+ */
+esp_err_t modbus_master_gateway_start(const modbus_master_gateway_config_t* config);
+
+/**
+ * @brief Stop the gateway and free the image
+ */
+void modbus_master_gateway_stop(void);
+
+/**
+ * @brief Check whether the gateway is serving
+ *
+ * @return true if started
+ */
+bool modbus_master_gateway_running(void);
+
+/**
+ * @brief Get the gateway counters
+ *
+ * @param stats Output counters
+ */
+void modbus_master_gateway_get_stats(modbus_master_gateway_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODBUS_MASTER_GATEWAY_H
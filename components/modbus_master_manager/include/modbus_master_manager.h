@@ -4,24 +4,107 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Transport carrying the Modbus frames
+ *
+ * The HMI firmware only selects the RS485 transports. MODBUS_MASTER_TRANSPORT_TCP
+ * needs a network interface brought up by the application, which this firmware
+ * does not do, so it is library-only here and not exercised by the tree.
+ */
+typedef enum {
+    MODBUS_MASTER_TRANSPORT_RTU = 0,    // RS485 through esp-modbus
+    MODBUS_MASTER_TRANSPORT_TCP,        // Modbus TCP, pipelined by MBAP transaction ID
+    MODBUS_MASTER_TRANSPORT_RTU_NATIVE, // RS485 through the built-in engine (modbus_master_rtu.h)
+} modbus_master_transport_t;
+
 /**
  * @brief Modbus Master configuration structure
  */
 typedef struct {
+    modbus_master_transport_t transport;
     int uart_port;     // UART port (UART_NUM_1, UART_NUM_2)
     int tx_pin;        // TX GPIO pin
     int rx_pin;        // RX GPIO pin
     int rts_pin;       // RTS GPIO pin (DE/RE for RS485)
     uint32_t baudrate; // Baudrate (9600, 19200, 115200...)
+    uint8_t duty_cycle; // Max bus duty cycle in % for slow slaves (0 = back-to-back)
+    uint32_t response_timeout_ms; // Response timeout ceiling (0 = derived from baudrate)
+    const char* tcp_host;     // TCP: server host name or address
+    uint16_t tcp_port;        // TCP: server port (0 = 502)
+    uint8_t tcp_max_inflight; // TCP: outstanding transactions (0 = 1)
 } modbus_master_config_t;
 
+/**
+ * @brief One read of a batch
+ */
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t command;    // 0x03=Holding, 0x04=Input
+    uint16_t reg_addr;
+    uint16_t reg_count;
+    uint16_t* data;     // Destination buffer
+    esp_err_t result;   // Set by modbus_master_read_multiple()
+} modbus_master_read_t;
+
+/**
+ * @brief Baudrate negotiation
+ *
+ * Every candidate rate is qualified with a burst of reads of one register;
+ * the fastest one within the error budget is kept and stored in NVS so the
+ * next boot tries it first.
+ */
+typedef struct {
+    const uint32_t* rates;       // Candidate baudrates, any order
+    uint8_t num_rates;           // <= MODBUS_MASTER_BAUD_MAX_RATES
+    uint8_t slave_addr;          // Slave qualified and watched for errors
+    uint16_t probe_reg;          // Holding register read by the qualification burst
+    uint16_t burst;              // Reads per qualification burst (0 = MODBUS_MASTER_BAUD_BURST)
+    uint16_t max_error_permille; // Error budget of a burst and of live traffic (0 = MODBUS_MASTER_BAUD_ERRORS)
+    const char* nvs_namespace;   // Where the chosen rate is stored (NULL = not stored)
+    bool rescan;                 // Probe faster rates even if the stored one qualifies
+} modbus_master_baud_config_t;
+
+/**
+ * @brief Progress of the commands staged on one control register
+ *
+ * Sequence numbers grow with every modbus_master_stage_register() call, so
+ * a caller can tell whether its command (or a later one) was written
+ * (acked) and seen again in a read of the register (confirmed).
+ */
+typedef struct {
+    uint16_t value;         // Value on the slave, last written or read back
+    bool known;             // False until written or read, or after a failed write
+    uint32_t seq_staged;    // Latest command
+    uint32_t seq_acked;     // Latest command written
+    uint32_t seq_confirmed; // Latest command read back with its value
+} modbus_master_command_state_t;
+
+/**
+ * @brief Bus timing derived from the baudrate and measured on the wire
+ */
+typedef struct {
+    uint32_t char_us;           // One RTU character (11 bits)
+    uint32_t t35_us;            // Minimum inter-frame silence
+    uint32_t turnaround_us;     // Smoothed slave turnaround
+    uint32_t turnaround_max_us; // Worst slave turnaround seen
+    uint32_t last_txn_us;       // Last request-to-response time
+    uint8_t duty_cycle;         // Active duty cycle cap in % (0 = none)
+    uint64_t busy_us;           // Time spent in transactions since init, of every lane (sample as deltas)
+} modbus_master_timing_t;
+
 /**
  * @brief Callback when new Modbus data is received
+ *
+ * Runs in the task that issued the read, after the bus has been released.
+ * Consumers that should not hold up the reading task use a frame reader
+ * (modbus_master_reader_register()) instead.
  * 
  * @param slave_addr Slave address
  * @param reg_type Register type (0x03=Holding, 0x04=Input)
@@ -32,6 +115,189 @@ typedef struct {
 typedef void (*modbus_master_data_callback_t)(uint8_t slave_addr, uint8_t reg_type, uint16_t reg_addr, uint16_t* data,
                                               uint16_t length);
 
+#define MODBUS_MASTER_REQ_INLINE_REGS   16 // Write payload copied into the request
+#define MODBUS_MASTER_MAX_SLAVES         8  // Slaves tracked for link health
+#define MODBUS_MASTER_RTT_WINDOW         32 // Round-trip samples per slave
+#define MODBUS_MASTER_TIMEOUT_P99_FACTOR 3  // Adaptive timeout = p99 x factor
+#define MODBUS_MASTER_TIMEOUT_MIN_MS     20
+#define MODBUS_MASTER_PROBE_INTERVAL_MS  500 // Probe period of an offline slave
+#define MODBUS_MASTER_RESYNC_ATTEMPTS    4    // RX flushes while waiting for a silent t3.5
+#define MODBUS_MASTER_RETRY_ATTEMPTS     3    // Probes after resync, backoff doubling
+#define MODBUS_MASTER_RETRY_BACKOFF_MS   5
+#define MODBUS_MASTER_REBUILD_AFTER_MS   5000 // Offline time before rebuilding the controller
+#define MODBUS_MASTER_STATS_FCS          8    // Function codes tracked per slave
+#define MODBUS_MASTER_LATENCY_BUCKETS    10   // Latency histogram buckets
+#define MODBUS_MASTER_TCP_TIMEOUT_MS     1000 // Default response timeout over TCP
+#define MODBUS_MASTER_BATCH_MAX          8    // Reads per modbus_master_read_multiple() call
+#define MODBUS_MASTER_STAGE_SLOTS        4    // Slaves with staged writes at once
+#define MODBUS_MASTER_STAGE_REGS         16   // Register window of one staging area (dirty bits)
+#define MODBUS_MASTER_STAGE_WINDOW_MS    250  // Staged writes flushed on their own after this
+#define MODBUS_MASTER_SHADOW_REGS        16   // Control registers tracked for de-duplication
+#define MODBUS_MASTER_SHADOW_FRESH_MS    100  // Read-back age still trusted for de-duplication (station poll period)
+#define MODBUS_MASTER_FRAME_RING         8    // Frames kept for readers (power of two)
+#define MODBUS_MASTER_FRAME_REGS         125  // Registers of one frame (FC 0x03/0x04 maximum)
+#define MODBUS_MASTER_MAX_READERS        4    // Tasks notified of new frames
+#define MODBUS_MASTER_SNIFF_SLICE_MS     10   // Longest bus hold while listening
+#define MODBUS_MASTER_BAUD_MAX_RATES     8    // Candidate baudrates
+#define MODBUS_MASTER_BAUD_BURST         50   // Reads of a qualification burst
+#define MODBUS_MASTER_BAUD_ERRORS        10   // Error budget in per mille
+#define MODBUS_MASTER_BAUD_WINDOW        200  // Live transactions judged at once for fallback
+#define MODBUS_MASTER_BAUD_NVS_KEY       "baud"
+#define MODBUS_MASTER_WORKER_STACK_SIZE 4096
+#define MODBUS_MASTER_WORKER_PRIORITY   5 // Above the poll task so queued writes win the bus
+
+/**
+ * @brief Link state of one slave
+ */
+typedef enum {
+    MODBUS_MASTER_LINK_UNKNOWN = 0, // No transaction yet
+    MODBUS_MASTER_LINK_ONLINE,      // Answering
+    MODBUS_MASTER_LINK_SUSPECT,     // Missed once, probe pending
+    MODBUS_MASTER_LINK_OFFLINE,     // Probe failed, only probed periodically
+} modbus_master_link_state_t;
+
+/**
+ * @brief Link health of one slave
+ */
+typedef struct {
+    modbus_master_link_state_t state;
+    uint32_t timeout_ms;  // Adaptive response timeout (p99 x factor, clamped)
+    uint32_t rtt_p99_us;  // p99 request-to-response time over the recent window
+    uint32_t late;        // Responses slower than timeout_ms
+    uint32_t probes;      // Single-register probes sent
+} modbus_master_link_info_t;
+
+/**
+ * @brief Link recovery counters, one pair per tier
+ */
+typedef struct {
+    uint32_t resync_attempts;  // Tier 1: RX flush + frame resync, then probe
+    uint32_t resync_ok;
+    uint32_t retry_attempts;   // Tier 2: probe with exponential backoff
+    uint32_t retry_ok;
+    uint32_t rebuild_attempts; // Tier 3: controller stop/delete/create
+    uint32_t rebuild_ok;
+    uint32_t last_recovery_us; // First miss to link restored, last recovery
+} modbus_master_recovery_stats_t;
+
+/**
+ * @brief Bus counters of one function code on one slave
+ */
+typedef struct {
+    uint8_t fc;               // Function code (0 = unused entry)
+    uint32_t requests;        // Transactions issued by callers
+    uint32_t ok;
+    uint32_t timeouts;        // No response within the response timeout
+    uint32_t crc_errors;      // Corrupt response (native RTU; esp-modbus reports these as exceptions)
+    uint32_t exceptions;      // Exception response
+    uint32_t errors;          // Malformed response or transport failure
+    uint32_t retries;         // Recovery probes issued after a miss
+    uint32_t tx_bytes;        // RTU bytes sent, CRC included
+    uint32_t rx_bytes;        // RTU bytes received, CRC included
+    uint32_t latency_max_us;
+    uint64_t latency_sum_us;  // Over successful transactions
+    uint32_t latency_hist[MODBUS_MASTER_LATENCY_BUCKETS]; // See modbus_master_latency_bucket_us()
+} modbus_master_fc_stats_t;
+
+/**
+ * @brief Bus counters of one slave
+ */
+typedef struct {
+    uint8_t slave_addr;
+    uint32_t since_ms; // Time since counters were last reset
+    modbus_master_fc_stats_t fc[MODBUS_MASTER_STATS_FCS];
+} modbus_master_slave_stats_t;
+
+/**
+ * @brief Callback when a slave connects or disconnects
+ *
+ * Runs in the task that issued the transaction, after the bus has been
+ * released, so it may take other locks or block. Several changes within one
+ * bus hold are reported once, with the final state.
+ *
+ * @param slave_addr Slave address
+ * @param connected true when the slave answers again
+ */
+typedef void (*modbus_master_link_callback_t)(uint8_t slave_addr, bool connected);
+
+/**
+ * @brief Register frame published to readers after each successful read
+ */
+typedef struct {
+    uint32_t seq;          // Publication number, increasing by one per frame
+    uint8_t slave_addr;
+    uint8_t reg_type;      // 0x03=Holding, 0x04=Input
+    uint16_t reg_addr;
+    uint16_t reg_count;
+    int64_t timestamp_us;  // esp_timer time of the response
+    uint16_t data[MODBUS_MASTER_FRAME_REGS];
+} modbus_master_frame_t;
+
+/**
+ * @brief Read position of one consumer in the frame ring
+ */
+typedef struct {
+    uint32_t next;     // Sequence number of the next frame to read
+    uint32_t dropped;  // Frames overwritten before they were read
+    TaskHandle_t task; // Task notified with xTaskNotifyGive when frames are published
+} modbus_master_reader_t;
+
+/**
+ * @brief Callback for registers read by another master, decoded from the bus
+ *
+ * Runs in the task calling modbus_master_sniff(), with the bus released.
+ *
+ * @param slave_addr Slave address
+ * @param reg_type Register type (0x03=Holding, 0x04=Input)
+ * @param reg_addr Starting register address
+ * @param data Registers, host byte order
+ * @param reg_count Number of registers
+ * @param arg User argument
+ */
+typedef void (*modbus_master_sniff_cb_t)(uint8_t slave_addr, uint8_t reg_type, uint16_t reg_addr,
+                                         const uint16_t* data, uint16_t reg_count, void* arg);
+
+/**
+ * @brief Request lanes, served in strict priority order
+ */
+typedef enum {
+    MODBUS_MASTER_LANE_SAFETY = 0, // E-stop and other safety writes
+    MODBUS_MASTER_LANE_COMMAND,    // Operator commands
+    MODBUS_MASTER_LANE_POLL,       // Background polling
+    MODBUS_MASTER_LANE_MAX,
+} modbus_master_lane_t;
+
+typedef struct modbus_master_request modbus_master_request_t;
+
+/**
+ * @brief Completion callback of an asynchronous request
+ *
+ * Runs in the task that executed the request (the Modbus worker, or the
+ * reader that staged writes rode along with); keep it short.
+ *
+ * @param req Completed request (data already filled for reads)
+ * @param err Result of the transaction
+ * @param arg User argument
+ */
+typedef void (*modbus_master_done_cb_t)(const modbus_master_request_t* req, esp_err_t err, void* arg);
+
+/**
+ * @brief Asynchronous request descriptor
+ */
+struct modbus_master_request {
+    uint32_t id;               // Handle, filled by modbus_master_submit()
+    modbus_master_lane_t lane; // Priority lane
+    uint8_t slave_addr;        // Slave address
+    uint8_t command;           // FC 0x01, 0x03, 0x04, 0x05, 0x06 or 0x10
+    uint16_t reg_addr;         // Starting register/coil address
+    uint16_t reg_count;        // Number of registers/coils
+    uint16_t* data;            // Read destination, or write source (NULL = use values[])
+    uint16_t values[MODBUS_MASTER_REQ_INLINE_REGS]; // Inline write payload
+    modbus_master_done_cb_t callback; // Completion callback (may be NULL)
+    void* arg;                        // User argument for callback
+    TaskHandle_t notify_task;         // Task notified with xTaskNotifyGive on completion (may be NULL)
+};
+
 /**
  * @brief Initialize Modbus Master Manager
  * 
@@ -54,6 +320,78 @@ esp_err_t modbus_master_deinit(void);
  */
 void modbus_master_register_callback(modbus_master_data_callback_t callback);
 
+/**
+ * @brief Register a consumer of the frame ring
+ *
+ * Every successful register read is copied into a ring of
+ * MODBUS_MASTER_FRAME_RING frames while the bus is held; the readers are
+ * notified once the bus has been released. The ring is lock-free: a reader
+ * never blocks the bus, and one that falls more than a ring behind skips the
+ * overwritten frames (counted in dropped). Only frames published after
+ * registration are seen.
+ *
+ * @param reader Reader state (must stay valid until unregistered)
+ * @param task Task to notify (NULL = calling task)
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if MODBUS_MASTER_MAX_READERS are registered
+ */
+esp_err_t modbus_master_reader_register(modbus_master_reader_t* reader, TaskHandle_t task);
+
+/**
+ * @brief Unregister a consumer of the frame ring
+ *
+ * @param reader Reader passed to modbus_master_reader_register()
+ */
+void modbus_master_reader_unregister(modbus_master_reader_t* reader);
+
+/**
+ * @brief Take the next frame of a reader
+ *
+ * Call in a loop after each notification until it returns false, so several
+ * frames are handled per wakeup. Only the owning task may call it.
+ *
+ * @param reader Registered reader
+ * @param frame Filled with the frame
+ * @return true if a frame was read, false if the reader has caught up
+ */
+bool modbus_master_reader_next(modbus_master_reader_t* reader, modbus_master_frame_t* frame);
+
+/**
+ * @brief Listen to another master on the bus without transmitting
+ *
+ * Request/response pairs of FC 0x03, 0x04 and 0x17 seen on the wire are
+ * matched, and every response goes through the same data path as our own
+ * reads: the frame ring, the data callback and the given callback. A slave
+ * seen answering is marked online. The bus is taken in slices of
+ * MODBUS_MASTER_SNIFF_SLICE_MS, so queued requests still get through.
+ * Only the native RTU engine can listen; esp-modbus owns its UART. Call from
+ * one task only, typically the poll task while nothing is due.
+ *
+ * @param listen_ms Time to listen
+ * @param callback Called for each decoded response (may be NULL)
+ * @param arg User argument for callback
+ * @return ESP_OK if a response was decoded, ESP_ERR_TIMEOUT if none,
+ *         ESP_ERR_NOT_SUPPORTED unless the transport is MODBUS_MASTER_TRANSPORT_RTU_NATIVE
+ */
+esp_err_t modbus_master_sniff(uint32_t listen_ms, modbus_master_sniff_cb_t callback, void* arg);
+
+/**
+ * @brief Feed a recorded capture through the data path
+ *
+ * The capture is the text of modbus_master_capture_dump(). Responses are
+ * matched to their requests as in modbus_master_sniff() and delivered to the
+ * frame ring, the data callback and the given callback, with the recorded
+ * spacing divided by speed. Nothing is transmitted and the manager does not
+ * need to be initialized, so decode, HSM and UI can be exercised without a
+ * station. The same capture always gives the same sequence of callbacks.
+ *
+ * @param capture Dump text, NUL terminated
+ * @param speed 1 = real time, N = N times faster, 0 = as fast as possible
+ * @param callback Called for each response (may be NULL)
+ * @param arg User argument for callback
+ * @return ESP_OK if responses were replayed, ESP_ERR_NOT_FOUND if the capture held none
+ */
+esp_err_t modbus_master_replay(const char* capture, uint16_t speed, modbus_master_sniff_cb_t callback, void* arg);
+
 /**
  * @brief Read Holding Registers (FC 0x03)
  * 
@@ -99,6 +437,48 @@ esp_err_t modbus_master_write_single_register(uint8_t slave_addr, uint16_t reg_a
 esp_err_t modbus_master_write_multiple_registers(uint8_t slave_addr, uint16_t reg_addr, uint16_t reg_count,
                                                  uint16_t* data);
 
+/**
+ * @brief Write then read holding registers in one transaction (FC 0x17)
+ *
+ * The slave applies the write before the read. esp-modbus only issues FC 0x17
+ * over RTU when both ranges are identical; otherwise the write and the read
+ * go out back to back under the same bus lock. TCP and the native RTU engine
+ * send any pair of ranges as one FC 0x17. The read is made even if a split
+ * write fails.
+ *
+ * @param slave_addr Slave address
+ * @param rd_addr First register read
+ * @param rd_count Registers read (<= 125)
+ * @param rd_data Buffer to store read data
+ * @param wr_addr First register written
+ * @param wr_count Registers written (<= 121)
+ * @param wr_data Values to write
+ * @return ESP_OK if successful, otherwise the write error if the write failed
+ *         and the read error if not
+ */
+esp_err_t modbus_master_read_write_registers(uint8_t slave_addr, uint16_t rd_addr, uint16_t rd_count,
+                                             uint16_t* rd_data, uint16_t wr_addr, uint16_t wr_count,
+                                             const uint16_t* wr_data);
+
+/**
+ * @brief Run several reads, pipelined when the transport allows it
+ *
+ * Over TCP up to tcp_max_inflight reads are outstanding at once; over RTU
+ * the reads run back to back. Each entry gets its own result.
+ *
+ * @param reads Reads to run (<= MODBUS_MASTER_BATCH_MAX)
+ * @param count Number of reads
+ * @return ESP_OK if all succeeded, otherwise the first failing result
+ */
+esp_err_t modbus_master_read_multiple(modbus_master_read_t* reads, uint8_t count);
+
+/**
+ * @brief Number of transactions the transport keeps in flight
+ *
+ * @return 1 for RTU, tcp_max_inflight for a connected TCP transport
+ */
+uint8_t modbus_master_pipeline_depth(void);
+
 /**
  * @brief Read Coils (FC 0x01)
  * 
@@ -120,6 +500,217 @@ esp_err_t modbus_master_read_coils(uint8_t slave_addr, uint16_t coil_addr, uint1
  */
 esp_err_t modbus_master_write_single_coil(uint8_t slave_addr, uint16_t coil_addr, bool value);
 
+/**
+ * @brief Queue a request without blocking on the bus
+ *
+ * Write payloads up to MODBUS_MASTER_REQ_INLINE_REGS registers given through
+ * data are copied, so the caller buffer may be reused immediately. Read
+ * destinations and larger write sources must stay valid until completion.
+ *
+ * @param req Request to queue (copied)
+ * @param id Set to the request handle (may be NULL)
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if the lane is full
+ */
+esp_err_t modbus_master_submit(const modbus_master_request_t* req, uint32_t* id);
+
+/**
+ * @brief Queue a single register write (FC 0x06)
+ *
+ * @param lane Priority lane
+ * @param slave_addr Slave address
+ * @param reg_addr Register address
+ * @param value Value to write
+ * @param callback Completion callback (may be NULL)
+ * @param arg User argument for callback
+ * @param id Set to the request handle (may be NULL)
+ * @return ESP_OK if queued
+ */
+esp_err_t modbus_master_write_register_async(modbus_master_lane_t lane, uint8_t slave_addr, uint16_t reg_addr,
+                                             uint16_t value, modbus_master_done_cb_t callback, void* arg,
+                                             uint32_t* id);
+
+/**
+ * @brief Stage a register write, batched with other control writes to the slave
+ *
+ * Writes staged within MODBUS_MASTER_STAGE_WINDOW_MS of the first one are
+ * collected in one area of MODBUS_MASTER_STAGE_REGS registers with a dirty
+ * bit each. They are flushed by the next holding-register read of the slave
+ * that covers a dirty register (typically the station poll): every run of
+ * adjacent dirty registers goes out as one FC 0x10 (0x06 for a single
+ * register), and the last run rides with the read as FC 0x17, so its effect
+ * is read back in the same round trip. With the esp-modbus RTU transport FC
+ * 0x17 needs identical ranges, which the station map never has (the poll
+ * reads 1005..1009), so there the last run goes out as its own 0x06/0x10
+ * right before the read under the same bus lock. Each callback gets the
+ * result of its write, not of the read. Registers that are not dirty are
+ * never written. If no such read comes before the window ends, the worker
+ * flushes the area on its own. A COMMAND or POLL lane write queued to a
+ * staged register flushes that area first so it cannot be overtaken; SAFETY
+ * lane writes never wait for a flush and must not target staged registers.
+ *
+ * A later write to a staged register with the same callback replaces the
+ * pending value, so only the latest one is sent. A value the slave already
+ * holds is not sent at all, and cancels an older pending value: the callback
+ * runs at once with ESP_OK. The slave is taken to hold a value when it was
+ * the last one written and no read came since, or when it was read back
+ * less than MODBUS_MASTER_SHADOW_FRESH_MS ago. Its request id is the
+ * command sequence number.
+ *
+ * @param slave_addr Slave address
+ * @param reg_addr Register address
+ * @param value Value to write
+ * @param callback Completion callback, once per register (may be NULL)
+ * @param arg User argument for callback
+ * @param seq Set to the command sequence number (may be NULL)
+ * @return ESP_OK if staged or already on the slave, ESP_ERR_INVALID_STATE if
+ *         the register falls outside the window staged for the slave or is
+ *         pending for another caller, ESP_ERR_NO_MEM if all staging areas are busy
+ */
+esp_err_t modbus_master_stage_register(uint8_t slave_addr, uint16_t reg_addr, uint16_t value,
+                                       modbus_master_done_cb_t callback, void* arg, uint32_t* seq);
+
+/**
+ * @brief Get the progress of the commands staged on a control register
+ *
+ * @param slave_addr Slave address
+ * @param reg_addr Register address
+ * @param state Output
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND if no command was staged on it
+ */
+esp_err_t modbus_master_get_command_state(uint8_t slave_addr, uint16_t reg_addr,
+                                          modbus_master_command_state_t* state);
+
+/**
+ * @brief Get bus timing
+ *
+ * Requests are chained back to back: the next frame starts t3.5 after the
+ * previous response, or later when a duty cycle cap is active.
+ *
+ * @param timing Output timing
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_get_timing(modbus_master_timing_t* timing);
+
+/**
+ * @brief Pick the fastest baudrate the slave sustains
+ *
+ * Call after modbus_master_init(), serial transports only. The rate stored
+ * by a previous negotiation is tried first, then the candidates from the
+ * fastest down. The slave must already listen at the rates probed (e.g.
+ * auto-baud); nothing is written to it.
+ *
+ * Afterwards live transactions with the slave are counted in windows of
+ * MODBUS_MASTER_BAUD_WINDOW; when a window goes over the error budget and a
+ * slower candidate exists, the worker task qualifies the slower candidates
+ * and the first that passes takes over until the next negotiation; it is
+ * not stored, so a noisy episode does not pin the link to a slower rate on
+ * later boots. At the slowest rate a noisy window is only logged.
+ *
+ * Only config->slave_addr is qualified: every other slave on the bus must
+ * follow the same rates, so do not negotiate on a bus shared with other
+ * stations or another master.
+ *
+ * @param config Negotiation parameters, copied
+ * @return ESP_OK if a rate qualified, ESP_ERR_NOT_FOUND if none did (the
+ *         configured rate is kept), ESP_ERR_NOT_SUPPORTED over TCP
+ */
+esp_err_t modbus_master_baud_negotiate(const modbus_master_baud_config_t* config);
+
+/**
+ * @brief Get the baudrate in use
+ *
+ * @return Baudrate, 0 over TCP or before init
+ */
+uint32_t modbus_master_get_baudrate(void);
+
+/**
+ * @brief Limit bus occupancy for slaves that need breathing room
+ *
+ * After a transaction of duration D the bus stays idle for
+ * D * (100 - percent) / percent.
+ *
+ * @param percent Max duty cycle in % (0 or 100 = back-to-back)
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_set_duty_cycle(uint8_t percent);
+
+/**
+ * @brief Register callback for link state changes
+ *
+ * The first timeout on a slave starts recovery: the bus is resynced on a
+ * frame boundary (the RX FIFO is flushed on the native RTU transport, the
+ * TCP connection is reopened), then the slave is probed with backoff. If
+ * that fails the slave is reported disconnected. The bus is released
+ * between recovery steps so the worker can serve the SAFETY lane; recovery
+ * run by the worker itself is abandoned when a SAFETY request is queued. Requests to an
+ * offline slave fail fast without using the bus, and the slave is probed
+ * every MODBUS_MASTER_PROBE_INTERVAL_MS until it answers; after
+ * MODBUS_MASTER_REBUILD_AFTER_MS the controller is rebuilt.
+ *
+ * @param callback Callback function
+ */
+void modbus_master_register_link_callback(modbus_master_link_callback_t callback);
+
+/**
+ * @brief Set the register read by the liveness probe (default 0)
+ *
+ * @param slave_addr Slave address
+ * @param reg_addr Holding register address
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_set_probe_register(uint8_t slave_addr, uint16_t reg_addr);
+
+/**
+ * @brief Get link state of a slave
+ *
+ * @param slave_addr Slave address
+ * @return Link state, MODBUS_MASTER_LINK_UNKNOWN if never addressed
+ */
+modbus_master_link_state_t modbus_master_get_link_state(uint8_t slave_addr);
+
+/**
+ * @brief Get link health of a slave
+ *
+ * The adaptive timeout bounds each transaction to an online slave on the
+ * native RTU and TCP transports; while the link recovers the ceiling is used.
+ * esp-modbus applies a single response timeout fixed at controller creation,
+ * so there the ceiling is the hard limit and the adaptive value is only
+ * reported for tuning and late-response accounting.
+ *
+ * @param slave_addr Slave address
+ * @param info Output link info
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND if never addressed
+ */
+esp_err_t modbus_master_get_link_info(uint8_t slave_addr, modbus_master_link_info_t* info);
+
+/**
+ * @brief Snapshot bus counters of a slave
+ *
+ * Copied under a spinlock without waiting for the bus, so it is safe to call
+ * from a timer callback.
+ *
+ * @param slave_addr Slave address
+ * @param stats Output counters
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND if never addressed
+ */
+esp_err_t modbus_master_get_stats(uint8_t slave_addr, modbus_master_slave_stats_t* stats);
+
+/**
+ * @brief Clear bus counters of all slaves
+ */
+void modbus_master_reset_stats(void);
+
+/**
+ * @brief Upper bound of a latency histogram bucket
+ *
+ * Buckets are 1, 2, 5, 10, 20, 50, 100, 200 and 500 ms; the last bucket
+ * collects everything slower.
+ *
+ * @param bucket Bucket index (< MODBUS_MASTER_LATENCY_BUCKETS)
+ * @return Exclusive upper bound in microseconds, UINT32_MAX for the last bucket
+ */
+uint32_t modbus_master_latency_bucket_us(uint8_t bucket);
+
 /**
  * @brief Check if Modbus Master Manager is running
  * 
@@ -128,11 +719,24 @@ esp_err_t modbus_master_write_single_coil(uint8_t slave_addr, uint16_t coil_addr
 bool modbus_master_is_running(void);
 /**
  * @brief Reset Modbus Master stack (khi mất kết nối)
+ *
+ * Rebuilds the esp-modbus controller (or re-opens the transport). Normally not needed: the manager
+ * recovers the link on its own and rebuilds only as a last resort.
  * 
  * @return ESP_OK if successful
  */
 esp_err_t modbus_master_reset(void);
 
+/**
+ * @brief Get link recovery counters
+ *
+ * Copied under a spinlock without waiting for the bus.
+ *
+ * @param stats Output counters
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_get_recovery_stats(modbus_master_recovery_stats_t* stats);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,137 @@
+#ifndef MODBUS_MASTER_PLAN_H
+#define MODBUS_MASTER_PLAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_MASTER_MAX_READ_REGS    125 // Modbus limit for FC 0x03/0x04
+#define MODBUS_MASTER_PLAN_MAX_BLOCKS  32  // Blocks per plan (fits ok_mask bits)
+#define MODBUS_MASTER_CHUNK_REGS       16  // Change detection granularity (one 32-byte cache line)
+
+/**
+ * @brief Wanted register range and its destination buffer
+ */
+typedef struct {
+    uint16_t reg_addr;  // Starting register address
+    uint16_t reg_count; // Number of registers (<= MODBUS_MASTER_MAX_READ_REGS)
+    uint16_t* data;     // Destination buffer, reg_count registers
+} modbus_master_block_t;
+
+/**
+ * @brief One bus transaction emitted by the planner
+ */
+typedef struct {
+    uint16_t reg_addr;   // First register read on the wire
+    uint16_t reg_count;  // Registers read on the wire (gaps included)
+    uint8_t first_order; // First entry in plan->order[] covered by this transaction
+    uint8_t num_blocks;  // Number of blocks covered
+} modbus_master_txn_t;
+
+/**
+ * @brief Coalesced read plan for one slave
+ */
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t reg_type; // 0x03=Holding, 0x04=Input
+    const modbus_master_block_t* blocks;
+    uint8_t num_blocks;
+    uint8_t order[MODBUS_MASTER_PLAN_MAX_BLOCKS]; // Block indices sorted by address
+    modbus_master_txn_t txns[MODBUS_MASTER_PLAN_MAX_BLOCKS];
+    uint8_t num_txns;
+} modbus_master_plan_t;
+
+/**
+ * @brief Largest register gap worth reading through instead of opening a new frame
+ *
+ * A new RTU transaction costs the request frame, the response header/CRC,
+ * two t3.5 silences and the slave turnaround. Every gap register costs two
+ * bytes on the wire, so reading through is cheaper while the gap stays below
+ * half of that fixed overhead expressed in characters.
+ *
+ * @param baudrate Bus baudrate
+ * @param turnaround_us Expected slave turnaround time in microseconds
+ * @return Gap size in registers
+ */
+uint16_t modbus_master_plan_gap_for_baud(uint32_t baudrate, uint32_t turnaround_us);
+
+/**
+ * @brief Build the minimal set of transactions covering all blocks
+ *
+ * Blocks may be given in any order and may overlap. Neighbouring blocks are
+ * merged while the merged span stays within MODBUS_MASTER_MAX_READ_REGS and
+ * the hole between them is at most max_gap registers.
+ *
+ * @param plan Plan to fill
+ * @param slave_addr Slave address
+ * @param reg_type Register type (0x03=Holding, 0x04=Input)
+ * @param blocks Wanted blocks (must outlive the plan)
+ * @param num_blocks Number of blocks (<= MODBUS_MASTER_PLAN_MAX_BLOCKS)
+ * @param max_gap Largest gap in registers to read through
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_plan_build(modbus_master_plan_t* plan, uint8_t slave_addr, uint8_t reg_type,
+                                   const modbus_master_block_t* blocks, uint8_t num_blocks, uint16_t max_gap);
+
+/**
+ * @brief Copy fresh registers into a block, chunk by chunk
+ *
+ * The block buffer holds the previous raw image; only chunks of
+ * MODBUS_MASTER_CHUNK_REGS registers that differ are compared in and copied.
+ *
+ * @param blk Destination block
+ * @param src Fresh registers, blk->reg_count entries
+ * @return Bitmask of changed chunks, 0 if the block is unchanged
+ */
+uint8_t modbus_master_block_update(const modbus_master_block_t* blk, const uint16_t* src);
+
+/**
+ * @brief Execute one planned transaction and scatter the result into its blocks
+ *
+ * Uses a shared scratch buffer, call from one task only.
+ *
+ * @param plan Plan built with modbus_master_plan_build()
+ * @param txn_index Transaction index (< plan->num_txns)
+ * @param ok_mask Set to the bitmask of block indices refreshed (may be NULL)
+ * @param changed_mask Set to the bitmask of refreshed blocks whose contents changed (may be NULL)
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_plan_execute_txn(const modbus_master_plan_t* plan, uint8_t txn_index, uint32_t* ok_mask,
+                                         uint32_t* changed_mask);
+
+/**
+ * @brief Execute several planned transactions as one batch
+ *
+ * On Modbus TCP the requests are pipelined, on RTU they run back to back.
+ * Blocks of every successful transaction are refreshed even if others fail.
+ * Uses a shared scratch buffer, call from one task only.
+ *
+ * @param plan Plan built with modbus_master_plan_build()
+ * @param txn_index Transaction indices (each < plan->num_txns)
+ * @param count Number of transactions (<= MODBUS_MASTER_BATCH_MAX)
+ * @param ok_mask Set to the bitmask of block indices refreshed (may be NULL)
+ * @param changed_mask Set to the bitmask of refreshed blocks whose contents changed (may be NULL)
+ * @return ESP_OK if all transactions succeeded, otherwise the first error
+ */
+esp_err_t modbus_master_plan_execute_txns(const modbus_master_plan_t* plan, const uint8_t* txn_index, uint8_t count,
+                                          uint32_t* ok_mask, uint32_t* changed_mask);
+
+/**
+ * @brief Execute every transaction of a plan back to back
+ *
+ * @param plan Plan built with modbus_master_plan_build()
+ * @param ok_mask Set to the bitmask of block indices refreshed (may be NULL)
+ * @param changed_mask Set to the bitmask of refreshed blocks whose contents changed (may be NULL)
+ * @return ESP_OK if all transactions succeeded, otherwise the last error
+ */
+esp_err_t modbus_master_plan_execute(const modbus_master_plan_t* plan, uint32_t* ok_mask, uint32_t* changed_mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODBUS_MASTER_PLAN_H
@@ -0,0 +1,142 @@
+#ifndef MODBUS_MASTER_RTU_H
+#define MODBUS_MASTER_RTU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_MASTER_RTU_MAX_ADU   256 // addr + 253 byte PDU + crc(2)
+#define MODBUS_MASTER_RTU_RX_TOUT   3   // RX idle timeout in characters that ends a frame
+
+/**
+ * @brief One Modbus RTU transaction
+ *
+ * Supported function codes: 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x10, 0x17.
+ * Registers are in host byte order, coils packed LSB first as in esp-modbus.
+ * For 0x17 reg_addr/reg_count/data describe the read, wr_* the write; the
+ * two ranges may differ.
+ */
+typedef struct {
+    uint8_t slave_addr;      // Slave address
+    uint8_t command;         // Function code
+    uint16_t reg_addr;       // Starting address
+    uint16_t reg_count;      // Number of registers or coils
+    void* data;              // Read destination or write source; FC 0x05/0x06 take one uint16_t
+    esp_err_t result;        // Set by modbus_master_rtu_transact()
+    uint32_t rtt_us;         // First request byte queued to response complete
+    uint16_t wr_addr;        // FC 0x17: first register written
+    uint16_t wr_count;       // FC 0x17: registers written
+    const uint16_t* wr_data; // FC 0x17: values written
+    uint32_t timeout_ms;     // Response timeout (0 = the one given to modbus_master_rtu_open())
+} modbus_master_rtu_txn_t;
+
+/**
+ * @brief Install the UART driver and configure the port for RS485 RTU
+ *
+ * The end of a response is detected by the UART RX idle timeout
+ * (MODBUS_MASTER_RTU_RX_TOUT characters) or as soon as the expected length
+ * has arrived, whichever comes first.
+ *
+ * @param uart_port UART port
+ * @param tx_pin TX GPIO pin
+ * @param rx_pin RX GPIO pin
+ * @param rts_pin RTS GPIO pin (DE/RE)
+ * @param baudrate Baudrate, 8N1
+ * @param timeout_ms Response timeout
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_rtu_open(int uart_port, int tx_pin, int rx_pin, int rts_pin, uint32_t baudrate,
+                                 uint32_t timeout_ms);
+
+/**
+ * @brief Remove the UART driver
+ */
+void modbus_master_rtu_close(void);
+
+/**
+ * @brief Check whether the port is open
+ *
+ * @return true if open
+ */
+bool modbus_master_rtu_is_open(void);
+
+/**
+ * @brief Compute the Modbus CRC-16 of a buffer (table driven)
+ *
+ * @param buf Data
+ * @param len Length in bytes
+ * @return CRC, sent low byte first
+ */
+uint16_t modbus_master_rtu_crc16(const uint8_t* buf, size_t len);
+
+/**
+ * @brief Encode the request frame of a transaction (address + PDU + CRC)
+ *
+ * @param txn Transaction
+ * @param adu Output, MODBUS_MASTER_RTU_MAX_ADU bytes
+ * @return Frame length, 0 if the function code or count is not supported
+ */
+size_t modbus_master_rtu_encode_request(const modbus_master_rtu_txn_t* txn, uint8_t* adu);
+
+/**
+ * @brief Encode the normal response frame of a completed transaction
+ *
+ * Used to record transactions of transports that do not expose the frames.
+ *
+ * @param txn Transaction, data holding what was read
+ * @param adu Output, MODBUS_MASTER_RTU_MAX_ADU bytes
+ * @return Frame length, 0 if the function code or count is not supported
+ */
+size_t modbus_master_rtu_encode_response(const modbus_master_rtu_txn_t* txn, uint8_t* adu);
+
+/**
+ * @brief Send one request and decode the response into the caller's buffer
+ *
+ * Not thread safe, the manager serializes callers. The request is only sent
+ * once no frame is arriving and the line has been idle for t3.5; a frame
+ * that starts during the wait pushes the send back to its end and is kept
+ * for modbus_master_rtu_listen().
+ *
+ * @param txn Transaction, result and rtt_us filled on return
+ * @return ESP_OK, ESP_ERR_NOT_FINISHED if the line stayed busy for the whole
+ *         response timeout (nothing sent), ESP_ERR_TIMEOUT if no complete response arrived,
+ *         ESP_ERR_INVALID_RESPONSE on exception, ESP_ERR_INVALID_CRC on a corrupt
+ *         frame, ESP_ERR_INVALID_SIZE on a malformed or overrun response
+ */
+esp_err_t modbus_master_rtu_transact(modbus_master_rtu_txn_t* txn);
+
+/**
+ * @brief Wait for a frame sent by another device on the bus
+ *
+ * Used to listen to the traffic of another master. Frames are delimited by
+ * the RX idle timeout; bytes of a frame still arriving when the time runs
+ * out are kept for the next call, as is a frame heard while
+ * modbus_master_rtu_transact() waited for the line.
+ *
+ * @param buf Destination, MODBUS_MASTER_RTU_MAX_ADU bytes
+ * @param len Set to the frame length, CRC included
+ * @param timeout_ms Longest wait
+ * @return ESP_OK if a frame arrived, ESP_ERR_INVALID_CRC if it was corrupt,
+ *         ESP_ERR_TIMEOUT if no frame ended in time
+ */
+esp_err_t modbus_master_rtu_listen(uint8_t* buf, size_t* len, uint32_t timeout_ms);
+
+/**
+ * @brief Drop received bytes, including a partly heard frame
+ *
+ * Used to resync on a frame boundary after a lost response.
+ *
+ * @return Number of bytes dropped
+ */
+size_t modbus_master_rtu_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODBUS_MASTER_RTU_H
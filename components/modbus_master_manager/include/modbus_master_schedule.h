@@ -0,0 +1,283 @@
+#ifndef MODBUS_MASTER_SCHEDULE_H
+#define MODBUS_MASTER_SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "modbus_master_plan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_MASTER_SCHEDULE_MAX_GROUPS MODBUS_MASTER_PLAN_MAX_BLOCKS
+#define MODBUS_MASTER_BUS_MAX_SLAVES      8    // Slave schedules sharing one bus
+#define MODBUS_MASTER_BUS_LOAD_WINDOW_MS  1000 // Bus load measurement window
+
+/**
+ * @brief Register group polled at its own rate
+ */
+typedef struct {
+    const char* name;            // Group name (for logs)
+    modbus_master_block_t block; // Register range and destination buffer
+    uint32_t period_ms;          // Poll period
+    uint32_t deadline_ms;        // Relative deadline after release (0 = period)
+    uint8_t tag;                 // Application defined (e.g. slot index)
+} modbus_master_group_t;
+
+/**
+ * @brief Achieved cadence of one group
+ *
+ * Averages are moving averages over about 8 refreshes.
+ */
+typedef struct {
+    uint32_t polls;         // Refreshes, polled or ingested
+    uint32_t missed;        // Polls, failed ones included, that ended after their deadline
+    uint32_t overruns;      // Releases skipped because the group fell a whole period behind
+    uint32_t period_us;     // Achieved period between refreshes
+    uint32_t jitter_us;     // Deviation of the achieved period from the nominal one
+    uint32_t jitter_max_us; // Largest deviation since the last reset
+    int64_t last_us;        // Time of the last refresh (0 = never)
+} modbus_master_group_stats_t;
+
+/**
+ * @brief Bus time used over the last window
+ */
+typedef struct {
+    uint32_t window_ms;     // Length of the measured window
+    uint32_t busy_ms;       // Time spent in transactions, polls, queued writes and recovery alike
+    uint32_t slack_ms;      // Time left for more groups or stations
+    uint16_t load_permille; // busy / window
+    uint32_t txns;          // Poll rounds run in the window
+} modbus_master_bus_load_t;
+
+/**
+ * @brief Callback after a transaction refreshed one or more groups
+ *
+ * Unchanged groups are reported in group_mask only, so the application can
+ * skip decoding them.
+ *
+ * @param group_mask Bitmask of refreshed group indices
+ * @param changed_mask Bitmask of refreshed groups whose registers changed
+ * @param arg User argument
+ */
+typedef void (*modbus_master_schedule_cb_t)(uint32_t group_mask, uint32_t changed_mask, void* arg);
+
+/**
+ * @brief Earliest-deadline-first poll schedule for one slave
+ */
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t reg_type; // 0x03=Holding, 0x04=Input
+    uint16_t max_gap; // Planner gap threshold
+    const modbus_master_group_t* groups;
+    uint8_t num_groups;
+    int64_t release_us[MODBUS_MASTER_SCHEDULE_MAX_GROUPS];  // Next release time
+    int64_t deadline_us[MODBUS_MASTER_SCHEDULE_MAX_GROUPS]; // Absolute deadline of current release
+    uint32_t period_ms[MODBUS_MASTER_SCHEDULE_MAX_GROUPS];  // Current period, the group's unless changed
+    modbus_master_group_stats_t stats[MODBUS_MASTER_SCHEDULE_MAX_GROUPS];
+    modbus_master_schedule_cb_t callback;
+    void* arg;
+
+    // Scratch for the plan built from due groups
+    modbus_master_block_t due_blocks[MODBUS_MASTER_SCHEDULE_MAX_GROUPS];
+    uint8_t due_group[MODBUS_MASTER_SCHEDULE_MAX_GROUPS];
+    modbus_master_plan_t plan;
+} modbus_master_schedule_t;
+
+/**
+ * @brief Slave schedule with its share of the bus
+ */
+typedef struct {
+    modbus_master_schedule_t* sched;
+    uint8_t weight;  // Relative share of transactions while several slaves have work due
+    int32_t current; // Smooth weighted round-robin state
+} modbus_master_bus_entry_t;
+
+/**
+ * @brief Weighted round-robin over the schedules of several slaves on one bus
+ */
+typedef struct {
+    modbus_master_bus_entry_t entries[MODBUS_MASTER_BUS_MAX_SLAVES];
+    uint8_t num_entries;
+
+    // Bus load of the window in progress and of the last completed one
+    int64_t window_start_us;
+    uint64_t window_busy_mark_us; // Manager busy counter at window start
+    uint32_t window_txns;
+    modbus_master_bus_load_t load;
+} modbus_master_bus_sched_t;
+
+/**
+ * @brief Initialize a schedule, all groups released immediately
+ *
+ * @param sched Schedule to initialize
+ * @param slave_addr Slave address
+ * @param reg_type Register type (0x03=Holding, 0x04=Input)
+ * @param groups Group table (must outlive the schedule)
+ * @param num_groups Number of groups (<= MODBUS_MASTER_SCHEDULE_MAX_GROUPS)
+ * @param max_gap Largest gap in registers to read through when coalescing
+ * @param callback Called with the refreshed groups after each transaction
+ * @param arg User argument for callback
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_schedule_init(modbus_master_schedule_t* sched, uint8_t slave_addr, uint8_t reg_type,
+                                      const modbus_master_group_t* groups, uint8_t num_groups, uint16_t max_gap,
+                                      modbus_master_schedule_cb_t callback, void* arg);
+
+/**
+ * @brief Run the transaction holding the earliest-deadline due group
+ *
+ * Groups are released on an absolute cadence, one period after the previous
+ * release, so bus latency and retries do not make the period drift. A group
+ * that falls a whole period behind skips the missed releases (counted as
+ * overruns) instead of being polled back to back.
+ *
+ * All due groups are coalesced with the planner; other due groups that share
+ * the chosen transaction are refreshed in the same frame.
+ * When the transport pipelines (Modbus TCP), further due transactions are
+ * sent in the same batch in deadline order, up to the pipeline depth.
+ *
+ * @param sched Schedule
+ * @param wait_ms Set to the time until the next release when nothing is due (may be NULL)
+ * @return ESP_OK if the transactions succeeded, ESP_ERR_NOT_FOUND if nothing is due,
+ *         otherwise the first transaction error
+ */
+esp_err_t modbus_master_schedule_run_once(modbus_master_schedule_t* sched, uint32_t* wait_ms);
+
+/**
+ * @brief Feed registers read by someone else, e.g. sniffed on the bus
+ *
+ * Every group whose block lies entirely inside the range is refreshed and
+ * released one period after now, so it is only polled again once it goes
+ * stale. The schedule callback runs for the refreshed groups.
+ *
+ * @param sched Schedule
+ * @param reg_type Register type (0x03=Holding, 0x04=Input)
+ * @param reg_addr Starting register address
+ * @param data Registers
+ * @param reg_count Number of registers
+ * @return ESP_OK if a group was refreshed, ESP_ERR_NOT_FOUND otherwise
+ */
+esp_err_t modbus_master_schedule_ingest(modbus_master_schedule_t* sched, uint8_t reg_type, uint16_t reg_addr,
+                                        const uint16_t* data, uint16_t reg_count);
+
+/**
+ * @brief Change the poll period of one group, e.g. when the displayed screen changes
+ *
+ * The next release moves to the last poll plus the new period, so a group
+ * that is already older than a shorter period is due at once. A deadline
+ * of 0 in the group table follows the new period.
+ *
+ * @param sched Schedule
+ * @param group Group index in the table
+ * @param period_ms New period (0 = back to the period in the group table)
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_schedule_set_period(modbus_master_schedule_t* sched, uint8_t group, uint32_t period_ms);
+
+/**
+ * @brief Change the planner gap threshold, e.g. after the baudrate or the slave turnaround changed
+ *
+ * Takes effect from the next transaction planned.
+ *
+ * @param sched Schedule
+ * @param max_gap Largest gap in registers to read through when coalescing
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_schedule_set_max_gap(modbus_master_schedule_t* sched, uint16_t max_gap);
+
+/**
+ * @brief Get the achieved cadence of one group
+ *
+ * Kept by the polling task; reading from another task is good enough for
+ * diagnostics.
+ *
+ * @param sched Schedule
+ * @param group Group index in the table
+ * @param stats Output
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_schedule_get_stats(const modbus_master_schedule_t* sched, uint8_t group,
+                                           modbus_master_group_stats_t* stats);
+
+/**
+ * @brief Clear the cadence statistics of every group
+ *
+ * @param sched Schedule
+ */
+void modbus_master_schedule_reset_stats(modbus_master_schedule_t* sched);
+
+/**
+ * @brief Get the earliest release time of a schedule
+ *
+ * @param sched Schedule
+ * @return Release time in esp_timer microseconds, INT64_MAX if the schedule is empty
+ */
+int64_t modbus_master_schedule_next_release(const modbus_master_schedule_t* sched);
+
+/**
+ * @brief Initialize an empty bus schedule
+ *
+ * @param bus Bus schedule
+ */
+void modbus_master_bus_sched_init(modbus_master_bus_sched_t* bus);
+
+/**
+ * @brief Add the schedule of one slave
+ *
+ * @param bus Bus schedule
+ * @param sched Initialized slave schedule (must outlive the bus schedule)
+ * @param weight Relative share of the bus (>= 1)
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if the bus is full
+ */
+esp_err_t modbus_master_bus_sched_add(modbus_master_bus_sched_t* bus, modbus_master_schedule_t* sched,
+                                      uint8_t weight);
+
+/**
+ * @brief Run one transaction for the next slave in weighted round-robin order
+ *
+ * Only slaves with a due group take part in a round, so an idle slave does
+ * not waste turns. A dead slave fails fast in the manager and its groups are
+ * re-released one period later, so it cannot starve the others.
+ *
+ * @param bus Bus schedule
+ * @param wait_ms Set to the time until the next release when nothing is due (may be NULL)
+ * @param slave_addr Set to the slave served (may be NULL)
+ * @return Result of modbus_master_schedule_run_once() for the slave served,
+ *         ESP_ERR_NOT_FOUND if nothing is due
+ */
+esp_err_t modbus_master_bus_sched_run_once(modbus_master_bus_sched_t* bus, uint32_t* wait_ms, uint8_t* slave_addr);
+
+/**
+ * @brief Get the bus time used in the last window
+ *
+ * Busy time is the manager's own transaction time (modbus_master_timing_t
+ * busy_us), so writes from the worker and recovery probes count too, and
+ * callback or UI work between polls does not. slack_ms tells how much polling can still be added (groups, faster
+ * periods or stations) before the schedule starts missing deadlines.
+ *
+ * @param bus Bus schedule
+ * @param load Output, zero until the first window has completed
+ */
+void modbus_master_bus_sched_get_load(const modbus_master_bus_sched_t* bus, modbus_master_bus_load_t* load);
+
+/**
+ * @brief Feed registers read by someone else to the schedule of their slave
+ *
+ * @param bus Bus schedule
+ * @param slave_addr Slave address
+ * @param reg_type Register type (0x03=Holding, 0x04=Input)
+ * @param reg_addr Starting register address
+ * @param data Registers
+ * @param reg_count Number of registers
+ * @return ESP_OK if a group was refreshed, ESP_ERR_NOT_FOUND otherwise
+ */
+esp_err_t modbus_master_bus_sched_ingest(modbus_master_bus_sched_t* bus, uint8_t slave_addr, uint8_t reg_type,
+                                         uint16_t reg_addr, const uint16_t* data, uint16_t reg_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODBUS_MASTER_SCHEDULE_H
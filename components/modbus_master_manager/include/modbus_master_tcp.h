@@ -0,0 +1,98 @@
+#ifndef MODBUS_MASTER_TCP_H
+#define MODBUS_MASTER_TCP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_MASTER_TCP_DEFAULT_PORT  502
+#define MODBUS_MASTER_TCP_MAX_INFLIGHT  8 // Upper bound of outstanding transactions
+
+/**
+ * @brief One Modbus TCP transaction
+ *
+ * Supported function codes: 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x10, 0x17.
+ * Registers are in host byte order, coils packed LSB first as in esp-modbus.
+ * For 0x17 reg_addr/reg_count/data describe the read, wr_* the write.
+ */
+typedef struct {
+    uint8_t unit_id;         // Unit identifier (slave address behind a gateway)
+    uint8_t command;         // Function code
+    uint16_t reg_addr;       // Starting address
+    uint16_t reg_count;      // Number of registers or coils
+    void* data;              // Read destination or write source; FC 0x05/0x06 take one uint16_t
+    esp_err_t result;        // Set by modbus_master_tcp_transact()
+    uint32_t rtt_us;         // Request sent to response received
+    uint16_t wr_addr;        // FC 0x17: first register written
+    uint16_t wr_count;       // FC 0x17: registers written
+    const uint16_t* wr_data; // FC 0x17: values written
+    uint32_t timeout_ms;     // Response timeout (0 = the one given to modbus_master_tcp_open())
+} modbus_master_tcp_txn_t;
+
+/**
+ * @brief Connect to a Modbus TCP server
+ *
+ * The host name is resolved here and kept for reconnects, unless the host
+ * or port change. Connecting is bounded by timeout_ms. The caller must have
+ * brought up a network interface (esp_netif + Wi-Fi or Ethernet) first.
+ *
+ * @param host Host name or IPv4 address
+ * @param port TCP port (0 = 502)
+ * @param timeout_ms Connect and response timeout
+ * @param max_inflight Transactions kept outstanding (1..MODBUS_MASTER_TCP_MAX_INFLIGHT)
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_tcp_open(const char* host, uint16_t port, uint32_t timeout_ms, uint8_t max_inflight);
+
+/**
+ * @brief Close the connection
+ */
+void modbus_master_tcp_close(void);
+
+/**
+ * @brief Drop and re-open the connection with the last parameters
+ *
+ * Uses the address resolved by modbus_master_tcp_open() and waits at most
+ * the connect timeout, so it can run with the bus locked.
+ *
+ * @return ESP_OK if successful
+ */
+esp_err_t modbus_master_tcp_reconnect(void);
+
+/**
+ * @brief Check whether the connection is open
+ *
+ * @return true if connected
+ */
+bool modbus_master_tcp_is_open(void);
+
+/**
+ * @brief Number of transactions kept outstanding
+ *
+ * @return Pipeline depth, 0 if not connected
+ */
+uint8_t modbus_master_tcp_inflight(void);
+
+/**
+ * @brief Run transactions pipelined on the connection
+ *
+ * Up to max_inflight requests are written before the first response is
+ * awaited; responses are matched by MBAP transaction ID, so the server may
+ * answer out of order. Responses to abandoned transactions are discarded.
+ * Not thread safe, the manager serializes callers.
+ *
+ * @param txns Transactions, result and rtt_us filled on return
+ * @param count Number of transactions
+ * @return ESP_OK if all succeeded, otherwise the first failing result
+ */
+esp_err_t modbus_master_tcp_transact(modbus_master_tcp_txn_t* txns, uint8_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODBUS_MASTER_TCP_H
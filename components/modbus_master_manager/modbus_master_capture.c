@@ -0,0 +1,300 @@
+#include "modbus_master_capture.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "MODBUS_CAP";
+
+#define CAPTURE_MAX_ADU 256
+
+// Header của một bản ghi trong ring, theo sau là ADU
+typedef struct {
+    int64_t timestamp_us;
+    uint16_t len;
+    uint8_t dir;
+    uint8_t ready; // ADU đã chép xong (chép ngoài lock)
+} capture_hdr_t;
+
+#define CAPTURE_REC_SIZE(len) ((sizeof(capture_hdr_t) + (len) + 7) & ~(size_t)7)
+
+// Ring byte trong PSRAM, bản ghi liền mạch: [tail, head) hoặc [tail, wrap_at) + [0, head) khi đã vòng
+static struct {
+    uint8_t* buf;
+    size_t size;
+    size_t head;
+    size_t tail;
+    size_t wrap_at;
+    bool wrapped;
+    bool recording;
+    bool paused; // Đang dump
+    uint8_t writers; // Bản ghi đã giữ chỗ, đang chép ADU
+    uint32_t frames;
+    uint32_t total;
+    uint32_t dropped;
+    portMUX_TYPE lock;
+} cap_ctx = {.lock = portMUX_INITIALIZER_UNLOCKED};
+
+static void
+capture_reset(void) {
+    cap_ctx.head = 0;
+    cap_ctx.tail = 0;
+    cap_ctx.wrap_at = 0;
+    cap_ctx.wrapped = false;
+    cap_ctx.frames = 0;
+}
+
+esp_err_t
+modbus_master_capture_start(size_t size) {
+    if (size < CAPTURE_REC_SIZE(CAPTURE_MAX_ADU)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    modbus_master_capture_free();
+    uint8_t* buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        ESP_LOGE(TAG, "No PSRAM for a %u byte capture", (unsigned)size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&cap_ctx.lock);
+    cap_ctx.buf = buf;
+    cap_ctx.size = size;
+    capture_reset();
+    cap_ctx.total = 0;
+    cap_ctx.dropped = 0;
+    cap_ctx.recording = true;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+
+    ESP_LOGI(TAG, "Capturing Modbus frames into %u KB of PSRAM", (unsigned)(size / 1024));
+    return ESP_OK;
+}
+
+void
+modbus_master_capture_stop(void) {
+    portENTER_CRITICAL(&cap_ctx.lock);
+    cap_ctx.recording = false;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+}
+
+// Vào lock khi không còn ai đang chép vào ring, để reset hay free không đụng bản ghi đang ghi dở
+static void
+capture_enter_idle(void) {
+    for (;;) {
+        portENTER_CRITICAL(&cap_ctx.lock);
+        if (cap_ctx.writers == 0) {
+            return;
+        }
+        portEXIT_CRITICAL(&cap_ctx.lock);
+        vTaskDelay(1);
+    }
+}
+
+void
+modbus_master_capture_free(void) {
+    capture_enter_idle();
+    uint8_t* buf = cap_ctx.buf;
+    cap_ctx.buf = NULL;
+    cap_ctx.size = 0;
+    cap_ctx.recording = false;
+    capture_reset();
+    portEXIT_CRITICAL(&cap_ctx.lock);
+
+    heap_caps_free(buf);
+}
+
+void
+modbus_master_capture_clear(void) {
+    capture_enter_idle();
+    capture_reset();
+    portEXIT_CRITICAL(&cap_ctx.lock);
+}
+
+bool
+modbus_master_capture_active(void) {
+    return cap_ctx.recording;
+}
+
+// Bỏ bản ghi cũ nhất; false nếu nó còn đang được chép
+static bool
+capture_drop_oldest(void) {
+    const capture_hdr_t* hdr = (const capture_hdr_t*)&cap_ctx.buf[cap_ctx.tail];
+    if (!hdr->ready) {
+        return false;
+    }
+    cap_ctx.tail += CAPTURE_REC_SIZE(hdr->len);
+    cap_ctx.frames--;
+    cap_ctx.dropped++;
+    if (cap_ctx.wrapped && cap_ctx.tail >= cap_ctx.wrap_at) {
+        cap_ctx.tail = 0;
+        cap_ctx.wrapped = false;
+    }
+    return true;
+}
+
+void
+modbus_master_capture_record(modbus_master_capture_dir_t dir, const uint8_t* adu, uint16_t len) {
+    if (!cap_ctx.recording || !adu || len == 0 || len > CAPTURE_MAX_ADU) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    size_t need = CAPTURE_REC_SIZE(len);
+
+    portENTER_CRITICAL(&cap_ctx.lock);
+    if (!cap_ctx.recording || cap_ctx.paused) {
+        cap_ctx.dropped += cap_ctx.recording ? 1 : 0;
+        portEXIT_CRITICAL(&cap_ctx.lock);
+        return;
+    }
+
+    // Tìm chỗ liền mạch, ghi đè bản ghi cũ nhất khi cần
+    bool room = true;
+    while (room) {
+        if (cap_ctx.frames == 0) {
+            capture_reset();
+        }
+        if (!cap_ctx.wrapped) {
+            if (cap_ctx.head + need <= cap_ctx.size) {
+                break;
+            }
+            cap_ctx.wrap_at = cap_ctx.head;
+            cap_ctx.head = 0;
+            cap_ctx.wrapped = true;
+            continue;
+        }
+        if (cap_ctx.head + need <= cap_ctx.tail) {
+            break;
+        }
+        room = capture_drop_oldest();
+    }
+    if (!room) {
+        cap_ctx.dropped++; // Ring nhỏ tới mức bản ghi cũ nhất vẫn đang chép
+        portEXIT_CRITICAL(&cap_ctx.lock);
+        return;
+    }
+
+    // Chỉ giữ chỗ trong lock; chép ADU vào PSRAM sau khi nhả
+    capture_hdr_t* hdr = (capture_hdr_t*)&cap_ctx.buf[cap_ctx.head];
+    hdr->timestamp_us = now;
+    hdr->len = len;
+    hdr->dir = (uint8_t)dir;
+    hdr->ready = 0;
+    cap_ctx.head += need;
+    cap_ctx.frames++;
+    cap_ctx.total++;
+    cap_ctx.writers++;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+
+    memcpy(hdr + 1, adu, len);
+
+    portENTER_CRITICAL(&cap_ctx.lock);
+    hdr->ready = 1;
+    cap_ctx.writers--;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+}
+
+esp_err_t
+modbus_master_capture_dump(void) {
+    portENTER_CRITICAL(&cap_ctx.lock);
+    if (!cap_ctx.buf || cap_ctx.frames == 0) {
+        portEXIT_CRITICAL(&cap_ctx.lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    cap_ctx.paused = true;
+    size_t offset = cap_ctx.tail;
+    uint32_t frames = cap_ctx.frames;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+
+    // Ghi bị tạm dừng nên duyệt ring không cần giữ lock
+    printf("%s BEGIN %lu\n", MODBUS_MASTER_CAPTURE_TAG, (unsigned long)frames);
+    for (uint32_t i = 0; i < frames; i++) {
+        const capture_hdr_t* hdr = (const capture_hdr_t*)&cap_ctx.buf[offset];
+        const uint8_t* adu = (const uint8_t*)(hdr + 1);
+
+        // Bản ghi giữ chỗ ngay trước khi dừng mà chưa chép xong: chờ nó
+        while (!((volatile const capture_hdr_t*)hdr)->ready) {
+            vTaskDelay(1);
+        }
+        printf("%s %lld %c ", MODBUS_MASTER_CAPTURE_TAG, (long long)hdr->timestamp_us,
+               hdr->dir == MODBUS_MASTER_CAPTURE_TX ? 'T' : 'R');
+        for (uint16_t k = 0; k < hdr->len; k++) {
+            printf("%02X", adu[k]);
+        }
+        printf("\n");
+
+        offset += CAPTURE_REC_SIZE(hdr->len);
+        if (cap_ctx.wrapped && offset >= cap_ctx.wrap_at) {
+            offset = 0;
+        }
+    }
+    printf("%s END\n", MODBUS_MASTER_CAPTURE_TAG);
+
+    portENTER_CRITICAL(&cap_ctx.lock);
+    cap_ctx.paused = false;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+    return ESP_OK;
+}
+
+void
+modbus_master_capture_get_stats(modbus_master_capture_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    portENTER_CRITICAL(&cap_ctx.lock);
+    stats->size = cap_ctx.size;
+    stats->frames = cap_ctx.frames;
+    stats->total = cap_ctx.total;
+    stats->dropped = cap_ctx.dropped;
+    portEXIT_CRITICAL(&cap_ctx.lock);
+}
+
+static int
+capture_hex(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)toupper((unsigned char)c);
+    return (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+}
+
+bool
+modbus_master_capture_parse_line(const char* line, modbus_master_capture_rec_t* rec, uint8_t* buf) {
+    if (!line || !rec || !buf) {
+        return false;
+    }
+
+    const char* p = strstr(line, MODBUS_MASTER_CAPTURE_TAG " ");
+    if (!p) {
+        return false;
+    }
+    p += strlen(MODBUS_MASTER_CAPTURE_TAG) + 1;
+
+    // BEGIN/END không phải frame
+    char* end;
+    long long timestamp = strtoll(p, &end, 10);
+    if (end == p || end[0] != ' ' || (end[1] != 'T' && end[1] != 'R') || end[2] != ' ') {
+        return false;
+    }
+    rec->timestamp_us = timestamp;
+    rec->dir = end[1] == 'T' ? MODBUS_MASTER_CAPTURE_TX : MODBUS_MASTER_CAPTURE_RX;
+
+    uint16_t len = 0;
+    for (p = end + 3; len < CAPTURE_MAX_ADU; p += 2) {
+        int hi = capture_hex(p[0]);
+        int lo = hi < 0 ? -1 : capture_hex(p[1]);
+        if (lo < 0) {
+            break;
+        }
+        buf[len++] = (uint8_t)((hi << 4) | lo);
+    }
+
+    rec->len = len;
+    rec->adu = buf;
+    return len > 0;
+}
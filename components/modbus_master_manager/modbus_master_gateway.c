@@ -0,0 +1,313 @@
+#include "modbus_master_gateway.h"
+#include <stdlib.h>
+#include <string.h>
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mbcontroller.h"
+#include "modbus_master_manager.h"
+#include "modbus_master_tcp.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char* TAG = "MODBUS_GW";
+
+// Ảnh thanh ghi của trạm, phục vụ master phía dưới mà không chạm bus RS485
+static struct {
+    modbus_master_gateway_config_t config;
+    modbus_master_gateway_block_t blocks[MODBUS_MASTER_GATEWAY_MAX_BLOCKS];
+    uint16_t offsets[MODBUS_MASTER_GATEWAY_MAX_BLOCKS]; // First register of each block in the image
+    uint16_t ages[MODBUS_MASTER_GATEWAY_MAX_BLOCKS];    // Served at age_reg_addr
+    uint16_t* image;
+    int64_t* stamps; // esp_timer time each register was last read, 0 = never
+    uint16_t num_regs;
+    void* handle;
+    TaskHandle_t task;
+    SemaphoreHandle_t task_exit;
+    volatile bool stop;
+    modbus_master_reader_t reader;
+    uint32_t frames;
+    uint32_t dropped;
+} gw_ctx;
+
+static bool
+gateway_overlap(uint16_t a_addr, uint16_t a_count, uint16_t b_addr, uint16_t b_count) {
+    return (uint32_t)a_addr < (uint32_t)b_addr + b_count && (uint32_t)b_addr < (uint32_t)a_addr + a_count;
+}
+
+static esp_err_t
+gateway_check(const modbus_master_gateway_config_t* config) {
+    if (!config || !config->blocks || config->num_blocks == 0 || config->num_blocks > MODBUS_MASTER_GATEWAY_MAX_BLOCKS
+        || config->unit_id == 0 || config->unit_id > 247) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->link == MODBUS_MASTER_GATEWAY_TCP && !config->netif) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->link == MODBUS_MASTER_GATEWAY_RTU && (config->tx_pin < 0 || config->rx_pin < 0)) {
+        ESP_LOGE(TAG, "UART%d: TX and RX pins must be set", config->uart_port);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((uint32_t)config->age_reg_addr + config->num_blocks > 0x10000) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int k = 0; k < config->num_blocks; k++) {
+        const modbus_master_gateway_block_t* b = &config->blocks[k];
+        if (b->reg_count == 0 || (uint32_t)b->reg_addr + b->reg_count > 0x10000
+            || gateway_overlap(b->reg_addr, b->reg_count, config->age_reg_addr, config->num_blocks)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (int j = 0; j < k; j++) {
+            if (gateway_overlap(b->reg_addr, b->reg_count, config->blocks[j].reg_addr, config->blocks[j].reg_count)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+// Chép phần giao giữa response và từng block vào ảnh
+static void
+gateway_mirror(const modbus_master_frame_t* frame) {
+    if (frame->slave_addr != gw_ctx.config.source_addr || frame->reg_type != 0x03) {
+        return;
+    }
+
+    uint32_t frame_end = (uint32_t)frame->reg_addr + frame->reg_count;
+    for (int k = 0; k < gw_ctx.config.num_blocks; k++) {
+        const modbus_master_gateway_block_t* b = &gw_ctx.blocks[k];
+        uint32_t lo = frame->reg_addr > b->reg_addr ? frame->reg_addr : b->reg_addr;
+        uint32_t hi = (uint32_t)b->reg_addr + b->reg_count;
+        hi = frame_end < hi ? frame_end : hi;
+        if (lo >= hi) {
+            continue;
+        }
+
+        uint16_t idx = gw_ctx.offsets[k] + (lo - b->reg_addr);
+        memcpy(&gw_ctx.image[idx], &frame->data[lo - frame->reg_addr], (hi - lo) * sizeof(uint16_t));
+        for (uint32_t i = 0; i < hi - lo; i++) {
+            gw_ctx.stamps[idx + i] = frame->timestamp_us;
+        }
+    }
+    gw_ctx.frames++;
+}
+
+// Tuổi của block tính theo thanh ghi cũ nhất
+static void
+gateway_update_ages(int64_t now) {
+    for (int k = 0; k < gw_ctx.config.num_blocks; k++) {
+        const int64_t* stamps = &gw_ctx.stamps[gw_ctx.offsets[k]];
+        int64_t oldest = stamps[0];
+        for (uint16_t i = 1; i < gw_ctx.blocks[k].reg_count && oldest; i++) {
+            oldest = stamps[i] < oldest ? stamps[i] : oldest;
+        }
+
+        if (!oldest) {
+            gw_ctx.ages[k] = MODBUS_MASTER_GATEWAY_AGE_NEVER;
+            continue;
+        }
+        int64_t age = (now - oldest) / (MODBUS_MASTER_GATEWAY_AGE_UNIT_MS * 1000);
+        gw_ctx.ages[k] = age < MODBUS_MASTER_GATEWAY_AGE_NEVER ? (uint16_t)age : MODBUS_MASTER_GATEWAY_AGE_NEVER - 1;
+    }
+}
+
+static void
+gateway_task(void* arg) {
+    static modbus_master_frame_t frame;
+
+    modbus_master_reader_register(&gw_ctx.reader, NULL);
+    while (!gw_ctx.stop) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MODBUS_MASTER_GATEWAY_AGE_UNIT_MS));
+
+        // Slave stack đọc ảnh dưới cùng lock này nên master phía dưới không thấy block ghi dở
+        mbc_slave_lock(gw_ctx.handle);
+        while (modbus_master_reader_next(&gw_ctx.reader, &frame)) {
+            gateway_mirror(&frame);
+        }
+        gateway_update_ages(esp_timer_get_time());
+        mbc_slave_unlock(gw_ctx.handle);
+
+        if (gw_ctx.reader.dropped) {
+            gw_ctx.dropped += gw_ctx.reader.dropped;
+            gw_ctx.reader.dropped = 0;
+        }
+    }
+
+    modbus_master_reader_unregister(&gw_ctx.reader);
+    xSemaphoreGive(gw_ctx.task_exit);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t
+gateway_create_slave(const modbus_master_gateway_config_t* config) {
+    mb_communication_info_t comm_info = {0};
+    esp_err_t err;
+
+    if (config->link == MODBUS_MASTER_GATEWAY_TCP) {
+        comm_info.tcp_opts.mode = MB_TCP;
+        comm_info.tcp_opts.port = config->tcp_port ? config->tcp_port : MODBUS_MASTER_TCP_DEFAULT_PORT;
+        comm_info.tcp_opts.uid = config->unit_id;
+        comm_info.tcp_opts.addr_type = MB_IPV4;
+        comm_info.tcp_opts.ip_addr_table = NULL;
+        comm_info.tcp_opts.ip_netif_ptr = config->netif;
+
+        err = mbc_slave_create_tcp(&comm_info, &gw_ctx.handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "mbc_slave_create_tcp failed: %s", esp_err_to_name(err));
+            gw_ctx.handle = NULL;
+        }
+        return err;
+    }
+
+    comm_info.ser_opts.mode = MB_RTU;
+    comm_info.ser_opts.port = config->uart_port;
+    comm_info.ser_opts.baudrate = config->baudrate;
+    comm_info.ser_opts.data_bits = UART_DATA_8_BITS;
+    comm_info.ser_opts.parity = UART_PARITY_DISABLE;
+    comm_info.ser_opts.stop_bits = UART_STOP_BITS_1;
+    comm_info.ser_opts.uid = config->unit_id;
+
+    err = mbc_slave_create_serial(&comm_info, &gw_ctx.handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mbc_slave_create_serial failed: %s", esp_err_to_name(err));
+        gw_ctx.handle = NULL;
+        return err;
+    }
+
+    err = uart_set_pin(config->uart_port, config->tx_pin, config->rx_pin, config->rts_pin, UART_PIN_NO_CHANGE);
+    if (err == ESP_OK) {
+        err = uart_set_mode(config->uart_port, UART_MODE_RS485_HALF_DUPLEX);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "UART %d setup failed: %s", config->uart_port, esp_err_to_name(err));
+        mbc_slave_delete(gw_ctx.handle);
+        gw_ctx.handle = NULL;
+    }
+    return err;
+}
+
+static esp_err_t
+gateway_set_descriptors(void) {
+    mb_register_area_descriptor_t area = {
+        .type = MB_PARAM_HOLDING,
+        .access = MB_ACCESS_RO,
+    };
+
+    for (int k = 0; k < gw_ctx.config.num_blocks; k++) {
+        area.start_offset = gw_ctx.blocks[k].reg_addr;
+        area.address = &gw_ctx.image[gw_ctx.offsets[k]];
+        area.size = gw_ctx.blocks[k].reg_count * sizeof(uint16_t);
+        esp_err_t err = mbc_slave_set_descriptor(gw_ctx.handle, area);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    area.start_offset = gw_ctx.config.age_reg_addr;
+    area.address = gw_ctx.ages;
+    area.size = gw_ctx.config.num_blocks * sizeof(uint16_t);
+    return mbc_slave_set_descriptor(gw_ctx.handle, area);
+}
+
+static void
+gateway_release(void) {
+    if (gw_ctx.handle) {
+        mbc_slave_stop(gw_ctx.handle);
+        mbc_slave_delete(gw_ctx.handle);
+        gw_ctx.handle = NULL;
+    }
+    if (gw_ctx.task_exit) {
+        vSemaphoreDelete(gw_ctx.task_exit);
+        gw_ctx.task_exit = NULL;
+    }
+    free(gw_ctx.image);
+    free(gw_ctx.stamps);
+    gw_ctx.image = NULL;
+    gw_ctx.stamps = NULL;
+}
+
+esp_err_t
+modbus_master_gateway_start(const modbus_master_gateway_config_t* config) {
+    esp_err_t err = gateway_check(config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (gw_ctx.task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    gw_ctx.config = *config;
+    memcpy(gw_ctx.blocks, config->blocks, config->num_blocks * sizeof(modbus_master_gateway_block_t));
+    gw_ctx.config.blocks = gw_ctx.blocks;
+    gw_ctx.num_regs = 0;
+    for (int k = 0; k < config->num_blocks; k++) {
+        gw_ctx.offsets[k] = gw_ctx.num_regs;
+        gw_ctx.num_regs += config->blocks[k].reg_count;
+        gw_ctx.ages[k] = MODBUS_MASTER_GATEWAY_AGE_NEVER;
+    }
+    gw_ctx.frames = 0;
+    gw_ctx.dropped = 0;
+
+    gw_ctx.image = calloc(gw_ctx.num_regs, sizeof(uint16_t));
+    gw_ctx.stamps = calloc(gw_ctx.num_regs, sizeof(int64_t));
+    gw_ctx.task_exit = xSemaphoreCreateBinary();
+    if (!gw_ctx.image || !gw_ctx.stamps || !gw_ctx.task_exit) {
+        gateway_release();
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = gateway_create_slave(config);
+    if (err == ESP_OK) {
+        err = gateway_set_descriptors();
+    }
+    if (err == ESP_OK) {
+        err = mbc_slave_start(gw_ctx.handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Gateway start failed: %s", esp_err_to_name(err));
+        gateway_release();
+        return err;
+    }
+
+    gw_ctx.stop = false;
+    if (xTaskCreate(gateway_task, "mb_gateway", MODBUS_MASTER_GATEWAY_STACK_SIZE, NULL,
+                    MODBUS_MASTER_GATEWAY_PRIORITY, &gw_ctx.task) != pdPASS) {
+        gw_ctx.task = NULL;
+        gateway_release();
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Serving station %u as unit %u over %s, %u registers in %u blocks, ages at %u",
+             config->source_addr, config->unit_id, config->link == MODBUS_MASTER_GATEWAY_TCP ? "TCP" : "RTU",
+             gw_ctx.num_regs, config->num_blocks, config->age_reg_addr);
+    return ESP_OK;
+}
+
+void
+modbus_master_gateway_stop(void) {
+    if (!gw_ctx.task) {
+        return;
+    }
+
+    gw_ctx.stop = true;
+    xTaskNotifyGive(gw_ctx.task);
+    xSemaphoreTake(gw_ctx.task_exit, portMAX_DELAY);
+    gw_ctx.task = NULL;
+    gateway_release();
+}
+
+bool
+modbus_master_gateway_running(void) {
+    return gw_ctx.task != NULL;
+}
+
+void
+modbus_master_gateway_get_stats(modbus_master_gateway_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+    stats->frames = gw_ctx.frames;
+    stats->dropped = gw_ctx.dropped;
+}
@@ -1,14 +1,105 @@
 #include "modbus_master_manager.h"
+#include <stdatomic.h>
 #include <string.h>
 #include "driver/uart.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 #include "mbcontroller.h"
+#include "modbus_master_capture.h"
+#include "modbus_master_rtu.h"
+#include "modbus_master_tcp.h"
+#include "nvs.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 
 static const char* TAG = "MODBUS_MASTER";
 
+static const uint8_t lane_depth[MODBUS_MASTER_LANE_MAX] = {
+    [MODBUS_MASTER_LANE_SAFETY] = 4,
+    [MODBUS_MASTER_LANE_COMMAND] = 8,
+    [MODBUS_MASTER_LANE_POLL] = 8,
+};
+
+// Cận trên (không bao gồm) của các bucket latency, bucket cuối là phần còn lại
+static const uint32_t latency_bucket_us[MODBUS_MASTER_LATENCY_BUCKETS - 1] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+};
+
+// Theo dõi kết nối từng slave
+typedef struct {
+    bool used;
+    uint8_t addr;
+    modbus_master_link_state_t state;
+    uint16_t probe_reg;
+    uint32_t rtt_us[MODBUS_MASTER_RTT_WINDOW]; // Recent request-to-response times
+    uint8_t rtt_head;
+    uint8_t rtt_count;
+    uint32_t rtt_p99_us;
+    uint32_t timeout_ms; // Adaptive response timeout
+    uint32_t late;       // Responses slower than timeout_ms
+    uint32_t probes;
+    int64_t next_probe_us;
+    int64_t offline_since_us;
+    int8_t notify; // Báo cho app sau khi nhả bus: 1 = connected, -1 = not connected
+    modbus_master_fc_stats_t stats[MODBUS_MASTER_STATS_FCS];
+} modbus_master_link_t;
+
+// Phần ghi của transaction FC 0x17 đang chạy
+typedef struct {
+    uint16_t addr;
+    uint16_t count;
+    const uint16_t* data;
+} modbus_master_rw_t;
+
+// Vùng gom lệnh ghi của một slave: các thanh ghi gần nhau, bit dirty cho từng thanh ghi
+typedef struct {
+    uint8_t slave_addr;
+    uint16_t base;       // Register of bit 0
+    uint16_t dirty;      // Registers waiting to be written (0 = slot free)
+    int64_t deadline_us; // Written on its own after this
+    uint16_t values[MODBUS_MASTER_STAGE_REGS];
+    modbus_master_done_cb_t callbacks[MODBUS_MASTER_STAGE_REGS];
+    void* args[MODBUS_MASTER_STAGE_REGS];
+    esp_err_t results[MODBUS_MASTER_STAGE_REGS]; // Filled when written
+    uint32_t seqs[MODBUS_MASTER_STAGE_REGS];     // Command sequence number of each value
+} modbus_master_stage_t;
+
+// Bản sao thanh ghi điều khiển: giá trị trên slave (ghi xong hoặc đọc lại) và tiến độ lệnh
+typedef struct {
+    bool used;
+    bool known;     // value is trusted
+    uint8_t slave_addr;
+    uint16_t reg_addr;
+    uint16_t value;   // Last written or read back
+    uint16_t written; // Value of seq_acked
+    bool readback;    // value đến từ lần đọc (false: từ lệnh ghi, chưa đọc lại)
+    int64_t updated_us;
+    uint32_t seq_staged;
+    uint32_t seq_acked;
+    uint32_t seq_confirmed;
+} modbus_master_shadow_t;
+
+// Một ô của ring frame: stamp = seq của frame khi đã ghi xong, 0 khi đang ghi
+typedef struct {
+    atomic_uint_fast32_t stamp;
+    modbus_master_frame_t frame;
+} modbus_master_ring_slot_t;
+
+// Request đọc gần nhất của master khác trên bus, chờ response
+typedef struct {
+    bool valid;
+    uint8_t slave_addr;
+    uint8_t command;
+    uint16_t reg_addr;
+    uint16_t reg_count;
+} modbus_master_sniff_req_t;
+
+_Static_assert((MODBUS_MASTER_FRAME_RING & (MODBUS_MASTER_FRAME_RING - 1)) == 0,
+               "MODBUS_MASTER_FRAME_RING must be a power of two");
+
 static struct {
     void* master_handle;
     modbus_master_config_t config;
@@ -16,7 +107,1199 @@ static struct {
     SemaphoreHandle_t mutex;
     bool initialized;
     bool running;
-} modbus_master_ctx = {0};
+
+    // Asynchronous requests
+    QueueHandle_t lanes[MODBUS_MASTER_LANE_MAX];
+    TaskHandle_t worker;
+    SemaphoreHandle_t worker_exit;
+    volatile bool worker_stop;
+    uint32_t next_id;
+    portMUX_TYPE id_lock;
+    modbus_master_stage_t stages[MODBUS_MASTER_STAGE_SLOTS];
+    modbus_master_shadow_t shadows[MODBUS_MASTER_SHADOW_REGS];
+    uint32_t command_seq;
+    portMUX_TYPE stage_lock; // Also guards shadows and command_seq
+    modbus_master_rw_t rw_write; // Write part of the FC 0x17 in progress
+
+    // Frame ring, single producer (whoever holds the bus)
+    modbus_master_ring_slot_t ring[MODBUS_MASTER_FRAME_RING];
+    atomic_uint_fast32_t ring_head; // Sequence number of the last published frame
+    modbus_master_reader_t* readers[MODBUS_MASTER_MAX_READERS];
+    portMUX_TYPE reader_lock;
+    bool frames_pending; // Readers notified when the bus is released
+    modbus_master_sniff_req_t sniff_req;
+
+    // Bus timing
+    uint32_t char_us;           // One RTU character (11 bits)
+    uint32_t t35_us;            // Inter-frame silence
+    uint8_t duty_cycle;         // Max bus duty cycle in % (0 = no cap)
+    int64_t bus_free_us;        // Earliest start of the next request
+    uint32_t turnaround_us;     // Smoothed slave turnaround (EWMA 1/8)
+    uint32_t turnaround_max_us;
+    uint32_t last_txn_us;
+    uint64_t busy_us;           // Tổng thời gian trong transaction từ lúc init (stats_lock)
+
+    // Link health
+    uint32_t response_timeout_ms; // Hard ceiling handed to esp-modbus
+    modbus_master_link_t links[MODBUS_MASTER_MAX_SLAVES];
+    modbus_master_link_callback_t link_callback;
+
+    // Baudrate negotiation, candidates fastest first
+    modbus_master_baud_config_t baud;
+    uint32_t baud_rates[MODBUS_MASTER_BAUD_MAX_RATES];
+    uint8_t baud_index;       // Active candidate
+    bool baud_active;         // Live error rate watched for fallback
+    volatile bool baud_fallback; // Cửa sổ lỗi vượt ngân sách, worker lùi tốc độ
+    bool timeout_auto;        // response_timeout_ms follows the baudrate
+    uint16_t baud_window_txns;
+    uint16_t baud_window_errors;
+
+    // Recovery
+    modbus_master_recovery_stats_t recovery;
+    int64_t last_rebuild_us;
+    bool recovering;      // Transactions count as retries while set
+    bool tcp_reconnected; // TCP already reconnected for the current transaction or batch
+
+    // Statistics
+    int64_t stats_since_us;
+    portMUX_TYPE stats_lock; // Guards link stats and recovery counters, read without taking the bus
+} modbus_master_ctx = {
+    .id_lock = portMUX_INITIALIZER_UNLOCKED,
+    .stage_lock = portMUX_INITIALIZER_UNLOCKED,
+    .reader_lock = portMUX_INITIALIZER_UNLOCKED,
+    .stats_lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static esp_err_t modbus_master_controller_create(void);
+static modbus_master_link_t* modbus_master_link_get(uint8_t slave_addr);
+static esp_err_t modbus_master_worker_start(void);
+static void modbus_master_worker_stop(void);
+static esp_err_t modbus_master_lock(void);
+static void modbus_master_unlock(void);
+
+static inline bool
+modbus_master_is_tcp(void) {
+    return modbus_master_ctx.config.transport == MODBUS_MASTER_TRANSPORT_TCP;
+}
+
+static inline bool
+modbus_master_is_native(void) {
+    return modbus_master_ctx.config.transport == MODBUS_MASTER_TRANSPORT_RTU_NATIVE;
+}
+
+// Transport đang dùng còn mở không
+static bool
+modbus_master_transport_ready(void) {
+    if (modbus_master_is_tcp()) {
+        return modbus_master_tcp_is_open();
+    }
+    if (modbus_master_is_native()) {
+        return modbus_master_rtu_is_open();
+    }
+    return modbus_master_ctx.master_handle != NULL;
+}
+
+static void
+modbus_master_timing_init(uint32_t baudrate, uint8_t duty_cycle) {
+    // TCP không có khoảng lặng giữa frame
+    modbus_master_ctx.char_us = baudrate ? (11 * 1000000UL + baudrate - 1) / baudrate : 0;
+    modbus_master_ctx.t35_us = (modbus_master_ctx.char_us * 7 + 1) / 2;
+    modbus_master_ctx.duty_cycle = duty_cycle;
+    modbus_master_ctx.bus_free_us = 0;
+    modbus_master_ctx.turnaround_us = 0;
+    modbus_master_ctx.turnaround_max_us = 0;
+}
+
+// Số ký tự trên dây của request/response theo function code
+static void
+modbus_master_wire_chars(const mb_param_request_t* request, uint32_t* tx_chars, uint32_t* rx_chars) {
+    uint32_t n = request->reg_size;
+
+    switch (request->command) {
+        case 0x01:
+            *tx_chars = 8;
+            *rx_chars = 5 + (n + 7) / 8;
+            break;
+        case 0x03:
+        case 0x04:
+            *tx_chars = 8;
+            *rx_chars = 5 + 2 * n;
+            break;
+        case 0x10:
+            *tx_chars = 9 + 2 * n;
+            *rx_chars = 8;
+            break;
+        case 0x17:
+            *tx_chars = 13 + 2 * modbus_master_ctx.rw_write.count;
+            *rx_chars = 5 + 2 * n;
+            break;
+        default:
+            *tx_chars = 8;
+            *rx_chars = 8;
+            break;
+    }
+
+    // MBAP (7 byte) thay cho địa chỉ + CRC (3 byte)
+    if (modbus_master_is_tcp()) {
+        *tx_chars += 4;
+        *rx_chars += 4;
+    }
+}
+
+// Chờ tới khi bus rảnh: t3.5 sau frame trước, hoặc lâu hơn nếu có giới hạn duty cycle
+static void
+modbus_master_bus_wait(void) {
+    int64_t wait_us = modbus_master_ctx.bus_free_us - esp_timer_get_time();
+    if (wait_us <= 0) {
+        return;
+    }
+
+    uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+    if (wait_us >= tick_us) {
+        vTaskDelay(wait_us / tick_us);
+        wait_us = modbus_master_ctx.bus_free_us - esp_timer_get_time();
+    }
+    if (wait_us > 0) {
+        esp_rom_delay_us((uint32_t)wait_us);
+    }
+}
+
+static modbus_master_fc_stats_t*
+modbus_master_stats_get(modbus_master_link_t* link, uint8_t fc) {
+    for (int i = 0; i < MODBUS_MASTER_STATS_FCS; i++) {
+        if (link->stats[i].fc == fc) {
+            return &link->stats[i];
+        }
+        if (link->stats[i].fc == 0) {
+            link->stats[i].fc = fc;
+            return &link->stats[i];
+        }
+    }
+    return NULL; // Hết chỗ, bỏ qua function code hiếm
+}
+
+static void
+modbus_master_stats_record(const mb_param_request_t* request, esp_err_t err, uint32_t busy_us,
+                           uint32_t tx_chars, uint32_t rx_chars) {
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    modbus_master_ctx.busy_us += busy_us;
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+
+    modbus_master_link_t* link = modbus_master_link_get(request->slave_addr);
+    if (!link) {
+        return;
+    }
+
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    modbus_master_fc_stats_t* st = modbus_master_stats_get(link, request->command);
+    if (!st) {
+        portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+        return;
+    }
+
+    if (modbus_master_ctx.recovering) {
+        st->retries++;
+    } else {
+        st->requests++;
+    }
+    st->tx_bytes += tx_chars;
+
+    if (err == ESP_OK) {
+        st->ok++;
+        st->rx_bytes += rx_chars;
+        st->latency_sum_us += busy_us;
+        if (busy_us > st->latency_max_us) {
+            st->latency_max_us = busy_us;
+        }
+
+        uint8_t bucket = 0;
+        while (bucket < MODBUS_MASTER_LATENCY_BUCKETS - 1 && busy_us >= latency_bucket_us[bucket]) {
+            bucket++;
+        }
+        st->latency_hist[bucket]++;
+    } else if (err == ESP_ERR_TIMEOUT) {
+        st->timeouts++;
+    } else if (err == ESP_ERR_INVALID_CRC) {
+        st->crc_errors++;
+    } else if (err == ESP_ERR_INVALID_RESPONSE) {
+        st->exceptions++;
+        st->rx_bytes += 5; // Exception response: addr + fc + code + crc
+    } else {
+        st->errors++;
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+}
+
+static void
+modbus_master_recovery_count(uint32_t* counter) {
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    (*counter)++;
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+}
+
+// Tìm bản sao của thanh ghi, tạo mới nếu create (gọi trong stage_lock)
+static modbus_master_shadow_t*
+modbus_master_shadow_get(uint8_t slave_addr, uint16_t reg_addr, bool create) {
+    modbus_master_shadow_t* free_sh = NULL;
+    for (int i = 0; i < MODBUS_MASTER_SHADOW_REGS; i++) {
+        modbus_master_shadow_t* sh = &modbus_master_ctx.shadows[i];
+        if (sh->used && sh->slave_addr == slave_addr && sh->reg_addr == reg_addr) {
+            return sh;
+        }
+        if (!sh->used && !free_sh) {
+            free_sh = sh;
+        }
+    }
+    if (create && free_sh) {
+        memset(free_sh, 0, sizeof(*free_sh));
+        free_sh->used = true;
+        free_sh->slave_addr = slave_addr;
+        free_sh->reg_addr = reg_addr;
+    }
+    return create ? free_sh : NULL;
+}
+
+// Cập nhật bản sao từ lệnh ghi (ok = false: không còn chắc giá trị trên slave) hoặc từ lần đọc lại
+static void
+modbus_master_shadow_update(uint8_t slave_addr, uint16_t reg_addr, uint16_t reg_count, const uint16_t* values,
+                            bool ok, bool readback) {
+    uint32_t end = (uint32_t)reg_addr + reg_count;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&modbus_master_ctx.stage_lock);
+    for (int i = 0; i < MODBUS_MASTER_SHADOW_REGS; i++) {
+        modbus_master_shadow_t* sh = &modbus_master_ctx.shadows[i];
+        if (!sh->used || sh->slave_addr != slave_addr || sh->reg_addr < reg_addr || sh->reg_addr >= end) {
+            continue;
+        }
+        sh->known = ok;
+        if (!ok) {
+            continue;
+        }
+        sh->value = values[sh->reg_addr - reg_addr];
+        sh->readback = readback;
+        sh->updated_us = now;
+        if (readback && sh->seq_confirmed != sh->seq_acked && sh->value == sh->written) {
+            sh->seq_confirmed = sh->seq_acked;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stage_lock);
+}
+
+// Ghi frame RTU của transaction vào capture (request trước khi gửi, response khi thành công)
+static void
+modbus_master_capture_txn(const modbus_master_rtu_txn_t* txn, bool response) {
+    static uint8_t adu[MODBUS_MASTER_RTU_MAX_ADU];
+
+    size_t len = response ? modbus_master_rtu_encode_response(txn, adu) : modbus_master_rtu_encode_request(txn, adu);
+    if (len) {
+        modbus_master_capture_record(response ? MODBUS_MASTER_CAPTURE_RX : MODBUS_MASTER_CAPTURE_TX, adu, len);
+    }
+}
+
+// Timeout thích nghi của slave đang online; đang khôi phục thì chờ đủ trần để không bỏ sót slave chậm
+static uint32_t
+modbus_master_link_timeout_ms(uint8_t slave_addr) {
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        const modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        if (link->used && link->addr == slave_addr) {
+            return link->state == MODBUS_MASTER_LINK_ONLINE ? link->timeout_ms : 0;
+        }
+    }
+    return 0;
+}
+
+// Gửi request qua esp-modbus, đo thời gian phản hồi và tính thời điểm bus rảnh tiếp theo
+static esp_err_t
+modbus_master_send_raw(mb_param_request_t* request, void* data, uint32_t* rtt_us) {
+    *rtt_us = 0;
+    if (!modbus_master_transport_ready()) {
+        return ESP_FAIL; // Transport đang được dựng lại và đã thất bại, recovery sẽ thử lại
+    }
+
+    modbus_master_bus_wait();
+
+    modbus_master_rtu_txn_t rtu_txn = {
+        .slave_addr = request->slave_addr,
+        .command = request->command,
+        .reg_addr = request->reg_start,
+        .reg_count = request->reg_size,
+        .data = data,
+        .wr_addr = modbus_master_ctx.rw_write.addr,
+        .wr_count = modbus_master_ctx.rw_write.count,
+        .wr_data = modbus_master_ctx.rw_write.data,
+        .timeout_ms = modbus_master_link_timeout_ms(request->slave_addr)
+    };
+    bool capture = modbus_master_capture_active();
+    if (capture) {
+        modbus_master_capture_txn(&rtu_txn, false);
+    }
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err;
+    if (modbus_master_is_tcp()) {
+        modbus_master_tcp_txn_t txn = {
+            .unit_id = request->slave_addr,
+            .command = request->command,
+            .reg_addr = request->reg_start,
+            .reg_count = request->reg_size,
+            .data = data,
+            .wr_addr = modbus_master_ctx.rw_write.addr,
+            .wr_count = modbus_master_ctx.rw_write.count,
+            .wr_data = modbus_master_ctx.rw_write.data,
+            .timeout_ms = rtu_txn.timeout_ms
+        };
+        err = modbus_master_tcp_transact(&txn, 1);
+    } else if (modbus_master_is_native()) {
+        err = modbus_master_rtu_transact(&rtu_txn);
+    } else {
+        // esp-modbus chỉ có một timeout cố định lúc tạo controller
+        err = mbc_master_send_request(modbus_master_ctx.master_handle, request, data);
+    }
+    int64_t end = esp_timer_get_time();
+
+    if (capture && err == ESP_OK) {
+        modbus_master_capture_txn(&rtu_txn, true);
+    }
+
+    // Ai ghi thanh ghi điều khiển cũng cập nhật bản sao, để bỏ lệnh trùng cho đúng
+    if (request->command == 0x06 || request->command == 0x10) {
+        modbus_master_shadow_update(request->slave_addr, request->reg_start, request->reg_size, data, err == ESP_OK,
+                                    false);
+    } else if (request->command == 0x17) {
+        modbus_master_shadow_update(request->slave_addr, rtu_txn.wr_addr, rtu_txn.wr_count, rtu_txn.wr_data,
+                                    err == ESP_OK, false);
+    }
+
+    uint32_t busy_us = (uint32_t)(end - start);
+    modbus_master_ctx.last_txn_us = busy_us;
+    *rtt_us = busy_us;
+
+    uint32_t tx_chars, rx_chars;
+    modbus_master_wire_chars(request, &tx_chars, &rx_chars);
+    modbus_master_stats_record(request, err, busy_us, tx_chars, rx_chars);
+
+    if (err == ESP_OK) {
+        uint32_t wire_us = (tx_chars + rx_chars) * modbus_master_ctx.char_us + modbus_master_ctx.t35_us;
+        uint32_t turnaround = busy_us > wire_us ? busy_us - wire_us : 0;
+
+        if (modbus_master_ctx.turnaround_us == 0) {
+            modbus_master_ctx.turnaround_us = turnaround;
+        } else {
+            modbus_master_ctx.turnaround_us += ((int32_t)turnaround - (int32_t)modbus_master_ctx.turnaround_us) / 8;
+        }
+        if (turnaround > modbus_master_ctx.turnaround_max_us) {
+            modbus_master_ctx.turnaround_max_us = turnaround;
+        }
+    }
+
+    uint32_t idle_us = modbus_master_ctx.t35_us;
+    uint8_t duty = modbus_master_ctx.duty_cycle;
+    if (duty > 0 && duty < 100) {
+        uint32_t duty_idle_us = (uint32_t)((uint64_t)busy_us * (100 - duty) / duty);
+        if (duty_idle_us > idle_us) {
+            idle_us = duty_idle_us;
+        }
+    }
+    modbus_master_ctx.bus_free_us = end + idle_us;
+
+    return err;
+}
+
+static modbus_master_link_t*
+modbus_master_link_get(uint8_t slave_addr) {
+    if (slave_addr == 0) {
+        return NULL; // Broadcast, không có phản hồi
+    }
+
+    modbus_master_link_t* free_link = NULL;
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        if (link->used && link->addr == slave_addr) {
+            return link;
+        }
+        if (!link->used && !free_link) {
+            free_link = link;
+        }
+    }
+
+    if (free_link) {
+        portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+        memset(free_link, 0, sizeof(*free_link));
+        free_link->used = true;
+        free_link->addr = slave_addr;
+        free_link->state = MODBUS_MASTER_LINK_UNKNOWN;
+        free_link->timeout_ms = modbus_master_ctx.response_timeout_ms;
+        portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+    }
+    return free_link;
+}
+
+static void
+modbus_master_link_set_state(modbus_master_link_t* link, modbus_master_link_state_t state) {
+    if (link->state == state) {
+        return;
+    }
+
+    bool was_online = link->state == MODBUS_MASTER_LINK_ONLINE || link->state == MODBUS_MASTER_LINK_SUSPECT;
+    link->state = state;
+
+    if (state == MODBUS_MASTER_LINK_OFFLINE) {
+        link->offline_since_us = esp_timer_get_time();
+    }
+
+    // Callback chạy trong modbus_master_unlock(), app được lấy lock của nó mà không giữ bus
+    if (state == MODBUS_MASTER_LINK_ONLINE && !was_online) {
+        ESP_LOGI(TAG, "Slave %u connected", link->addr);
+        link->notify = 1;
+    } else if (state == MODBUS_MASTER_LINK_OFFLINE) {
+        ESP_LOGW(TAG, "Slave %u not connected", link->addr);
+        link->notify = -1;
+    }
+}
+
+// Timeout thích nghi = p99 * k, kẹp trong [min, ceiling]
+static void
+modbus_master_link_update_timeout(modbus_master_link_t* link) {
+    uint32_t sorted[MODBUS_MASTER_RTT_WINDOW];
+    uint8_t n = link->rtt_count;
+
+    memcpy(sorted, link->rtt_us, n * sizeof(uint32_t));
+    for (uint8_t i = 1; i < n; i++) {
+        uint32_t v = sorted[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+
+    uint8_t idx = (uint8_t)((n * 99 + 99) / 100) - 1;
+    link->rtt_p99_us = sorted[idx];
+
+    uint32_t timeout_ms = (link->rtt_p99_us * MODBUS_MASTER_TIMEOUT_P99_FACTOR + 999) / 1000;
+    if (timeout_ms < MODBUS_MASTER_TIMEOUT_MIN_MS) {
+        timeout_ms = MODBUS_MASTER_TIMEOUT_MIN_MS;
+    }
+    if (timeout_ms > modbus_master_ctx.response_timeout_ms) {
+        timeout_ms = modbus_master_ctx.response_timeout_ms;
+    }
+    link->timeout_ms = timeout_ms;
+}
+
+static void
+modbus_master_link_ok(modbus_master_link_t* link, uint32_t rtt_us) {
+    if (link->rtt_count >= 8 && rtt_us > link->timeout_ms * 1000) {
+        link->late++;
+    }
+
+    link->rtt_us[link->rtt_head] = rtt_us;
+    link->rtt_head = (link->rtt_head + 1) % MODBUS_MASTER_RTT_WINDOW;
+    if (link->rtt_count < MODBUS_MASTER_RTT_WINDOW) {
+        link->rtt_count++;
+    }
+    if ((link->rtt_head & 7) == 0 || link->rtt_count < 8) {
+        modbus_master_link_update_timeout(link);
+    }
+
+    modbus_master_link_set_state(link, MODBUS_MASTER_LINK_ONLINE);
+}
+
+// Probe 1 thanh ghi để xác nhận slave còn sống
+static esp_err_t
+modbus_master_link_probe(modbus_master_link_t* link) {
+    uint16_t value = 0;
+    uint32_t rtt_us = 0;
+    mb_param_request_t probe = {
+        .slave_addr = link->addr,
+        .command = 0x03,
+        .reg_start = link->probe_reg,
+        .reg_size = 1
+    };
+
+    link->probes++;
+    esp_err_t err = modbus_master_send_raw(&probe, &value, &rtt_us);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE) {
+        modbus_master_link_ok(link, rtt_us);
+        return ESP_OK;
+    }
+    return err;
+}
+
+// Tier 1: bỏ byte rác trong RX FIFO và chờ bus im lặng để bắt lại biên frame
+static void
+modbus_master_resync(void) {
+    // TCP: stream mất đồng bộ chỉ sửa được bằng kết nối lại, tối đa một lần mỗi lô
+    if (modbus_master_is_tcp()) {
+        if (!modbus_master_ctx.tcp_reconnected) {
+            modbus_master_ctx.tcp_reconnected = true;
+            modbus_master_tcp_reconnect();
+        }
+        return;
+    }
+
+    // UART của esp-modbus thuộc port task của nó, không flush từ đây: chỉ chờ bus im lặng
+    if (!modbus_master_is_native()) {
+        modbus_master_ctx.bus_free_us = esp_timer_get_time() + modbus_master_ctx.t35_us;
+        modbus_master_bus_wait();
+        return;
+    }
+
+    modbus_master_rtu_flush();
+    for (int i = 0; i < MODBUS_MASTER_RESYNC_ATTEMPTS; i++) {
+        modbus_master_ctx.bus_free_us = esp_timer_get_time() + modbus_master_ctx.t35_us;
+        modbus_master_bus_wait();
+
+        // Còn byte đến trong khoảng t3.5 thì frame lạc chưa kết thúc
+        if (modbus_master_rtu_flush() == 0) {
+            break;
+        }
+    }
+}
+
+// Dừng và tạo lại transport theo config hiện tại
+static esp_err_t
+modbus_master_transport_restart(void) {
+    if (modbus_master_ctx.master_handle) {
+        mbc_master_stop(modbus_master_ctx.master_handle);
+        mbc_master_delete(modbus_master_ctx.master_handle);
+        modbus_master_ctx.master_handle = NULL;
+    }
+    modbus_master_tcp_close();
+    modbus_master_rtu_close();
+
+    esp_err_t err = modbus_master_controller_create();
+    modbus_master_ctx.running = (err == ESP_OK);
+    modbus_master_ctx.bus_free_us = esp_timer_get_time() + modbus_master_ctx.t35_us;
+    return err;
+}
+
+// Tier 3: dựng lại controller esp-modbus hoặc transport (stop + delete + create)
+static esp_err_t
+modbus_master_rebuild(void) {
+    modbus_master_recovery_count(&modbus_master_ctx.recovery.rebuild_attempts);
+    modbus_master_ctx.last_rebuild_us = esp_timer_get_time();
+
+    esp_err_t err = modbus_master_transport_restart();
+    ESP_LOGW(TAG, "Controller rebuilt: %s", esp_err_to_name(err));
+    return err;
+}
+
+// Khôi phục kéo dài tới hàng trăm ms nên nhả bus trước mỗi bước (và trong lúc backoff); worker
+// (ưu tiên cao hơn task poll) đang chờ bus chiếm được ngay. Trả về true khi nên bỏ dở để phục vụ
+// lane SAFETY trước.
+static bool
+modbus_master_recover_yield(uint32_t backoff_ms) {
+    // Chính worker đang khôi phục thì lệnh safety nằm trong hàng đợi của nó, không nhả bus được
+    if (xTaskGetCurrentTaskHandle() == modbus_master_ctx.worker) {
+        QueueHandle_t safety = modbus_master_ctx.lanes[MODBUS_MASTER_LANE_SAFETY];
+        if (safety && uxQueueMessagesWaiting(safety) > 0) {
+            return true;
+        }
+        modbus_master_ctx.bus_free_us = esp_timer_get_time() + backoff_ms * 1000LL;
+        return false;
+    }
+
+    modbus_master_ctx.recovering = false;
+    modbus_master_unlock();
+    if (backoff_ms) {
+        TickType_t ticks = pdMS_TO_TICKS(backoff_ms);
+        vTaskDelay(ticks ? ticks : 1);
+    } else {
+        taskYIELD();
+    }
+    xSemaphoreTake(modbus_master_ctx.mutex, portMAX_DELAY);
+    modbus_master_ctx.recovering = true;
+    return false;
+}
+
+static void
+modbus_master_recovered(int64_t start_us, uint32_t* tier_ok) {
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    (*tier_ok)++;
+    modbus_master_ctx.recovery.last_recovery_us = elapsed_us;
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+}
+
+// Khôi phục theo tầng sau lần miss đầu tiên: resync -> retry có backoff.
+// Bus được nhả giữa các bước; bị lane SAFETY chen thì link giữ SUSPECT, lần miss sau khôi phục lại.
+static esp_err_t
+modbus_master_link_recover(modbus_master_link_t* link) {
+    modbus_master_recovery_stats_t* stats = &modbus_master_ctx.recovery;
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    bool preempted = false;
+
+    modbus_master_ctx.recovering = true;
+
+    preempted = modbus_master_recover_yield(0);
+    if (!preempted) {
+        modbus_master_recovery_count(&stats->resync_attempts);
+        modbus_master_resync();
+        if (modbus_master_link_probe(link) == ESP_OK) {
+            modbus_master_recovered(start_us, &stats->resync_ok);
+            err = ESP_OK;
+        }
+    }
+
+    uint32_t backoff_ms = MODBUS_MASTER_RETRY_BACKOFF_MS;
+    for (int i = 0; i < MODBUS_MASTER_RETRY_ATTEMPTS && err != ESP_OK && !preempted; i++) {
+        // Backoff chờ ngoài bus, trong lúc đó task khác được dùng bus
+        preempted = modbus_master_recover_yield(backoff_ms);
+        backoff_ms *= 2;
+        if (preempted || link->state != MODBUS_MASTER_LINK_SUSPECT) {
+            break;
+        }
+
+        modbus_master_recovery_count(&stats->retry_attempts);
+        if (modbus_master_link_probe(link) == ESP_OK) {
+            modbus_master_recovered(start_us, &stats->retry_ok);
+            err = ESP_OK;
+        }
+    }
+
+    modbus_master_ctx.recovering = false;
+    if (err == ESP_OK || link->state == MODBUS_MASTER_LINK_ONLINE) {
+        return ESP_OK; // Task khác đã nhận được phản hồi trong lúc nhả bus
+    }
+    if (preempted) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    modbus_master_link_set_state(link, MODBUS_MASTER_LINK_OFFLINE);
+    link->next_probe_us = esp_timer_get_time() + MODBUS_MASTER_PROBE_INTERVAL_MS * 1000LL;
+    return ESP_ERR_TIMEOUT;
+}
+
+// Probe định kỳ slave offline; offline quá lâu thì dựng lại controller
+static esp_err_t
+modbus_master_link_probe_offline(modbus_master_link_t* link) {
+    int64_t now = esp_timer_get_time();
+    if (now < link->next_probe_us) {
+        return ESP_ERR_TIMEOUT;
+    }
+    link->next_probe_us = now + MODBUS_MASTER_PROBE_INTERVAL_MS * 1000LL;
+
+    modbus_master_ctx.recovering = true;
+    esp_err_t err = modbus_master_link_probe(link);
+
+    // Dựng lại controller là bước dài nhất: nhả bus trước, có lệnh safety thì để lần probe sau
+    int64_t rebuild_us = MODBUS_MASTER_REBUILD_AFTER_MS * 1000LL;
+    if (err != ESP_OK && now - link->offline_since_us >= rebuild_us
+        && now - modbus_master_ctx.last_rebuild_us >= rebuild_us && !modbus_master_recover_yield(0)
+        && link->state == MODBUS_MASTER_LINK_OFFLINE
+        && esp_timer_get_time() - modbus_master_ctx.last_rebuild_us >= rebuild_us) {
+        if (modbus_master_rebuild() == ESP_OK && modbus_master_link_probe(link) == ESP_OK) {
+            modbus_master_recovered(link->offline_since_us, &modbus_master_ctx.recovery.rebuild_ok);
+            err = ESP_OK;
+        }
+    }
+
+    modbus_master_ctx.recovering = false;
+    return err == ESP_OK ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static void
+modbus_master_link_result(modbus_master_link_t* link, esp_err_t err, uint32_t rtt_us) {
+    if (err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE) {
+        // Exception response vẫn chứng tỏ slave còn sống
+        modbus_master_link_ok(link, rtt_us);
+    } else if (err == ESP_ERR_TIMEOUT || err == ESP_FAIL || err == ESP_ERR_INVALID_CRC
+               || err == ESP_ERR_INVALID_SIZE) {
+        // Frame hỏng hay sai cũng là dấu hiệu mất biên frame, resync như khi miss
+        // Lần miss đầu tiên: khôi phục ngay thay vì chờ nhiều chu kỳ poll
+        modbus_master_link_set_state(link, MODBUS_MASTER_LINK_SUSPECT);
+        modbus_master_link_recover(link);
+    }
+}
+
+// Mặc định: 50 ms + 2 lần thời gian frame phản hồi dài nhất (255 ký tự)
+static uint32_t
+modbus_master_default_timeout_ms(void) {
+    if (modbus_master_is_tcp()) {
+        return MODBUS_MASTER_TCP_TIMEOUT_MS;
+    }
+    return 50 + (2 * 255 * modbus_master_ctx.char_us + 999) / 1000;
+}
+
+// Đổi baudrate: tính lại timing, timeout và dựng lại transport
+static esp_err_t
+modbus_master_baud_apply(uint32_t baudrate) {
+    modbus_master_ctx.config.baudrate = baudrate;
+    modbus_master_timing_init(baudrate, modbus_master_ctx.duty_cycle);
+    if (modbus_master_ctx.timeout_auto) {
+        modbus_master_ctx.response_timeout_ms = modbus_master_default_timeout_ms();
+    }
+
+    // RTT đo ở tốc độ cũ không còn đúng
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        link->rtt_count = 0;
+        link->rtt_head = 0;
+        link->timeout_ms = modbus_master_ctx.response_timeout_ms;
+    }
+    return modbus_master_transport_restart();
+}
+
+// Đọc liên tiếp một thanh ghi, đạt khi số lỗi nằm trong ngân sách
+static bool
+modbus_master_baud_qualify(uint32_t baudrate) {
+    const modbus_master_baud_config_t* cfg = &modbus_master_ctx.baud;
+    uint32_t allowed = (uint32_t)cfg->burst * cfg->max_error_permille / 1000;
+    uint32_t errors = 0;
+
+    if (modbus_master_baud_apply(baudrate) != ESP_OK) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < cfg->burst && errors <= allowed; i++) {
+        uint16_t value = 0;
+        uint32_t rtt_us = 0;
+        mb_param_request_t probe = {
+            .slave_addr = cfg->slave_addr,
+            .command = 0x03,
+            .reg_start = cfg->probe_reg,
+            .reg_size = 1
+        };
+        esp_err_t err = modbus_master_send_raw(&probe, &value, &rtt_us);
+        if (err != ESP_OK && err != ESP_ERR_INVALID_RESPONSE) {
+            errors++;
+        }
+    }
+
+    ESP_LOGI(TAG, "Baud %lu: %lu/%u errors, %s", baudrate, errors, cfg->burst, errors <= allowed ? "ok" : "rejected");
+    return errors <= allowed;
+}
+
+static uint32_t
+modbus_master_baud_load(void) {
+    nvs_handle_t nvs;
+    uint32_t baudrate = 0;
+    if (modbus_master_ctx.baud.nvs_namespace
+        && nvs_open(modbus_master_ctx.baud.nvs_namespace, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u32(nvs, MODBUS_MASTER_BAUD_NVS_KEY, &baudrate);
+        nvs_close(nvs);
+    }
+    return baudrate;
+}
+
+static void
+modbus_master_baud_store(uint32_t baudrate) {
+    nvs_handle_t nvs;
+    if (!modbus_master_ctx.baud.nvs_namespace
+        || nvs_open(modbus_master_ctx.baud.nvs_namespace, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_u32(nvs, MODBUS_MASTER_BAUD_NVS_KEY, baudrate) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+// Thử lần lượt các tốc độ từ first trở xuống, giữ tốc độ đầu tiên đạt
+static bool
+modbus_master_baud_select(uint8_t first) {
+    for (uint8_t i = first; i < modbus_master_ctx.baud.num_rates; i++) {
+        if (modbus_master_baud_qualify(modbus_master_ctx.baud_rates[i])) {
+            modbus_master_ctx.baud_index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Lỗi của traffic thật theo cửa sổ; vượt ngân sách thì lùi xuống tốc độ chậm hơn
+static void
+modbus_master_baud_track(const modbus_master_link_t* link, esp_err_t err) {
+    if (!modbus_master_ctx.baud_active || link->addr != modbus_master_ctx.baud.slave_addr
+        || link->state == MODBUS_MASTER_LINK_OFFLINE) {
+        return; // Slave chết không phải do tốc độ
+    }
+
+    if (err == ESP_ERR_NOT_FINISHED || modbus_master_ctx.baud_fallback) {
+        return; // Đường truyền bận (request chưa gửi), hoặc đang chờ lùi tốc độ
+    }
+    modbus_master_ctx.baud_window_txns++;
+    if (err != ESP_OK && err != ESP_ERR_INVALID_RESPONSE) {
+        modbus_master_ctx.baud_window_errors++;
+    }
+    if (modbus_master_ctx.baud_window_txns < MODBUS_MASTER_BAUD_WINDOW) {
+        return;
+    }
+
+    uint32_t permille = (uint32_t)modbus_master_ctx.baud_window_errors * 1000 / MODBUS_MASTER_BAUD_WINDOW;
+    modbus_master_ctx.baud_window_txns = 0;
+    modbus_master_ctx.baud_window_errors = 0;
+    if (permille <= modbus_master_ctx.baud.max_error_permille) {
+        return;
+    }
+
+    // Đã ở tốc độ chậm nhất: không còn gì để lùi, không dựng lại transport
+    if (modbus_master_ctx.baud_index + 1 >= modbus_master_ctx.baud.num_rates) {
+        ESP_LOGW(TAG, "Baud %lu: %lu%% errors at the slowest rate", modbus_master_ctx.config.baudrate, permille / 10);
+        return;
+    }
+
+    // Burst kiểm tra tốc độ mới dài cả trăm transaction: giao cho worker, không chạy trong lần gửi này
+    ESP_LOGW(TAG, "Baud %lu: %lu%% errors, falling back", modbus_master_ctx.config.baudrate, permille / 10);
+    modbus_master_ctx.baud_fallback = true;
+    if (modbus_master_ctx.worker) {
+        xTaskNotifyGive(modbus_master_ctx.worker);
+    }
+}
+
+// Lùi xuống tốc độ chậm hơn đầu tiên còn đạt (chạy trong worker). Không lưu NVS: một lúc nhiễu không được
+// giữ link ở tốc độ chậm mãi mãi, boot sau lại bắt đầu từ tốc độ đã thương lượng
+static void
+modbus_master_baud_fallback(void) {
+    if (modbus_master_lock() != ESP_OK) {
+        return; // Giữ cờ, thử lại ở vòng sau
+    }
+
+    uint32_t current = modbus_master_ctx.config.baudrate;
+    if (!modbus_master_baud_select(modbus_master_ctx.baud_index + 1)) {
+        modbus_master_baud_apply(current); // Không tốc độ chậm hơn nào đạt, giữ nguyên
+    }
+    modbus_master_ctx.baud_window_txns = 0;
+    modbus_master_ctx.baud_window_errors = 0;
+    modbus_master_ctx.baud_fallback = false;
+    modbus_master_unlock();
+}
+
+static esp_err_t
+modbus_master_send(mb_param_request_t* request, void* data) {
+    modbus_master_link_t* link = modbus_master_link_get(request->slave_addr);
+
+    // Slave đã mất kết nối: không chiếm bus, chỉ probe định kỳ
+    if (link && link->state == MODBUS_MASTER_LINK_OFFLINE && modbus_master_link_probe_offline(link) != ESP_OK) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    uint32_t rtt_us = 0;
+    modbus_master_ctx.tcp_reconnected = false;
+    esp_err_t err = modbus_master_send_raw(request, data, &rtt_us);
+    if (link) {
+        modbus_master_link_result(link, err, rtt_us);
+        modbus_master_baud_track(link, err);
+    }
+    return err;
+}
+
+// FC 0x17: ghi rồi đọc trong một transaction. Trả về kết quả đọc; kết quả ghi nằm ở wr_err
+static esp_err_t
+modbus_master_send_rw(uint8_t slave_addr, uint16_t rd_addr, uint16_t rd_count, uint16_t* rd_data, uint16_t wr_addr,
+                      uint16_t wr_count, const uint16_t* wr_data, esp_err_t* wr_err) {
+    bool same_range = (rd_addr == wr_addr && rd_count == wr_count);
+
+    // esp-modbus RTU chỉ gửi 0x17 với vùng đọc và ghi trùng nhau: tách thành ghi + đọc liền nhau.
+    // Vùng đọc của station (1005..1009) không trùng vùng ghi nên cấu hình này luôn đi nhánh tách.
+    bool esp_modbus = modbus_master_ctx.config.transport == MODBUS_MASTER_TRANSPORT_RTU;
+    if (esp_modbus && !same_range) {
+        mb_param_request_t write = {
+            .slave_addr = slave_addr,
+            .command = wr_count == 1 ? 0x06 : 0x10,
+            .reg_start = wr_addr,
+            .reg_size = wr_count
+        };
+        // Ghi lỗi vẫn đọc: lần đọc là poll của caller, không để nó mất theo lệnh ghi
+        *wr_err = modbus_master_send(&write, (void*)wr_data);
+        mb_param_request_t read = {
+            .slave_addr = slave_addr,
+            .command = 0x03,
+            .reg_start = rd_addr,
+            .reg_size = rd_count
+        };
+        return modbus_master_send(&read, rd_data);
+    }
+
+    // esp-modbus dùng chung một buffer cho dữ liệu ghi và đọc
+    if (esp_modbus && rd_data != wr_data) {
+        memcpy(rd_data, wr_data, wr_count * sizeof(uint16_t));
+    }
+
+    mb_param_request_t request = {
+        .slave_addr = slave_addr,
+        .command = 0x17,
+        .reg_start = rd_addr,
+        .reg_size = rd_count
+    };
+    modbus_master_ctx.rw_write = (modbus_master_rw_t){wr_addr, wr_count, wr_data};
+    esp_err_t err = modbus_master_send(&request, rd_data);
+    modbus_master_ctx.rw_write = (modbus_master_rw_t){0};
+    *wr_err = err;
+    return err;
+}
+
+// Lấy vùng gom của slave khi vùng đọc (hoặc ghi) chứa một thanh ghi dirty, hoặc (rd_count = 0) vùng bất kỳ
+// đã quá hạn
+static bool
+modbus_master_stage_take(uint8_t slave_addr, uint16_t rd_addr, uint16_t rd_count, modbus_master_stage_t* stage) {
+    int64_t now = esp_timer_get_time();
+    bool found = false;
+
+    portENTER_CRITICAL(&modbus_master_ctx.stage_lock);
+    for (int i = 0; i < MODBUS_MASTER_STAGE_SLOTS && !found; i++) {
+        modbus_master_stage_t* st = &modbus_master_ctx.stages[i];
+        if (!st->dirty) {
+            continue;
+        }
+        if (rd_count == 0) {
+            found = st->deadline_us <= now;
+        } else if (st->slave_addr == slave_addr) {
+            for (int k = 0; k < MODBUS_MASTER_STAGE_REGS && !found; k++) {
+                uint32_t reg = (uint32_t)st->base + k;
+                found = (st->dirty & (1U << k)) && reg >= rd_addr && reg < (uint32_t)rd_addr + rd_count;
+            }
+        }
+        if (found) {
+            *stage = *st;
+            st->dirty = 0;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stage_lock);
+
+    if (!found) {
+        stage->dirty = 0;
+    }
+    return found;
+}
+
+// Số tick tới hạn chót sớm nhất của các vùng gom
+static TickType_t
+modbus_master_stage_wait_ticks(void) {
+    int64_t earliest = INT64_MAX;
+
+    portENTER_CRITICAL(&modbus_master_ctx.stage_lock);
+    for (int i = 0; i < MODBUS_MASTER_STAGE_SLOTS; i++) {
+        if (modbus_master_ctx.stages[i].dirty && modbus_master_ctx.stages[i].deadline_us < earliest) {
+            earliest = modbus_master_ctx.stages[i].deadline_us;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stage_lock);
+
+    if (earliest == INT64_MAX) {
+        return portMAX_DELAY;
+    }
+    int64_t wait_us = earliest - esp_timer_get_time();
+    TickType_t ticks = wait_us > 0 ? pdMS_TO_TICKS((wait_us + 999) / 1000) : 0;
+    return ticks > 0 ? ticks : 1;
+}
+
+// Ghi mỗi đoạn dirty liền nhau bằng một FC 0x10 (0x06 nếu chỉ một thanh ghi), không đụng
+// thanh ghi không dirty. Đoạn cuối đi chung với lần đọc (FC 0x17) nếu có rd_data.
+static esp_err_t
+modbus_master_stage_send(modbus_master_stage_t* stage, uint16_t rd_addr, uint16_t rd_count, uint16_t* rd_data) {
+    esp_err_t err = ESP_OK;
+    int k = 0;
+
+    while (k < MODBUS_MASTER_STAGE_REGS) {
+        if (!(stage->dirty & (1U << k))) {
+            k++;
+            continue;
+        }
+        int first = k;
+        while (k < MODBUS_MASTER_STAGE_REGS && (stage->dirty & (1U << k))) {
+            k++;
+        }
+        uint16_t count = k - first;
+        bool last = k == MODBUS_MASTER_STAGE_REGS || (stage->dirty >> k) == 0;
+
+        esp_err_t wr_err;
+        if (last && rd_data) {
+            err = modbus_master_send_rw(stage->slave_addr, rd_addr, rd_count, rd_data, stage->base + first, count,
+                                        &stage->values[first], &wr_err);
+        } else {
+            mb_param_request_t request = {
+                .slave_addr = stage->slave_addr,
+                .command = count == 1 ? 0x06 : 0x10,
+                .reg_start = stage->base + first,
+                .reg_size = count
+            };
+            err = modbus_master_send(&request, &stage->values[first]);
+            wr_err = err;
+        }
+        for (int r = first; r < k; r++) {
+            stage->results[r] = wr_err;
+        }
+        if (wr_err == ESP_OK) {
+            portENTER_CRITICAL(&modbus_master_ctx.stage_lock);
+            for (int r = first; r < k; r++) {
+                modbus_master_shadow_t* sh = modbus_master_shadow_get(stage->slave_addr, stage->base + r, false);
+                if (sh && sh->seq_staged == stage->seqs[r]) {
+                    sh->written = stage->values[r];
+                    sh->seq_acked = stage->seqs[r];
+                }
+            }
+            portEXIT_CRITICAL(&modbus_master_ctx.stage_lock);
+        }
+    }
+    return err;
+}
+
+// Báo kết quả từng thanh ghi đã ghi (gọi sau khi nhả bus)
+static void
+modbus_master_stage_done(const modbus_master_stage_t* stage) {
+    for (int k = 0; k < MODBUS_MASTER_STAGE_REGS; k++) {
+        if (!(stage->dirty & (1U << k)) || !stage->callbacks[k]) {
+            continue;
+        }
+        modbus_master_request_t req = {
+            .id = stage->seqs[k],
+            .lane = MODBUS_MASTER_LANE_COMMAND,
+            .slave_addr = stage->slave_addr,
+            .command = 0x06,
+            .reg_addr = stage->base + k,
+            .reg_count = 1,
+            .values = {stage->values[k]},
+            .callback = stage->callbacks[k],
+            .arg = stage->args[k],
+        };
+        stage->callbacks[k](&req, stage->results[k], stage->args[k]);
+    }
+}
+
+// Đọc holding register, kèm các lệnh ghi đang gom nếu vùng đọc chứa một trong số đó
+static esp_err_t
+modbus_master_read_holding(uint8_t slave_addr, uint16_t reg_addr, uint16_t reg_count, uint16_t* data,
+                           modbus_master_stage_t* stage) {
+    if (modbus_master_stage_take(slave_addr, reg_addr, reg_count, stage)) {
+        return modbus_master_stage_send(stage, reg_addr, reg_count, data);
+    }
+
+    mb_param_request_t request = {
+        .slave_addr = slave_addr,
+        .command = 0x03,
+        .reg_start = reg_addr,
+        .reg_size = reg_count
+    };
+    return modbus_master_send(&request, data);
+}
+
+// TCP: gửi cả lô, nhiều transaction cùng lúc trên kết nối, khớp theo transaction ID
+static void
+modbus_master_send_pipelined(modbus_master_read_t* reads, uint8_t count, uint32_t skip_mask) {
+    modbus_master_tcp_txn_t txns[MODBUS_MASTER_BATCH_MAX];
+    uint8_t index[MODBUS_MASTER_BATCH_MAX];
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (skip_mask & (1UL << i)) {
+            continue;
+        }
+        modbus_master_link_t* link = modbus_master_link_get(reads[i].slave_addr);
+        if (link && link->state == MODBUS_MASTER_LINK_OFFLINE && modbus_master_link_probe_offline(link) != ESP_OK) {
+            reads[i].result = ESP_ERR_TIMEOUT;
+            continue;
+        }
+        txns[n] = (modbus_master_tcp_txn_t){
+            .unit_id = reads[i].slave_addr,
+            .command = reads[i].command,
+            .reg_addr = reads[i].reg_addr,
+            .reg_count = reads[i].reg_count,
+            .data = reads[i].data,
+            .timeout_ms = modbus_master_link_timeout_ms(reads[i].slave_addr)
+        };
+        index[n++] = i;
+    }
+
+    if (n == 0) {
+        return;
+    }
+    // Cả lô chỉ kết nối lại một lần, kể cả khi nhiều transaction cùng lỗi vì mất kết nối
+    modbus_master_ctx.tcp_reconnected = false;
+    if (!modbus_master_tcp_is_open()) {
+        modbus_master_ctx.tcp_reconnected = true;
+        modbus_master_tcp_reconnect();
+    }
+    modbus_master_tcp_transact(txns, n);
+
+    for (uint8_t k = 0; k < n; k++) {
+        modbus_master_read_t* read = &reads[index[k]];
+        mb_param_request_t request = {
+            .slave_addr = read->slave_addr,
+            .command = read->command,
+            .reg_start = read->reg_addr,
+            .reg_size = read->reg_count
+        };
+        uint32_t tx_chars, rx_chars;
+
+        if (modbus_master_capture_active()) {
+            modbus_master_rtu_txn_t rtu_txn = {
+                .slave_addr = read->slave_addr,
+                .command = read->command,
+                .reg_addr = read->reg_addr,
+                .reg_count = read->reg_count,
+                .data = read->data
+            };
+            modbus_master_capture_txn(&rtu_txn, false);
+            if (txns[k].result == ESP_OK) {
+                modbus_master_capture_txn(&rtu_txn, true);
+            }
+        }
+
+        read->result = txns[k].result;
+        modbus_master_ctx.last_txn_us = txns[k].rtt_us;
+        modbus_master_wire_chars(&request, &tx_chars, &rx_chars);
+        modbus_master_stats_record(&request, read->result, txns[k].rtt_us, tx_chars, rx_chars);
+
+        modbus_master_link_t* link = modbus_master_link_get(read->slave_addr);
+        if (link) {
+            modbus_master_link_result(link, read->result, txns[k].rtt_us);
+        }
+    }
+}
+
+// Chép frame vào ring, gọi khi đang giữ bus nên chỉ có một producer
+static void
+modbus_master_publish(uint8_t slave_addr, uint8_t reg_type, uint16_t reg_addr, const uint16_t* data,
+                      uint16_t reg_count) {
+    if (reg_count == 0 || reg_count > MODBUS_MASTER_FRAME_REGS) {
+        return;
+    }
+    if (reg_type == 0x03) {
+        modbus_master_shadow_update(slave_addr, reg_addr, reg_count, data, true, true);
+    }
+
+    uint32_t seq = atomic_load_explicit(&modbus_master_ctx.ring_head, memory_order_relaxed) + 1;
+    if (seq == 0) {
+        seq = 1; // 0 đánh dấu ô đang ghi
+    }
+    modbus_master_ring_slot_t* slot = &modbus_master_ctx.ring[seq & (MODBUS_MASTER_FRAME_RING - 1)];
+
+    atomic_store_explicit(&slot->stamp, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->frame.seq = seq;
+    slot->frame.slave_addr = slave_addr;
+    slot->frame.reg_type = reg_type;
+    slot->frame.reg_addr = reg_addr;
+    slot->frame.reg_count = reg_count;
+    slot->frame.timestamp_us = esp_timer_get_time();
+    memcpy(slot->frame.data, data, reg_count * sizeof(uint16_t));
+    atomic_store_explicit(&slot->stamp, seq, memory_order_release);
+    atomic_store_explicit(&modbus_master_ctx.ring_head, seq, memory_order_release);
+
+    modbus_master_ctx.frames_pending = true;
+}
+
+static void
+modbus_master_notify_readers(void) {
+    TaskHandle_t tasks[MODBUS_MASTER_MAX_READERS];
+    int num_tasks = 0;
+
+    portENTER_CRITICAL(&modbus_master_ctx.reader_lock);
+    for (int i = 0; i < MODBUS_MASTER_MAX_READERS; i++) {
+        if (modbus_master_ctx.readers[i]) {
+            tasks[num_tasks++] = modbus_master_ctx.readers[i]->task;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.reader_lock);
+
+    for (int i = 0; i < num_tasks; i++) {
+        xTaskNotifyGive(tasks[i]);
+    }
+}
 
 static esp_err_t
 modbus_master_lock(void) {
@@ -28,29 +1311,50 @@ modbus_master_lock(void) {
 
 static void
 modbus_master_unlock(void) {
+    bool notify = modbus_master_ctx.frames_pending;
+    modbus_master_ctx.frames_pending = false;
+
+    // Lấy sự kiện link khi còn giữ bus, gọi callback sau khi nhả
+    struct {
+        uint8_t addr;
+        bool connected;
+    } events[MODBUS_MASTER_MAX_SLAVES];
+    int num_events = 0;
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        if (link->notify) {
+            events[num_events].addr = link->addr;
+            events[num_events].connected = link->notify > 0;
+            num_events++;
+            link->notify = 0;
+        }
+    }
+    modbus_master_link_callback_t link_callback = modbus_master_ctx.link_callback;
+
     if (modbus_master_ctx.mutex) {
         xSemaphoreGive(modbus_master_ctx.mutex);
     }
-}
-
-esp_err_t
-modbus_master_init(const modbus_master_config_t* config) {
-    if (!config) {
-        return ESP_ERR_INVALID_ARG;
+    if (notify) {
+        modbus_master_notify_readers();
     }
-
-    if (modbus_master_ctx.initialized) {
-        ESP_LOGW(TAG, "Already initialized");
-        return ESP_OK;
+    for (int i = 0; i < num_events && link_callback; i++) {
+        link_callback(events[i].addr, events[i].connected);
     }
+}
 
-    modbus_master_ctx.mutex = xSemaphoreCreateMutex();
-    if (!modbus_master_ctx.mutex) {
-        ESP_LOGE(TAG, "Failed to create mutex");
-        return ESP_ERR_NO_MEM;
+// Tạo và start controller esp-modbus (hoặc kết nối TCP) theo config hiện tại
+static esp_err_t
+modbus_master_controller_create(void) {
+    if (modbus_master_is_tcp()) {
+        return modbus_master_tcp_open(modbus_master_ctx.config.tcp_host, modbus_master_ctx.config.tcp_port,
+                                      modbus_master_ctx.response_timeout_ms, modbus_master_ctx.config.tcp_max_inflight);
+    }
+    if (modbus_master_is_native()) {
+        // Không cần descriptor giả hay task của esp-modbus
+        return modbus_master_rtu_open(modbus_master_ctx.config.uart_port, modbus_master_ctx.config.tx_pin,
+                                      modbus_master_ctx.config.rx_pin, modbus_master_ctx.config.rts_pin,
+                                      modbus_master_ctx.config.baudrate, modbus_master_ctx.response_timeout_ms);
     }
-
-    memcpy(&modbus_master_ctx.config, config, sizeof(modbus_master_config_t));
 
     static mb_parameter_descriptor_t device_params = {0};
     device_params.cid = 0;
@@ -66,37 +1370,38 @@ modbus_master_init(const modbus_master_config_t* config) {
 
     mb_communication_info_t comm_info = {0};
     comm_info.ser_opts.mode = MB_RTU;
-    comm_info.ser_opts.port = config->uart_port;
-    comm_info.ser_opts.baudrate = config->baudrate;
+    comm_info.ser_opts.port = modbus_master_ctx.config.uart_port;
+    comm_info.ser_opts.baudrate = modbus_master_ctx.config.baudrate;
     comm_info.ser_opts.data_bits = UART_DATA_8_BITS;
     comm_info.ser_opts.parity = UART_PARITY_DISABLE;
     comm_info.ser_opts.stop_bits = UART_STOP_BITS_1;
     comm_info.ser_opts.uid = 0;
+    comm_info.ser_opts.response_tout_ms = modbus_master_ctx.response_timeout_ms;
 
     esp_err_t err = mbc_master_create_serial(&comm_info, &modbus_master_ctx.master_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "mbc_master_create_serial failed: %s", esp_err_to_name(err));
-        vSemaphoreDelete(modbus_master_ctx.mutex);
+        modbus_master_ctx.master_handle = NULL;
         return err;
     }
 
-    err = uart_set_pin(config->uart_port,
-                       config->tx_pin,
-                       config->rx_pin,
-                       config->rts_pin,       
+    err = uart_set_pin(modbus_master_ctx.config.uart_port,
+                       modbus_master_ctx.config.tx_pin,
+                       modbus_master_ctx.config.rx_pin,
+                       modbus_master_ctx.config.rts_pin,       
                        UART_PIN_NO_CHANGE);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "uart_set_pin failed: %s", esp_err_to_name(err));
         mbc_master_delete(modbus_master_ctx.master_handle);
-        vSemaphoreDelete(modbus_master_ctx.mutex);
+        modbus_master_ctx.master_handle = NULL;
         return err;
     }
 
-    err = uart_set_mode(config->uart_port, UART_MODE_RS485_HALF_DUPLEX);
+    err = uart_set_mode(modbus_master_ctx.config.uart_port, UART_MODE_RS485_HALF_DUPLEX);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "uart_set_mode failed: %s", esp_err_to_name(err));
         mbc_master_delete(modbus_master_ctx.master_handle);
-        vSemaphoreDelete(modbus_master_ctx.mutex);
+        modbus_master_ctx.master_handle = NULL;
         return err;
     }
 
@@ -106,7 +1411,7 @@ modbus_master_init(const modbus_master_config_t* config) {
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "mbc_master_set_descriptor failed: %s", esp_err_to_name(err));
         mbc_master_delete(modbus_master_ctx.master_handle);
-        vSemaphoreDelete(modbus_master_ctx.mutex);
+        modbus_master_ctx.master_handle = NULL;
         return err;
     }
 
@@ -114,16 +1419,73 @@ modbus_master_init(const modbus_master_config_t* config) {
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "mbc_master_start failed: %s", esp_err_to_name(err));
         mbc_master_delete(modbus_master_ctx.master_handle);
+        modbus_master_ctx.master_handle = NULL;
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_init(const modbus_master_config_t* config) {
+    if (!config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->transport == MODBUS_MASTER_TRANSPORT_TCP ? !config->tcp_host : config->baudrate == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (modbus_master_ctx.initialized) {
+        ESP_LOGW(TAG, "Already initialized");
+        return ESP_OK;
+    }
+
+    modbus_master_ctx.mutex = xSemaphoreCreateMutex();
+    if (!modbus_master_ctx.mutex) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(&modbus_master_ctx.config, config, sizeof(modbus_master_config_t));
+    modbus_master_timing_init(config->baudrate, config->duty_cycle);
+    memset(modbus_master_ctx.links, 0, sizeof(modbus_master_ctx.links));
+    memset(&modbus_master_ctx.recovery, 0, sizeof(modbus_master_ctx.recovery));
+    modbus_master_ctx.stats_since_us = esp_timer_get_time();
+
+    modbus_master_ctx.baud_active = false;
+    modbus_master_ctx.timeout_auto = config->response_timeout_ms == 0;
+    modbus_master_ctx.response_timeout_ms = modbus_master_ctx.timeout_auto ? modbus_master_default_timeout_ms()
+                                                                           : config->response_timeout_ms;
+
+    esp_err_t err = modbus_master_controller_create();
+    if (err != ESP_OK) {
         vSemaphoreDelete(modbus_master_ctx.mutex);
+        modbus_master_ctx.mutex = NULL;
         return err;
     }
 
     modbus_master_ctx.initialized = true;
     modbus_master_ctx.running = true;
 
+    err = modbus_master_worker_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start worker: %s", esp_err_to_name(err));
+        modbus_master_deinit();
+        return err;
+    }
+
     ESP_LOGI(TAG, "✅ Modbus Master initialized");
-    ESP_LOGI(TAG, "   UART%d @ %lu baud", config->uart_port, config->baudrate);
-    ESP_LOGI(TAG, "   TX=%d RX=%d RTS=%d", config->tx_pin, config->rx_pin, config->rts_pin);
+    if (modbus_master_is_tcp()) {
+        ESP_LOGI(TAG, "   TCP %s:%u, %u in flight", config->tcp_host, config->tcp_port ? config->tcp_port : 502,
+                 modbus_master_tcp_inflight());
+    } else {
+        ESP_LOGI(TAG, "   UART%d @ %lu baud (%s)", config->uart_port, config->baudrate,
+                 modbus_master_is_native() ? "native engine" : "esp-modbus");
+        ESP_LOGI(TAG, "   TX=%d RX=%d RTS=%d", config->tx_pin, config->rx_pin, config->rts_pin);
+        ESP_LOGI(TAG, "   t3.5=%luus duty=%u%%", modbus_master_ctx.t35_us,
+                 config->duty_cycle ? config->duty_cycle : 100);
+    }
+    ESP_LOGI(TAG, "   Response timeout ceiling %lums", modbus_master_ctx.response_timeout_ms);
 
     return ESP_OK;
 }
@@ -134,6 +1496,9 @@ modbus_master_deinit(void) {
         return ESP_OK;
     }
 
+    modbus_master_worker_stop();
+    memset(modbus_master_ctx.stages, 0, sizeof(modbus_master_ctx.stages));
+
     modbus_master_lock();
     modbus_master_ctx.running = false;
 
@@ -142,23 +1507,259 @@ modbus_master_deinit(void) {
         mbc_master_delete(modbus_master_ctx.master_handle);
         modbus_master_ctx.master_handle = NULL;
     }
+    modbus_master_tcp_close();
+    modbus_master_rtu_close();
+
+    modbus_master_ctx.initialized = false;
+    modbus_master_ctx.callback = NULL;
+    modbus_master_unlock();
+
+    if (modbus_master_ctx.mutex) {
+        vSemaphoreDelete(modbus_master_ctx.mutex);
+        modbus_master_ctx.mutex = NULL;
+    }
+
+    ESP_LOGI(TAG, "Modbus stopped");
+    return ESP_OK;
+}
+
+void
+modbus_master_register_callback(modbus_master_data_callback_t callback) {
+    modbus_master_ctx.callback = callback;
+}
+
+esp_err_t
+modbus_master_reader_register(modbus_master_reader_t* reader, TaskHandle_t task) {
+    if (!reader) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    reader->task = task ? task : xTaskGetCurrentTaskHandle();
+    reader->dropped = 0;
+    reader->next = atomic_load_explicit(&modbus_master_ctx.ring_head, memory_order_acquire) + 1;
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&modbus_master_ctx.reader_lock);
+    for (int i = 0; i < MODBUS_MASTER_MAX_READERS; i++) {
+        if (!modbus_master_ctx.readers[i]) {
+            modbus_master_ctx.readers[i] = reader;
+            err = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.reader_lock);
+    return err;
+}
+
+void
+modbus_master_reader_unregister(modbus_master_reader_t* reader) {
+    portENTER_CRITICAL(&modbus_master_ctx.reader_lock);
+    for (int i = 0; i < MODBUS_MASTER_MAX_READERS; i++) {
+        if (modbus_master_ctx.readers[i] == reader) {
+            modbus_master_ctx.readers[i] = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.reader_lock);
+}
+
+bool
+modbus_master_reader_next(modbus_master_reader_t* reader, modbus_master_frame_t* frame) {
+    if (!reader || !frame) {
+        return false;
+    }
+
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&modbus_master_ctx.ring_head, memory_order_acquire);
+        int32_t behind = (int32_t)(head - reader->next);
+        if (behind < 0) {
+            return false;
+        }
+        if (behind >= MODBUS_MASTER_FRAME_RING) {
+            // Chậm hơn một vòng ring: bỏ các frame đã bị ghi đè
+            uint32_t oldest = head - MODBUS_MASTER_FRAME_RING + 1;
+            reader->dropped += oldest - reader->next;
+            reader->next = oldest;
+        }
+
+        const modbus_master_ring_slot_t* slot = &modbus_master_ctx.ring[reader->next & (MODBUS_MASTER_FRAME_RING - 1)];
+        if (atomic_load_explicit(&slot->stamp, memory_order_acquire) == reader->next) {
+            memcpy(frame, &slot->frame, sizeof(*frame));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->stamp, memory_order_relaxed) == reader->next) {
+                reader->next++;
+                return true;
+            }
+        }
+
+        // Producer ghi đè ô trong lúc đọc
+        reader->dropped++;
+        reader->next++;
+    }
+}
+
+// Ghép request/response (nghe trên bus hoặc phát lại); true khi frame là response khớp request trước đó
+static bool
+modbus_master_sniff_decode(modbus_master_sniff_req_t* req, const uint8_t* adu, size_t len,
+                           modbus_master_frame_t* frame) {
+    if (len < 4) {
+        req->valid = false;
+        return false;
+    }
+    uint8_t fc = adu[1];
+
+    // Response: addr fc byte_count data crc(2)
+    if (req->valid && adu[0] == req->slave_addr && fc == req->command && adu[2] == 2 * req->reg_count
+        && len == 5u + 2 * req->reg_count) {
+        req->valid = false;
+        frame->slave_addr = adu[0];
+        frame->reg_type = fc == 0x04 ? 0x04 : 0x03;
+        frame->reg_addr = req->reg_addr;
+        frame->reg_count = req->reg_count;
+        for (uint16_t i = 0; i < req->reg_count; i++) {
+            frame->data[i] = (uint16_t)((adu[3 + 2 * i] << 8) | adu[4 + 2 * i]);
+        }
+        return true;
+    }
+
+    // Request: addr fc start(2) count(2) [FC 0x17: vùng ghi] crc(2)
+    bool read_req = (fc == 0x03 || fc == 0x04) && len == 8;
+    bool rw_req = fc == 0x17 && len >= 13 && len == 13u + adu[10];
+    uint16_t count = (uint16_t)((adu[4] << 8) | adu[5]);
+    req->valid = (read_req || rw_req) && adu[0] != 0 && count > 0 && count <= MODBUS_MASTER_FRAME_REGS;
+    if (req->valid) {
+        req->slave_addr = adu[0];
+        req->command = fc;
+        req->reg_addr = (uint16_t)((adu[2] << 8) | adu[3]);
+        req->reg_count = count;
+    }
+    return false;
+}
+
+esp_err_t
+modbus_master_sniff(uint32_t listen_ms, modbus_master_sniff_cb_t callback, void* arg) {
+    if (!modbus_master_ctx.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!modbus_master_is_native()) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    static uint8_t adu[MODBUS_MASTER_RTU_MAX_ADU];
+    static modbus_master_frame_t frame;
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)listen_ms * 1000;
+    esp_err_t result = ESP_ERR_TIMEOUT;
+
+    for (;;) {
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        if (left_us <= 0) {
+            break;
+        }
+        uint32_t slice_ms = (uint32_t)((left_us + 999) / 1000);
+        if (slice_ms > MODBUS_MASTER_SNIFF_SLICE_MS) {
+            slice_ms = MODBUS_MASTER_SNIFF_SLICE_MS;
+        }
+
+        // Giữ bus từng lát ngắn để request trong hàng đợi không phải chờ
+        esp_err_t err = modbus_master_lock();
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        size_t len = 0;
+        bool heard = modbus_master_rtu_listen(adu, &len, slice_ms) == ESP_OK;
+        bool got = heard && modbus_master_sniff_decode(&modbus_master_ctx.sniff_req, adu, len, &frame);
+        if (heard && (got || modbus_master_ctx.sniff_req.valid)) {
+            modbus_master_capture_record(got ? MODBUS_MASTER_CAPTURE_RX : MODBUS_MASTER_CAPTURE_TX, adu, len);
+        }
+        if (got) {
+            for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+                modbus_master_link_t* link = &modbus_master_ctx.links[i];
+                if (link->used && link->addr == frame.slave_addr) {
+                    modbus_master_link_set_state(link, MODBUS_MASTER_LINK_ONLINE);
+                }
+            }
+            modbus_master_publish(frame.slave_addr, frame.reg_type, frame.reg_addr, frame.data, frame.reg_count);
+        }
+
+        modbus_master_unlock();
+        if (!got) {
+            continue;
+        }
+
+        result = ESP_OK;
+        if (callback) {
+            callback(frame.slave_addr, frame.reg_type, frame.reg_addr, frame.data, frame.reg_count, arg);
+        }
+        if (modbus_master_ctx.callback) {
+            modbus_master_ctx.callback(frame.slave_addr, frame.reg_type, frame.reg_addr, frame.data, frame.reg_count);
+        }
+    }
+    return result;
+}
+
+esp_err_t
+modbus_master_replay(const char* capture, uint16_t speed, modbus_master_sniff_cb_t callback, void* arg) {
+    if (!capture) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    static char line[640];
+    static uint8_t adu[MODBUS_MASTER_RTU_MAX_ADU];
+    static modbus_master_frame_t frame;
+    modbus_master_sniff_req_t req = {.valid = false};
+    modbus_master_capture_rec_t rec;
+    int64_t start_us = esp_timer_get_time();
+    int64_t first_us = -1;
+    uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+    uint32_t frames = 0;
+
+    for (const char* p = capture; *p;) {
+        const char* eol = strchr(p, '\n');
+        size_t n = eol ? (size_t)(eol - p) : strlen(p);
+        if (n >= sizeof(line)) {
+            n = sizeof(line) - 1; // Dòng quá dài: parse sẽ bỏ
+        }
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p = eol ? eol + 1 : p + strlen(p);
+
+        if (!modbus_master_capture_parse_line(line, &rec, adu) || modbus_master_rtu_crc16(rec.adu, rec.len) != 0) {
+            continue;
+        }
+        if (first_us < 0) {
+            first_us = rec.timestamp_us;
+        }
+        if (!modbus_master_sniff_decode(&req, rec.adu, rec.len, &frame)) {
+            continue;
+        }
 
-    modbus_master_ctx.initialized = false;
-    modbus_master_ctx.callback = NULL;
-    modbus_master_unlock();
+        // Giữ khoảng cách thời gian như lúc ghi, chia theo tốc độ
+        if (speed) {
+            int64_t wait_us = start_us + (rec.timestamp_us - first_us) / speed - esp_timer_get_time();
+            if (wait_us >= tick_us) {
+                vTaskDelay((TickType_t)(wait_us / tick_us));
+            }
+        }
 
-    if (modbus_master_ctx.mutex) {
-        vSemaphoreDelete(modbus_master_ctx.mutex);
-        modbus_master_ctx.mutex = NULL;
-    }
+        // Chưa init (không có bus thật) thì không cần lock
+        esp_err_t err = modbus_master_lock();
+        if (err == ESP_ERR_TIMEOUT) {
+            return err;
+        }
+        modbus_master_publish(frame.slave_addr, frame.reg_type, frame.reg_addr, frame.data, frame.reg_count);
+        modbus_master_unlock();
 
-    ESP_LOGI(TAG, "Modbus stopped");
-    return ESP_OK;
-}
+        frames++;
+        if (callback) {
+            callback(frame.slave_addr, frame.reg_type, frame.reg_addr, frame.data, frame.reg_count, arg);
+        }
+        if (modbus_master_ctx.callback) {
+            modbus_master_ctx.callback(frame.slave_addr, frame.reg_type, frame.reg_addr, frame.data, frame.reg_count);
+        }
+    }
 
-void
-modbus_master_register_callback(modbus_master_data_callback_t callback) {
-    modbus_master_ctx.callback = callback;
+    ESP_LOGI(TAG, "Replayed %lu frames in %lld ms", frames, (esp_timer_get_time() - start_us) / 1000);
+    return frames ? ESP_OK : ESP_ERR_NOT_FOUND;
 }
 
 esp_err_t
@@ -172,20 +1773,17 @@ modbus_master_read_holding_registers(uint8_t slave_addr, uint16_t reg_addr, uint
         return err;
     }
 
-    mb_param_request_t request = {
-        .slave_addr = slave_addr,
-        .command = 0x03,
-        .reg_start = reg_addr,
-        .reg_size = reg_count
-    };
-
-    err = mbc_master_send_request(modbus_master_ctx.master_handle, &request, data);
+    modbus_master_stage_t stage;
+    err = modbus_master_read_holding(slave_addr, reg_addr, reg_count, data, &stage);
+    if (err == ESP_OK) {
+        modbus_master_publish(slave_addr, 0x03, reg_addr, data, reg_count);
+    }
 
+    modbus_master_unlock();
+    modbus_master_stage_done(&stage);
     if (err == ESP_OK && modbus_master_ctx.callback) {
         modbus_master_ctx.callback(slave_addr, 0x03, reg_addr, data, reg_count);
     }
-
-    modbus_master_unlock();
     return err;
 }
 
@@ -207,13 +1805,15 @@ modbus_master_read_input_registers(uint8_t slave_addr, uint16_t reg_addr, uint16
         .reg_size = reg_count
     };
 
-    err = mbc_master_send_request(modbus_master_ctx.master_handle, &request, data);
+    err = modbus_master_send(&request, data);
+    if (err == ESP_OK) {
+        modbus_master_publish(slave_addr, 0x04, reg_addr, data, reg_count);
+    }
 
+    modbus_master_unlock();
     if (err == ESP_OK && modbus_master_ctx.callback) {
         modbus_master_ctx.callback(slave_addr, 0x04, reg_addr, data, reg_count);
     }
-
-    modbus_master_unlock();
     return err;
 }
 
@@ -235,7 +1835,7 @@ modbus_master_write_single_register(uint8_t slave_addr, uint16_t reg_addr, uint1
         .reg_size = 1
     };
 
-    err = mbc_master_send_request(modbus_master_ctx.master_handle, &request, &value);
+    err = modbus_master_send(&request, &value);
 
     modbus_master_unlock();
     return err;
@@ -259,12 +1859,112 @@ modbus_master_write_multiple_registers(uint8_t slave_addr, uint16_t reg_addr, ui
         .reg_size = reg_count
     };
 
-    err = mbc_master_send_request(modbus_master_ctx.master_handle, &request, data);
+    err = modbus_master_send(&request, data);
+
+    modbus_master_unlock();
+    return err;
+}
+
+esp_err_t
+modbus_master_read_write_registers(uint8_t slave_addr, uint16_t rd_addr, uint16_t rd_count, uint16_t* rd_data,
+                                   uint16_t wr_addr, uint16_t wr_count, const uint16_t* wr_data) {
+    if (!modbus_master_ctx.initialized || !rd_data || !wr_data) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (rd_count == 0 || rd_count > 125 || wr_count == 0 || wr_count > 121) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = modbus_master_lock();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    esp_err_t wr_err;
+    err = modbus_master_send_rw(slave_addr, rd_addr, rd_count, rd_data, wr_addr, wr_count, wr_data, &wr_err);
+    if (err == ESP_OK) {
+        modbus_master_publish(slave_addr, 0x03, rd_addr, rd_data, rd_count);
+    }
+
+    modbus_master_unlock();
+    if (err == ESP_OK && modbus_master_ctx.callback) {
+        modbus_master_ctx.callback(slave_addr, 0x03, rd_addr, rd_data, rd_count);
+    }
+    return wr_err != ESP_OK ? wr_err : err;
+}
+
+esp_err_t
+modbus_master_read_multiple(modbus_master_read_t* reads, uint8_t count) {
+    if (!modbus_master_ctx.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!reads || count == 0 || count > MODBUS_MASTER_BATCH_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = modbus_master_lock();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Read đầu tiên chứa lệnh ghi đang gom chạy riêng kèm FC 0x17, phần còn lại gửi pipeline trên TCP
+    modbus_master_stage_t stage = {.dirty = 0};
+    uint32_t done_mask = 0;
+    for (uint8_t i = 0; i < count && !stage.dirty; i++) {
+        if (reads[i].command == 0x03
+            && modbus_master_stage_take(reads[i].slave_addr, reads[i].reg_addr, reads[i].reg_count, &stage)) {
+            reads[i].result = modbus_master_stage_send(&stage, reads[i].reg_addr, reads[i].reg_count, reads[i].data);
+            done_mask |= 1UL << i;
+        }
+    }
+
+    if (modbus_master_is_tcp() && count > 1) {
+        modbus_master_send_pipelined(reads, count, done_mask);
+    } else {
+        for (uint8_t i = 0; i < count; i++) {
+            if (done_mask & (1UL << i)) {
+                continue;
+            }
+            mb_param_request_t request = {
+                .slave_addr = reads[i].slave_addr,
+                .command = reads[i].command,
+                .reg_start = reads[i].reg_addr,
+                .reg_size = reads[i].reg_count
+            };
+            reads[i].result = modbus_master_send(&request, reads[i].data);
+        }
+    }
+
+    err = ESP_OK;
+    for (uint8_t i = 0; i < count; i++) {
+        if (reads[i].result == ESP_OK) {
+            modbus_master_publish(reads[i].slave_addr, reads[i].command, reads[i].reg_addr, reads[i].data,
+                                  reads[i].reg_count);
+        } else if (err == ESP_OK) {
+            err = reads[i].result;
+        }
+    }
 
     modbus_master_unlock();
+    modbus_master_stage_done(&stage);
+    for (uint8_t i = 0; i < count; i++) {
+        if (reads[i].result == ESP_OK && modbus_master_ctx.callback) {
+            modbus_master_ctx.callback(reads[i].slave_addr, reads[i].command, reads[i].reg_addr, reads[i].data,
+                                       reads[i].reg_count);
+        }
+    }
     return err;
 }
 
+uint8_t
+modbus_master_pipeline_depth(void) {
+    if (!modbus_master_is_tcp()) {
+        return 1;
+    }
+    uint8_t depth = modbus_master_tcp_inflight();
+    return depth ? depth : 1;
+}
+
 esp_err_t
 modbus_master_read_coils(uint8_t slave_addr, uint16_t coil_addr, uint16_t coil_count, uint8_t* data) {
     if (!modbus_master_ctx.initialized || !data) {
@@ -283,7 +1983,7 @@ modbus_master_read_coils(uint8_t slave_addr, uint16_t coil_addr, uint16_t coil_c
         .reg_size = coil_count
     };
 
-    err = mbc_master_send_request(modbus_master_ctx.master_handle, &request, data);
+    err = modbus_master_send(&request, data);
 
     modbus_master_unlock();
     return err;
@@ -309,12 +2009,533 @@ modbus_master_write_single_coil(uint8_t slave_addr, uint16_t coil_addr, bool val
         .reg_size = 1
     };
 
-    err = mbc_master_send_request(modbus_master_ctx.master_handle, &request, &coil_value);
+    err = modbus_master_send(&request, &coil_value);
+
+    modbus_master_unlock();
+    return err;
+}
+
+static esp_err_t
+modbus_master_execute(modbus_master_request_t* req) {
+    uint16_t* payload = req->data ? req->data : req->values;
+
+    switch (req->command) {
+        case 0x01: return modbus_master_read_coils(req->slave_addr, req->reg_addr, req->reg_count, (uint8_t*)payload);
+        case 0x03:
+            return modbus_master_read_holding_registers(req->slave_addr, req->reg_addr, req->reg_count, payload);
+        case 0x04:
+            return modbus_master_read_input_registers(req->slave_addr, req->reg_addr, req->reg_count, payload);
+        case 0x05: return modbus_master_write_single_coil(req->slave_addr, req->reg_addr, payload[0] != 0);
+        case 0x06: return modbus_master_write_single_register(req->slave_addr, req->reg_addr, payload[0]);
+        case 0x10:
+            return modbus_master_write_multiple_registers(req->slave_addr, req->reg_addr, req->reg_count, payload);
+        default: return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+static bool
+modbus_master_next_request(modbus_master_request_t* req) {
+    // Luôn ưu tiên lane safety, rồi command, cuối cùng poll
+    for (int lane = 0; lane < MODBUS_MASTER_LANE_MAX; lane++) {
+        if (xQueueReceive(modbus_master_ctx.lanes[lane], req, 0) == pdTRUE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Ghi riêng một vùng gom đã lấy ra (không có lần đọc đi kèm) rồi báo kết quả
+static void
+modbus_master_stage_flush(modbus_master_stage_t* stage) {
+    if (modbus_master_lock() == ESP_OK) {
+        modbus_master_stage_send(stage, 0, 0, NULL);
+        modbus_master_unlock();
+    } else {
+        for (int k = 0; k < MODBUS_MASTER_STAGE_REGS; k++) {
+            stage->results[k] = ESP_ERR_TIMEOUT;
+        }
+    }
+    modbus_master_stage_done(stage);
+}
+
+static void
+modbus_master_worker_task(void* arg) {
+    modbus_master_request_t req;
+    modbus_master_stage_t stage;
+
+    while (!modbus_master_ctx.worker_stop) {
+        if (modbus_master_ctx.baud_fallback) {
+            modbus_master_baud_fallback();
+        }
+        if (!modbus_master_next_request(&req)) {
+            // Vùng gom hết hạn mà không có lần đọc nào đi kèm: ghi riêng
+            if (modbus_master_stage_take(0, 0, 0, &stage)) {
+                modbus_master_stage_flush(&stage);
+                continue;
+            }
+            ulTaskNotifyTake(pdTRUE, modbus_master_stage_wait_ticks());
+            continue;
+        }
+
+        // Lệnh ghi xếp hàng đè lên thanh ghi đang gom phải đi sau giá trị gom trên dây, không thì giá trị cũ
+        // ghi đè lên giá trị mới. Chỉ xả vùng chứa đúng các thanh ghi đó; lane SAFETY (E-stop, không bao giờ
+        // được gom) không chờ gì cả
+        bool write = req.command == 0x06 || req.command == 0x10;
+        if (write && req.lane != MODBUS_MASTER_LANE_SAFETY
+            && modbus_master_stage_take(req.slave_addr, req.reg_addr, req.reg_count, &stage)) {
+            modbus_master_stage_flush(&stage);
+        }
+
+        esp_err_t err = modbus_master_execute(&req);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Request #%lu (lane %d, FC 0x%02X @%u) failed: %s", req.id, req.lane, req.command,
+                     req.reg_addr, esp_err_to_name(err));
+        }
+
+        if (req.callback) {
+            req.callback(&req, err, req.arg);
+        }
+        if (req.notify_task) {
+            xTaskNotifyGive(req.notify_task);
+        }
+    }
+
+    xSemaphoreGive(modbus_master_ctx.worker_exit);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t
+modbus_master_worker_start(void) {
+    for (int lane = 0; lane < MODBUS_MASTER_LANE_MAX; lane++) {
+        modbus_master_ctx.lanes[lane] = xQueueCreate(lane_depth[lane], sizeof(modbus_master_request_t));
+        if (!modbus_master_ctx.lanes[lane]) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    modbus_master_ctx.worker_exit = xSemaphoreCreateBinary();
+    if (!modbus_master_ctx.worker_exit) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    modbus_master_ctx.worker_stop = false;
+    if (xTaskCreate(modbus_master_worker_task, "mb_worker", MODBUS_MASTER_WORKER_STACK_SIZE, NULL,
+                    MODBUS_MASTER_WORKER_PRIORITY, &modbus_master_ctx.worker) != pdPASS) {
+        modbus_master_ctx.worker = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void
+modbus_master_worker_stop(void) {
+    if (modbus_master_ctx.worker) {
+        modbus_master_ctx.worker_stop = true;
+        xTaskNotifyGive(modbus_master_ctx.worker);
+        // Worker thoát sau request đang chạy (bị chặn bởi response timeout); chưa thoát thì chưa được xoá
+        // worker_exit và lane mà nó đang dùng
+        xSemaphoreTake(modbus_master_ctx.worker_exit, portMAX_DELAY);
+        modbus_master_ctx.worker = NULL;
+    }
+
+    if (modbus_master_ctx.worker_exit) {
+        vSemaphoreDelete(modbus_master_ctx.worker_exit);
+        modbus_master_ctx.worker_exit = NULL;
+    }
+
+    for (int lane = 0; lane < MODBUS_MASTER_LANE_MAX; lane++) {
+        if (modbus_master_ctx.lanes[lane]) {
+            vQueueDelete(modbus_master_ctx.lanes[lane]);
+            modbus_master_ctx.lanes[lane] = NULL;
+        }
+    }
+}
+
+esp_err_t
+modbus_master_submit(const modbus_master_request_t* req, uint32_t* id) {
+    if (!req || req->lane >= MODBUS_MASTER_LANE_MAX || req->reg_count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!modbus_master_ctx.initialized || !modbus_master_ctx.worker) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    modbus_master_request_t item = *req;
+    bool is_write = (req->command == 0x05 || req->command == 0x06 || req->command == 0x10);
+
+    // Copy payload ghi nhỏ để caller không phải giữ buffer
+    if (is_write && req->data && req->reg_count <= MODBUS_MASTER_REQ_INLINE_REGS) {
+        memcpy(item.values, req->data, req->reg_count * sizeof(uint16_t));
+        item.data = NULL;
+    } else if (!is_write && !req->data) {
+        return ESP_ERR_INVALID_ARG;
+    } else if (is_write && !req->data && req->reg_count > MODBUS_MASTER_REQ_INLINE_REGS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    portENTER_CRITICAL(&modbus_master_ctx.id_lock);
+    item.id = ++modbus_master_ctx.next_id;
+    portEXIT_CRITICAL(&modbus_master_ctx.id_lock);
+
+    if (xQueueSend(modbus_master_ctx.lanes[item.lane], &item, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Lane %d full, request dropped", item.lane);
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(modbus_master_ctx.worker);
+
+    if (id) {
+        *id = item.id;
+    }
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_write_register_async(modbus_master_lane_t lane, uint8_t slave_addr, uint16_t reg_addr, uint16_t value,
+                                   modbus_master_done_cb_t callback, void* arg, uint32_t* id) {
+    modbus_master_request_t req = {
+        .lane = lane,
+        .slave_addr = slave_addr,
+        .command = 0x06,
+        .reg_addr = reg_addr,
+        .reg_count = 1,
+        .values = {value},
+        .callback = callback,
+        .arg = arg,
+    };
+    return modbus_master_submit(&req, id);
+}
+
+esp_err_t
+modbus_master_stage_register(uint8_t slave_addr, uint16_t reg_addr, uint16_t value, modbus_master_done_cb_t callback,
+                             void* arg, uint32_t* seq) {
+    if (!modbus_master_ctx.initialized || !modbus_master_ctx.worker) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    bool dropped = false;
+    modbus_master_stage_t* st = NULL;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&modbus_master_ctx.stage_lock);
+    uint32_t cmd_seq = ++modbus_master_ctx.command_seq;
+    modbus_master_shadow_t* sh = modbus_master_shadow_get(slave_addr, reg_addr, true);
+
+    for (int i = 0; i < MODBUS_MASTER_STAGE_SLOTS; i++) {
+        modbus_master_stage_t* slot = &modbus_master_ctx.stages[i];
+        if (slot->dirty && slot->slave_addr == slave_addr) {
+            st = slot;
+            break;
+        }
+        if (!slot->dirty && !st) {
+            st = slot;
+        }
+    }
+
+    // Slave đã có đúng giá trị này: bỏ lệnh, kể cả giá trị cũ hơn còn chờ ghi của cùng người gọi. Chỉ tin
+    // bản sao khi vừa ghi mà chưa đọc lại, hoặc đọc lại chưa quá một chu kỳ poll: trạm có thể tự đổi thanh ghi
+    uint32_t pending_k = st && st->dirty && reg_addr >= st->base ? (uint32_t)reg_addr - st->base : UINT32_MAX;
+    bool pending = pending_k < MODBUS_MASTER_STAGE_REGS && (st->dirty & (1U << pending_k));
+    bool fresh = sh && (!sh->readback || now - sh->updated_us < (int64_t)MODBUS_MASTER_SHADOW_FRESH_MS * 1000);
+    if (sh && sh->known && fresh && sh->value == value
+        && (!pending || (st->callbacks[pending_k] == callback && st->args[pending_k] == arg))) {
+        if (pending) {
+            st->dirty &= ~(1U << pending_k);
+        }
+        sh->seq_staged = cmd_seq;
+        sh->seq_acked = cmd_seq;
+        sh->seq_confirmed = cmd_seq;
+        sh->written = value;
+        dropped = true;
+        st = NULL;
+        err = ESP_OK;
+    }
+
+    if (st && !st->dirty) {
+        // Vùng mới: cửa sổ gom tính từ lệnh đầu tiên
+        st->slave_addr = slave_addr;
+        st->base = reg_addr;
+        st->deadline_us = esp_timer_get_time() + (int64_t)MODBUS_MASTER_STAGE_WINDOW_MS * 1000;
+    }
+    if (st && reg_addr < st->base) {
+        // Dời gốc xuống nếu cả vùng vẫn nằm trong MODBUS_MASTER_STAGE_REGS thanh ghi
+        uint16_t shift = st->base - reg_addr;
+        if (shift < MODBUS_MASTER_STAGE_REGS && (st->dirty >> (MODBUS_MASTER_STAGE_REGS - shift)) == 0) {
+            uint16_t keep = MODBUS_MASTER_STAGE_REGS - shift;
+            memmove(&st->values[shift], st->values, keep * sizeof(st->values[0]));
+            memmove(&st->callbacks[shift], st->callbacks, keep * sizeof(st->callbacks[0]));
+            memmove(&st->args[shift], st->args, keep * sizeof(st->args[0]));
+            memmove(&st->seqs[shift], st->seqs, keep * sizeof(st->seqs[0]));
+            st->dirty <<= shift;
+            st->base = reg_addr;
+        }
+    }
+    if (st) {
+        uint32_t k = (uint32_t)reg_addr - st->base;
+        if (reg_addr < st->base || k >= MODBUS_MASTER_STAGE_REGS) {
+            err = ESP_ERR_INVALID_STATE; // Ngoài cửa sổ của vùng đang gom
+        } else if ((st->dirty & (1U << k)) && (st->callbacks[k] != callback || st->args[k] != arg)) {
+            err = ESP_ERR_INVALID_STATE; // Lệnh của người khác trên cùng thanh ghi chưa ghi
+        } else {
+            // Giá trị mới thay giá trị cũ chưa gửi
+            st->values[k] = value;
+            st->callbacks[k] = callback;
+            st->args[k] = arg;
+            st->seqs[k] = cmd_seq;
+            st->dirty |= 1U << k;
+            if (sh) {
+                sh->seq_staged = cmd_seq;
+            }
+            err = ESP_OK;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stage_lock);
+
+    if (seq) {
+        *seq = err == ESP_OK ? cmd_seq : 0;
+    }
+    if (dropped) {
+        ESP_LOGD(TAG, "Write reg %u = %u dropped, slave already has it", reg_addr, value);
+        if (callback) {
+            modbus_master_request_t req = {
+                .id = cmd_seq,
+                .lane = MODBUS_MASTER_LANE_COMMAND,
+                .slave_addr = slave_addr,
+                .command = 0x06,
+                .reg_addr = reg_addr,
+                .reg_count = 1,
+                .values = {value},
+                .callback = callback,
+                .arg = arg,
+            };
+            callback(&req, ESP_OK, arg);
+        }
+    } else if (err == ESP_OK) {
+        xTaskNotifyGive(modbus_master_ctx.worker); // Worker tính lại hạn chót
+    }
+    return err;
+}
+
+esp_err_t
+modbus_master_get_command_state(uint8_t slave_addr, uint16_t reg_addr, modbus_master_command_state_t* state) {
+    if (!state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&modbus_master_ctx.stage_lock);
+    modbus_master_shadow_t* sh = modbus_master_shadow_get(slave_addr, reg_addr, false);
+    if (sh) {
+        state->value = sh->value;
+        state->known = sh->known;
+        state->seq_staged = sh->seq_staged;
+        state->seq_acked = sh->seq_acked;
+        state->seq_confirmed = sh->seq_confirmed;
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stage_lock);
+    return sh ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t
+modbus_master_get_timing(modbus_master_timing_t* timing) {
+    if (!timing) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!modbus_master_ctx.initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timing->char_us = modbus_master_ctx.char_us;
+    timing->t35_us = modbus_master_ctx.t35_us;
+    timing->turnaround_us = modbus_master_ctx.turnaround_us;
+    timing->turnaround_max_us = modbus_master_ctx.turnaround_max_us;
+    timing->last_txn_us = modbus_master_ctx.last_txn_us;
+    timing->duty_cycle = modbus_master_ctx.duty_cycle;
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    timing->busy_us = modbus_master_ctx.busy_us;
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_baud_negotiate(const modbus_master_baud_config_t* config) {
+    if (!config || !config->rates || config->num_rates == 0 || config->num_rates > MODBUS_MASTER_BAUD_MAX_RATES
+        || config->slave_addr == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (modbus_master_is_tcp()) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (modbus_master_lock() != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    modbus_master_ctx.baud = *config;
+    modbus_master_ctx.baud.rates = modbus_master_ctx.baud_rates;
+    if (modbus_master_ctx.baud.burst == 0) {
+        modbus_master_ctx.baud.burst = MODBUS_MASTER_BAUD_BURST;
+    }
+    if (modbus_master_ctx.baud.max_error_permille == 0) {
+        modbus_master_ctx.baud.max_error_permille = MODBUS_MASTER_BAUD_ERRORS;
+    }
+
+    // Sắp xếp giảm dần: index lớn hơn = chậm hơn
+    uint8_t n = config->num_rates;
+    memcpy(modbus_master_ctx.baud_rates, config->rates, n * sizeof(uint32_t));
+    for (uint8_t i = 1; i < n; i++) {
+        uint32_t v = modbus_master_ctx.baud_rates[i];
+        uint8_t j = i;
+        while (j > 0 && modbus_master_ctx.baud_rates[j - 1] < v) {
+            modbus_master_ctx.baud_rates[j] = modbus_master_ctx.baud_rates[j - 1];
+            j--;
+        }
+        modbus_master_ctx.baud_rates[j] = v;
+    }
+
+    uint32_t configured = modbus_master_ctx.config.baudrate;
+    uint32_t stored = modbus_master_baud_load();
+    bool found = false;
+
+    // Tốc độ đã lưu đi trước để boot nhanh
+    for (uint8_t i = 0; i < n && stored && !config->rescan; i++) {
+        if (modbus_master_ctx.baud_rates[i] == stored && modbus_master_baud_qualify(stored)) {
+            modbus_master_ctx.baud_index = i;
+            found = true;
+        }
+    }
+    if (!found) {
+        found = modbus_master_baud_select(0);
+    }
+
+    if (found) {
+        if (modbus_master_ctx.config.baudrate != stored) {
+            modbus_master_baud_store(modbus_master_ctx.config.baudrate);
+        }
+        modbus_master_ctx.baud_active = true;
+        modbus_master_ctx.baud_fallback = false;
+        modbus_master_ctx.baud_window_txns = 0;
+        modbus_master_ctx.baud_window_errors = 0;
+        ESP_LOGI(TAG, "Baud negotiated: %lu", modbus_master_ctx.config.baudrate);
+    } else {
+        modbus_master_baud_apply(configured);
+        ESP_LOGW(TAG, "No baudrate qualified, staying at %lu", configured);
+    }
+
+    modbus_master_unlock();
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+uint32_t
+modbus_master_get_baudrate(void) {
+    if (!modbus_master_ctx.initialized || modbus_master_is_tcp()) {
+        return 0;
+    }
+    return modbus_master_ctx.config.baudrate;
+}
+
+esp_err_t
+modbus_master_set_duty_cycle(uint8_t percent) {
+    if (percent > 100) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    modbus_master_ctx.duty_cycle = percent;
+    return ESP_OK;
+}
+
+void
+modbus_master_register_link_callback(modbus_master_link_callback_t callback) {
+    modbus_master_ctx.link_callback = callback;
+}
+
+esp_err_t
+modbus_master_set_probe_register(uint8_t slave_addr, uint16_t reg_addr) {
+    if (modbus_master_lock() != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    modbus_master_link_t* link = modbus_master_link_get(slave_addr);
+    if (link) {
+        link->probe_reg = reg_addr;
+    }
 
     modbus_master_unlock();
+    return link ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+modbus_master_link_state_t
+modbus_master_get_link_state(uint8_t slave_addr) {
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        const modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        if (link->used && link->addr == slave_addr) {
+            return link->state;
+        }
+    }
+    return MODBUS_MASTER_LINK_UNKNOWN;
+}
+
+esp_err_t
+modbus_master_get_link_info(uint8_t slave_addr, modbus_master_link_info_t* info) {
+    if (!info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        const modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        if (link->used && link->addr == slave_addr) {
+            info->state = link->state;
+            info->timeout_ms = link->timeout_ms;
+            info->rtt_p99_us = link->rtt_p99_us;
+            info->late = link->late;
+            info->probes = link->probes;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t
+modbus_master_get_stats(uint8_t slave_addr, modbus_master_slave_stats_t* stats) {
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Chỉ lấy spinlock: gọi được từ task esp_timer mà không phải chờ bus
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        const modbus_master_link_t* link = &modbus_master_ctx.links[i];
+        if (link->used && link->addr == slave_addr) {
+            stats->slave_addr = slave_addr;
+            stats->since_ms = (uint32_t)((now - modbus_master_ctx.stats_since_us) / 1000);
+            memcpy(stats->fc, link->stats, sizeof(stats->fc));
+            err = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
     return err;
 }
 
+void
+modbus_master_reset_stats(void) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    for (int i = 0; i < MODBUS_MASTER_MAX_SLAVES; i++) {
+        memset(modbus_master_ctx.links[i].stats, 0, sizeof(modbus_master_ctx.links[i].stats));
+    }
+    memset(&modbus_master_ctx.recovery, 0, sizeof(modbus_master_ctx.recovery));
+    modbus_master_ctx.stats_since_us = now;
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+}
+
+uint32_t
+modbus_master_latency_bucket_us(uint8_t bucket) {
+    if (bucket >= MODBUS_MASTER_LATENCY_BUCKETS - 1) {
+        return UINT32_MAX;
+    }
+    return latency_bucket_us[bucket];
+}
+
 bool
 modbus_master_is_running(void) {
     return modbus_master_ctx.running;
@@ -331,17 +2552,28 @@ modbus_master_reset(void) {
         return err;
     }
 
-    // Stop và restart stack
-    mbc_master_stop(modbus_master_ctx.master_handle);
-    vTaskDelay(pdMS_TO_TICKS(100));
-    
-    err = mbc_master_start(modbus_master_ctx.master_handle);
-    
+    err = modbus_master_rebuild();
+    if (err == ESP_OK) {
+        modbus_master_recovery_count(&modbus_master_ctx.recovery.rebuild_ok);
+    }
+
     modbus_master_unlock();
-    
+
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Modbus stack reset successfully");
     }
-    
+
     return err;
 }
+
+esp_err_t
+modbus_master_get_recovery_stats(modbus_master_recovery_stats_t* stats) {
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&modbus_master_ctx.stats_lock);
+    *stats = modbus_master_ctx.recovery;
+    portEXIT_CRITICAL(&modbus_master_ctx.stats_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,222 @@
+#include "modbus_master_plan.h"
+#include <string.h>
+#include "esp_log.h"
+#include "modbus_master_manager.h"
+
+static const char* TAG = "MODBUS_PLAN";
+
+// RTU framing overhead of one read transaction, in characters
+#define PLAN_RTU_REQUEST_CHARS  8 // addr + fc + start(2) + count(2) + crc(2)
+#define PLAN_RTU_RESPONSE_CHARS 5 // addr + fc + byte count + crc(2)
+#define PLAN_RTU_SILENCE_CHARS  7 // t3.5 before request and before response
+#define PLAN_RTU_BITS_PER_CHAR  11
+
+// Bộ đệm cho các transaction gửi pipeline (chỉ task poll dùng)
+static uint16_t plan_scratch[MODBUS_MASTER_BATCH_MAX][MODBUS_MASTER_MAX_READ_REGS];
+
+uint16_t
+modbus_master_plan_gap_for_baud(uint32_t baudrate, uint32_t turnaround_us) {
+    if (baudrate == 0) {
+        return 0;
+    }
+
+    uint32_t char_us = (PLAN_RTU_BITS_PER_CHAR * 1000000UL + baudrate - 1) / baudrate;
+    uint32_t chars = PLAN_RTU_REQUEST_CHARS + PLAN_RTU_RESPONSE_CHARS + PLAN_RTU_SILENCE_CHARS
+                     + turnaround_us / char_us;
+
+    uint32_t gap = chars / 2;
+    return gap > MODBUS_MASTER_MAX_READ_REGS ? MODBUS_MASTER_MAX_READ_REGS : (uint16_t)gap;
+}
+
+esp_err_t
+modbus_master_plan_build(modbus_master_plan_t* plan, uint8_t slave_addr, uint8_t reg_type,
+                         const modbus_master_block_t* blocks, uint8_t num_blocks, uint16_t max_gap) {
+    if (!plan || !blocks || num_blocks == 0 || num_blocks > MODBUS_MASTER_PLAN_MAX_BLOCKS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(plan, 0, sizeof(*plan));
+    plan->slave_addr = slave_addr;
+    plan->reg_type = reg_type;
+    plan->blocks = blocks;
+    plan->num_blocks = num_blocks;
+
+    // Sắp xếp block theo địa chỉ (insertion sort, số block nhỏ)
+    for (uint8_t i = 0; i < num_blocks; i++) {
+        if (blocks[i].reg_count == 0 || blocks[i].reg_count > MODBUS_MASTER_MAX_READ_REGS || !blocks[i].data) {
+            ESP_LOGE(TAG, "Invalid block %u (addr=%u count=%u)", i, blocks[i].reg_addr, blocks[i].reg_count);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint8_t j = i;
+        while (j > 0 && blocks[plan->order[j - 1]].reg_addr > blocks[i].reg_addr) {
+            plan->order[j] = plan->order[j - 1];
+            j--;
+        }
+        plan->order[j] = i;
+    }
+
+    // Gộp các block liền kề khi khoảng trống đủ nhỏ
+    modbus_master_txn_t* txn = NULL;
+    uint32_t txn_end = 0; // exclusive
+
+    for (uint8_t k = 0; k < num_blocks; k++) {
+        const modbus_master_block_t* blk = &blocks[plan->order[k]];
+        uint32_t blk_end = (uint32_t)blk->reg_addr + blk->reg_count;
+
+        if (txn) {
+            uint32_t new_end = blk_end > txn_end ? blk_end : txn_end;
+            bool fits = (new_end - txn->reg_addr) <= MODBUS_MASTER_MAX_READ_REGS;
+            bool close = blk->reg_addr <= txn_end || (blk->reg_addr - txn_end) <= max_gap;
+
+            if (fits && close) {
+                txn_end = new_end;
+                txn->reg_count = (uint16_t)(txn_end - txn->reg_addr);
+                txn->num_blocks++;
+                continue;
+            }
+        }
+
+        txn = &plan->txns[plan->num_txns++];
+        txn->reg_addr = blk->reg_addr;
+        txn->reg_count = blk->reg_count;
+        txn->first_order = k;
+        txn->num_blocks = 1;
+        txn_end = blk_end;
+    }
+
+    ESP_LOGD(TAG, "Slave %u: %u blocks -> %u transactions (max_gap=%u)", slave_addr, num_blocks, plan->num_txns,
+             max_gap);
+    return ESP_OK;
+}
+
+static esp_err_t
+modbus_master_plan_read(const modbus_master_plan_t* plan, uint16_t reg_addr, uint16_t reg_count, uint16_t* data) {
+    if (plan->reg_type == 0x04) {
+        return modbus_master_read_input_registers(plan->slave_addr, reg_addr, reg_count, data);
+    }
+    return modbus_master_read_holding_registers(plan->slave_addr, reg_addr, reg_count, data);
+}
+
+uint8_t
+modbus_master_block_update(const modbus_master_block_t* blk, const uint16_t* src) {
+    uint8_t chunk_mask = 0;
+
+    // So sánh theo từng chunk cỡ cache line, chỉ chép chunk khác
+    for (uint16_t offset = 0, chunk = 0; offset < blk->reg_count; offset += MODBUS_MASTER_CHUNK_REGS, chunk++) {
+        uint16_t count = blk->reg_count - offset;
+        if (count > MODBUS_MASTER_CHUNK_REGS) {
+            count = MODBUS_MASTER_CHUNK_REGS;
+        }
+        if (memcmp(&blk->data[offset], &src[offset], count * sizeof(uint16_t)) != 0) {
+            memcpy(&blk->data[offset], &src[offset], count * sizeof(uint16_t));
+            chunk_mask |= 1U << chunk;
+        }
+    }
+    return chunk_mask;
+}
+
+// Phân phối một transaction vào các block, trả về mask block đã đọc và đã đổi
+static void
+modbus_master_plan_scatter(const modbus_master_plan_t* plan, const modbus_master_txn_t* txn, const uint16_t* src,
+                           uint32_t* ok_mask, uint32_t* changed_mask) {
+    for (uint8_t k = 0; k < txn->num_blocks; k++) {
+        uint8_t idx = plan->order[txn->first_order + k];
+        const modbus_master_block_t* blk = &plan->blocks[idx];
+        *ok_mask |= 1UL << idx;
+        if (modbus_master_block_update(blk, &src[blk->reg_addr - txn->reg_addr])) {
+            *changed_mask |= 1UL << idx;
+        }
+    }
+}
+
+esp_err_t
+modbus_master_plan_execute_txn(const modbus_master_plan_t* plan, uint8_t txn_index, uint32_t* ok_mask,
+                               uint32_t* changed_mask) {
+    return modbus_master_plan_execute_txns(plan, &txn_index, 1, ok_mask, changed_mask);
+}
+
+esp_err_t
+modbus_master_plan_execute_txns(const modbus_master_plan_t* plan, const uint8_t* txn_index, uint8_t count,
+                                uint32_t* ok_mask, uint32_t* changed_mask) {
+    if (ok_mask) {
+        *ok_mask = 0;
+    }
+    if (changed_mask) {
+        *changed_mask = 0;
+    }
+    if (!plan || !txn_index || count == 0 || count > MODBUS_MASTER_BATCH_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Luôn đọc vào scratch: buffer đích giữ ảnh lần đọc trước để so sánh
+    modbus_master_read_t reads[MODBUS_MASTER_BATCH_MAX];
+    for (uint8_t i = 0; i < count; i++) {
+        if (txn_index[i] >= plan->num_txns) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        const modbus_master_txn_t* txn = &plan->txns[txn_index[i]];
+        reads[i] = (modbus_master_read_t){
+            .slave_addr = plan->slave_addr,
+            .command = plan->reg_type == 0x04 ? 0x04 : 0x03,
+            .reg_addr = txn->reg_addr,
+            .reg_count = txn->reg_count,
+            .data = plan_scratch[i],
+            .result = ESP_OK
+        };
+    }
+
+    esp_err_t err;
+    if (count == 1) {
+        err = modbus_master_plan_read(plan, reads[0].reg_addr, reads[0].reg_count, plan_scratch[0]);
+        reads[0].result = err;
+    } else {
+        err = modbus_master_read_multiple(reads, count);
+    }
+
+    uint32_t ok = 0;
+    uint32_t changed = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (reads[i].result == ESP_OK) {
+            modbus_master_plan_scatter(plan, &plan->txns[txn_index[i]], plan_scratch[i], &ok, &changed);
+        }
+    }
+
+    if (ok_mask) {
+        *ok_mask = ok;
+    }
+    if (changed_mask) {
+        *changed_mask = changed;
+    }
+    return err;
+}
+
+esp_err_t
+modbus_master_plan_execute(const modbus_master_plan_t* plan, uint32_t* ok_mask, uint32_t* changed_mask) {
+    if (!plan) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = ESP_OK;
+    uint32_t ok = 0;
+    uint32_t changed = 0;
+
+    for (uint8_t i = 0; i < plan->num_txns; i++) {
+        uint32_t txn_ok = 0;
+        uint32_t txn_changed = 0;
+        esp_err_t err = modbus_master_plan_execute_txn(plan, i, &txn_ok, &txn_changed);
+        if (err != ESP_OK) {
+            result = err;
+        }
+        ok |= txn_ok;
+        changed |= txn_changed;
+    }
+
+    if (ok_mask) {
+        *ok_mask = ok;
+    }
+    if (changed_mask) {
+        *changed_mask = changed;
+    }
+    return result;
+}
@@ -0,0 +1,554 @@
+#include "modbus_master_rtu.h"
+#include <string.h>
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+static const char* TAG = "MODBUS_RTU";
+
+#define RTU_RX_BUF_SIZE    512 // Driver RX ring, larger than the hardware FIFO
+#define RTU_EVENT_QUEUE    16
+#define RTU_EXCEPTION_LEN  5   // addr + fc | 0x80 + code + crc(2)
+
+// CRC-16/MODBUS (đa thức 0xA001 đảo bit), tra bảng mỗi byte thay vì 8 vòng dịch bit
+static const uint16_t rtu_crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+static struct {
+    int port;
+    QueueHandle_t events;
+    uint32_t timeout_ms;
+    bool open;
+    uint8_t adu[MODBUS_MASTER_RTU_MAX_ADU]; // Frame dựng và nhận tại chỗ
+    uint8_t listen_buf[MODBUS_MASTER_RTU_MAX_ADU]; // Frame của thiết bị khác đang nhận dở
+    size_t listen_len;
+    bool listen_ready;    // listen_buf giữ một frame trọn vẹn nghe được lúc chờ gửi
+    uint32_t t35_us;      // Khoảng im lặng giữa hai frame
+    int64_t last_rx_us;   // Lần cuối có byte trên đường truyền
+} rtu_ctx = {.port = -1};
+
+static inline void
+put_u16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline uint16_t
+get_u16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint16_t
+modbus_master_rtu_crc16(const uint8_t* buf, size_t len) {
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc = (crc >> 8) ^ rtu_crc_table[(crc ^ *buf++) & 0xFF];
+    }
+    return crc;
+}
+
+esp_err_t
+modbus_master_rtu_open(int uart_port, int tx_pin, int rx_pin, int rts_pin, uint32_t baudrate, uint32_t timeout_ms) {
+    if (baudrate == 0 || timeout_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    modbus_master_rtu_close();
+
+    uart_config_t uart_cfg = {
+        .baud_rate = (int)baudrate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    // Không có TX ring: uart_write_bytes ghi thẳng vào FIFO phần cứng
+    esp_err_t err = uart_driver_install(uart_port, RTU_RX_BUF_SIZE, 0, RTU_EVENT_QUEUE, &rtu_ctx.events, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "uart_driver_install failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    rtu_ctx.port = uart_port;
+
+    err = uart_param_config(uart_port, &uart_cfg);
+    if (err == ESP_OK) {
+        err = uart_set_pin(uart_port, tx_pin, rx_pin, rts_pin, UART_PIN_NO_CHANGE);
+    }
+    if (err == ESP_OK) {
+        err = uart_set_mode(uart_port, UART_MODE_RS485_HALF_DUPLEX);
+    }
+    if (err == ESP_OK) {
+        // Ngắt RX timeout báo hết frame khi đường truyền im lặng
+        err = uart_set_rx_timeout(uart_port, MODBUS_MASTER_RTU_RX_TOUT);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "UART%d setup failed: %s", uart_port, esp_err_to_name(err));
+        modbus_master_rtu_close();
+        return err;
+    }
+
+    rtu_ctx.timeout_ms = timeout_ms;
+    // t3.5 = 3.5 ký tự 11 bit, cố định 1750 us khi trên 19200 baud
+    rtu_ctx.t35_us = baudrate > 19200 ? 1750 : (uint32_t)(38500000ULL / baudrate);
+    rtu_ctx.last_rx_us = 0;
+    rtu_ctx.listen_len = 0;
+    rtu_ctx.listen_ready = false;
+    rtu_ctx.open = true;
+    ESP_LOGI(TAG, "UART%d @ %lu baud, RX idle timeout %u chars", uart_port, baudrate, MODBUS_MASTER_RTU_RX_TOUT);
+    return ESP_OK;
+}
+
+void
+modbus_master_rtu_close(void) {
+    if (rtu_ctx.port >= 0) {
+        uart_driver_delete(rtu_ctx.port);
+        rtu_ctx.port = -1;
+    }
+    rtu_ctx.events = NULL;
+    rtu_ctx.open = false;
+}
+
+bool
+modbus_master_rtu_is_open(void) {
+    return rtu_ctx.open;
+}
+
+// Gắn CRC vào cuối frame
+static size_t
+modbus_master_rtu_seal(uint8_t* adu, size_t len) {
+    uint16_t crc = modbus_master_rtu_crc16(adu, len);
+    adu[len] = crc & 0xFF;
+    adu[len + 1] = crc >> 8;
+    return len + 2;
+}
+
+size_t
+modbus_master_rtu_encode_request(const modbus_master_rtu_txn_t* txn, uint8_t* adu) {
+    uint8_t* pdu = adu + 1;
+    const uint16_t* regs = (const uint16_t*)txn->data;
+    size_t pdu_len;
+
+    pdu[0] = txn->command;
+    put_u16(&pdu[1], txn->reg_addr);
+
+    switch (txn->command) {
+        case 0x01:
+        case 0x02:
+            if (txn->reg_count == 0 || txn->reg_count > 2000) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            pdu_len = 5;
+            break;
+        case 0x03:
+        case 0x04:
+            if (txn->reg_count == 0 || txn->reg_count > 125) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            pdu_len = 5;
+            break;
+        case 0x05:
+        case 0x06:
+            put_u16(&pdu[3], regs[0]);
+            pdu_len = 5;
+            break;
+        case 0x10:
+            if (txn->reg_count == 0 || txn->reg_count > 123) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            pdu[5] = txn->reg_count * 2;
+            for (uint16_t i = 0; i < txn->reg_count; i++) {
+                put_u16(&pdu[6 + 2 * i], regs[i]);
+            }
+            pdu_len = 6 + 2 * txn->reg_count;
+            break;
+        case 0x17:
+            if (txn->reg_count == 0 || txn->reg_count > 125 || txn->wr_count == 0 || txn->wr_count > 121
+                || !txn->wr_data) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            put_u16(&pdu[5], txn->wr_addr);
+            put_u16(&pdu[7], txn->wr_count);
+            pdu[9] = txn->wr_count * 2;
+            for (uint16_t i = 0; i < txn->wr_count; i++) {
+                put_u16(&pdu[10 + 2 * i], txn->wr_data[i]);
+            }
+            pdu_len = 10 + 2 * txn->wr_count;
+            break;
+        default:
+            return 0;
+    }
+
+    adu[0] = txn->slave_addr;
+    return modbus_master_rtu_seal(adu, 1 + pdu_len);
+}
+
+size_t
+modbus_master_rtu_encode_response(const modbus_master_rtu_txn_t* txn, uint8_t* adu) {
+    uint8_t* pdu = adu + 1;
+    const uint16_t* regs = (const uint16_t*)txn->data;
+    size_t pdu_len;
+
+    adu[0] = txn->slave_addr;
+    pdu[0] = txn->command;
+
+    switch (txn->command) {
+        case 0x01:
+        case 0x02:
+            if (txn->reg_count == 0 || txn->reg_count > 2000) {
+                return 0;
+            }
+            pdu[1] = (txn->reg_count + 7) / 8;
+            memcpy(&pdu[2], txn->data, pdu[1]);
+            pdu_len = 2 + pdu[1];
+            break;
+        case 0x03:
+        case 0x04:
+        case 0x17:
+            if (txn->reg_count == 0 || txn->reg_count > 125) {
+                return 0;
+            }
+            pdu[1] = txn->reg_count * 2;
+            for (uint16_t i = 0; i < txn->reg_count; i++) {
+                put_u16(&pdu[2 + 2 * i], regs[i]);
+            }
+            pdu_len = 2 + pdu[1];
+            break;
+        case 0x05:
+        case 0x06:
+            put_u16(&pdu[1], txn->reg_addr);
+            put_u16(&pdu[3], regs[0]);
+            pdu_len = 5;
+            break;
+        case 0x10:
+            put_u16(&pdu[1], txn->reg_addr);
+            put_u16(&pdu[3], txn->reg_count);
+            pdu_len = 5;
+            break;
+        default:
+            return 0;
+    }
+    return modbus_master_rtu_seal(adu, 1 + pdu_len);
+}
+
+// Độ dài response mong đợi, để kết thúc sớm không cần chờ RX timeout
+static size_t
+modbus_master_rtu_response_len(const modbus_master_rtu_txn_t* txn) {
+    switch (txn->command) {
+        case 0x01:
+        case 0x02:
+            return 5 + (txn->reg_count + 7) / 8;
+        case 0x03:
+        case 0x04:
+        case 0x17:
+            return 5 + 2 * txn->reg_count;
+        default:
+            return 8;
+    }
+}
+
+// Giải mã thẳng vào buffer của caller
+static esp_err_t
+modbus_master_rtu_parse(modbus_master_rtu_txn_t* txn, const uint8_t* adu, size_t len) {
+    // CRC hỏng, exception và frame sai trả về mã khác nhau để thống kê riêng
+    if (len < RTU_EXCEPTION_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (modbus_master_rtu_crc16(adu, len) != 0) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (adu[0] != txn->slave_addr) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint8_t* pdu = adu + 1;
+    len -= 3;
+    if (pdu[0] != txn->command) {
+        return ESP_ERR_INVALID_RESPONSE; // Exception (fc | 0x80)
+    }
+
+    switch (txn->command) {
+        case 0x01:
+        case 0x02: {
+            size_t bytes = (txn->reg_count + 7) / 8;
+            if (pdu[1] != bytes || len < 2 + bytes) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(txn->data, &pdu[2], bytes);
+            break;
+        }
+        case 0x03:
+        case 0x04:
+        case 0x17: {
+            size_t bytes = txn->reg_count * 2;
+            if (pdu[1] != bytes || len < 2 + bytes) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            uint16_t* regs = (uint16_t*)txn->data;
+            for (uint16_t i = 0; i < txn->reg_count; i++) {
+                regs[i] = get_u16(&pdu[2 + 2 * i]);
+            }
+            break;
+        }
+        default:
+            // Write: slave trả lại địa chỉ
+            if (len < 5 || get_u16(&pdu[1]) != txn->reg_addr) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            break;
+    }
+    return ESP_OK;
+}
+
+// Chờ event UART tới deadline
+static bool
+modbus_master_rtu_wait_event(uart_event_t* event, int64_t deadline_us) {
+    int64_t wait_us = deadline_us - esp_timer_get_time();
+    if (wait_us <= 0) {
+        return false;
+    }
+
+    uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+    return xQueueReceive(rtu_ctx.events, event, (TickType_t)((wait_us + tick_us - 1) / tick_us)) == pdTRUE;
+}
+
+// Nhận response tới khi đủ độ dài mong đợi, gặp exception, hoặc đường truyền im lặng (RX timeout)
+static esp_err_t
+modbus_master_rtu_receive(const modbus_master_rtu_txn_t* txn, size_t* rx_len, int64_t deadline_us) {
+    size_t expected = modbus_master_rtu_response_len(txn);
+    size_t len = 0;
+
+    for (;;) {
+        uart_event_t event;
+        if (!modbus_master_rtu_wait_event(&event, deadline_us)) {
+            return ESP_ERR_TIMEOUT;
+        }
+
+        switch (event.type) {
+            case UART_DATA: {
+                int n = uart_read_bytes(rtu_ctx.port, &rtu_ctx.adu[len], sizeof(rtu_ctx.adu) - len, 0);
+                if (n > 0) {
+                    len += n;
+                    rtu_ctx.last_rx_us = esp_timer_get_time();
+                }
+                bool exception = len >= RTU_EXCEPTION_LEN && (rtu_ctx.adu[1] & 0x80);
+                if (len >= expected || exception || len == sizeof(rtu_ctx.adu)) {
+                    *rx_len = exception ? RTU_EXCEPTION_LEN : expected;
+                    return ESP_OK;
+                }
+                if (event.timeout_flag && len > 0) {
+                    *rx_len = len; // Frame ngắn hơn mong đợi, để parse báo lỗi
+                    return ESP_OK;
+                }
+                break;
+            }
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                uart_flush_input(rtu_ctx.port);
+                xQueueReset(rtu_ctx.events);
+                return ESP_ERR_INVALID_SIZE;
+            default:
+                break; // Lỗi parity/frame: CRC sẽ bắt
+        }
+    }
+}
+
+// Gom một event UART vào listen_buf; true khi đường truyền im lặng sau frame (hết frame)
+static bool
+modbus_master_rtu_listen_event(const uart_event_t* event) {
+    if (event->type == UART_FIFO_OVF || event->type == UART_BUFFER_FULL) {
+        uart_flush_input(rtu_ctx.port);
+        xQueueReset(rtu_ctx.events);
+        rtu_ctx.listen_len = 0;
+        rtu_ctx.listen_ready = false;
+        return false;
+    }
+    if (event->type != UART_DATA) {
+        return false;
+    }
+
+    // Frame mới bắt đầu: frame cũ chưa ai lấy thì bỏ
+    if (rtu_ctx.listen_ready) {
+        rtu_ctx.listen_len = 0;
+        rtu_ctx.listen_ready = false;
+    }
+
+    // Chỉ đọc đúng số byte của event để không lấn sang frame kế tiếp
+    size_t room = sizeof(rtu_ctx.listen_buf) - rtu_ctx.listen_len;
+    int n = uart_read_bytes(rtu_ctx.port, &rtu_ctx.listen_buf[rtu_ctx.listen_len],
+                            event->size < room ? event->size : room, 0);
+    if (n > 0) {
+        rtu_ctx.listen_len += n;
+        rtu_ctx.last_rx_us = esp_timer_get_time();
+    }
+    return event->timeout_flag || rtu_ctx.listen_len == sizeof(rtu_ctx.listen_buf);
+}
+
+// Chờ đường truyền rảnh (không frame nào đang tới và im lặng đủ t3.5) trước khi phát. Frame của thiết bị
+// khác bắt đầu trong lúc chờ thì lùi lại tới hết frame đó, và giữ nó cho modbus_master_rtu_listen()
+static esp_err_t
+modbus_master_rtu_wait_idle(int64_t deadline_us) {
+    for (;;) {
+        size_t pending = 0;
+        uart_get_buffered_data_len(rtu_ctx.port, &pending);
+        bool hearing = pending > 0 || (rtu_ctx.listen_len > 0 && !rtu_ctx.listen_ready);
+        int64_t idle_at = rtu_ctx.last_rx_us + rtu_ctx.t35_us;
+        int64_t now = esp_timer_get_time();
+        if (!hearing && now >= idle_at) {
+            return ESP_OK;
+        }
+        if (now >= deadline_us) {
+            return ESP_ERR_NOT_FINISHED;
+        }
+
+        uart_event_t event;
+        if (!modbus_master_rtu_wait_event(&event, hearing || idle_at > deadline_us ? deadline_us : idle_at)) {
+            continue;
+        }
+        if (modbus_master_rtu_listen_event(&event)) {
+            rtu_ctx.listen_ready = rtu_ctx.listen_len >= 4;
+            if (!rtu_ctx.listen_ready) {
+                rtu_ctx.listen_len = 0; // Nhiễu
+            }
+        }
+    }
+}
+
+esp_err_t
+modbus_master_rtu_transact(modbus_master_rtu_txn_t* txn) {
+    if (!txn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    txn->rtt_us = 0;
+    if (!rtu_ctx.open) {
+        txn->result = ESP_ERR_INVALID_STATE;
+        return txn->result;
+    }
+
+    size_t adu_len = modbus_master_rtu_encode_request(txn, rtu_ctx.adu);
+    if (adu_len == 0) {
+        txn->result = ESP_ERR_NOT_SUPPORTED;
+        return txn->result;
+    }
+
+    // Không phát chồng lên frame đang nghe: chờ đường truyền rảnh, tối đa bằng response timeout
+    uint32_t timeout_ms = txn->timeout_ms ? txn->timeout_ms : rtu_ctx.timeout_ms;
+    esp_err_t err = modbus_master_rtu_wait_idle(esp_timer_get_time() + (int64_t)timeout_ms * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Bus busy, request to slave %u not sent", txn->slave_addr);
+        txn->result = err;
+        return txn->result;
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (uart_write_bytes(rtu_ctx.port, rtu_ctx.adu, adu_len) != (int)adu_len) {
+        txn->result = ESP_FAIL;
+        return txn->result;
+    }
+
+    // Broadcast không có response
+    if (txn->slave_addr == 0) {
+        uart_wait_tx_done(rtu_ctx.port, pdMS_TO_TICKS(timeout_ms));
+        rtu_ctx.last_rx_us = esp_timer_get_time(); // Half duplex: frame của mình cũng chiếm đường truyền
+        txn->rtt_us = (uint32_t)(rtu_ctx.last_rx_us - start);
+        txn->result = ESP_OK;
+        return txn->result;
+    }
+
+    size_t rx_len = 0;
+    err = modbus_master_rtu_receive(txn, &rx_len, start + (int64_t)timeout_ms * 1000);
+    txn->rtt_us = (uint32_t)(esp_timer_get_time() - start);
+    txn->result = err == ESP_OK ? modbus_master_rtu_parse(txn, rtu_ctx.adu, rx_len) : err;
+    return txn->result;
+}
+
+esp_err_t
+modbus_master_rtu_listen(uint8_t* buf, size_t* len, uint32_t timeout_ms) {
+    if (!buf || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!rtu_ctx.open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    uart_event_t event;
+    for (;;) {
+        // Frame nghe được lúc transact chờ đường truyền rảnh đi trước
+        if (!rtu_ctx.listen_ready) {
+            if (!modbus_master_rtu_wait_event(&event, deadline_us)) {
+                break;
+            }
+            if (!modbus_master_rtu_listen_event(&event)) {
+                continue;
+            }
+        }
+
+        // Đường truyền im lặng: hết frame
+        size_t frame_len = rtu_ctx.listen_len;
+        rtu_ctx.listen_len = 0;
+        rtu_ctx.listen_ready = false;
+        if (frame_len < 4) {
+            continue; // Nhiễu
+        }
+        memcpy(buf, rtu_ctx.listen_buf, frame_len);
+        *len = frame_len;
+        return modbus_master_rtu_crc16(buf, frame_len) == 0 ? ESP_OK : ESP_ERR_INVALID_CRC;
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+size_t
+modbus_master_rtu_flush(void) {
+    size_t pending = 0;
+    if (!rtu_ctx.open) {
+        return 0;
+    }
+
+    uart_get_buffered_data_len(rtu_ctx.port, &pending);
+    pending += rtu_ctx.listen_len;
+    uart_flush_input(rtu_ctx.port);
+    xQueueReset(rtu_ctx.events);
+    rtu_ctx.listen_len = 0;
+    rtu_ctx.listen_ready = false;
+    return pending;
+}
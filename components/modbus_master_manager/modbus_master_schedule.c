@@ -0,0 +1,428 @@
+#include "modbus_master_schedule.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "modbus_master_manager.h"
+
+static const char* TAG = "MODBUS_SCHED";
+
+esp_err_t
+modbus_master_schedule_init(modbus_master_schedule_t* sched, uint8_t slave_addr, uint8_t reg_type,
+                            const modbus_master_group_t* groups, uint8_t num_groups, uint16_t max_gap,
+                            modbus_master_schedule_cb_t callback, void* arg) {
+    if (!sched || !groups || num_groups == 0 || num_groups > MODBUS_MASTER_SCHEDULE_MAX_GROUPS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(sched, 0, sizeof(*sched));
+    sched->slave_addr = slave_addr;
+    sched->reg_type = reg_type;
+    sched->max_gap = max_gap;
+    sched->groups = groups;
+    sched->num_groups = num_groups;
+    sched->callback = callback;
+    sched->arg = arg;
+
+    int64_t now = esp_timer_get_time();
+    for (uint8_t i = 0; i < num_groups; i++) {
+        if (groups[i].period_ms == 0) {
+            ESP_LOGE(TAG, "Group %s has no period", groups[i].name ? groups[i].name : "?");
+            return ESP_ERR_INVALID_ARG;
+        }
+        uint32_t deadline_ms = groups[i].deadline_ms ? groups[i].deadline_ms : groups[i].period_ms;
+        sched->period_ms[i] = groups[i].period_ms;
+        sched->release_us[i] = now;
+        sched->deadline_us[i] = now + (int64_t)deadline_ms * 1000;
+    }
+
+    ESP_LOGI(TAG, "Slave %u: %u groups scheduled", slave_addr, num_groups);
+    return ESP_OK;
+}
+
+// Đặt lần release kế tiếp; rephase = tính từ now (dữ liệu vừa nghe được) thay vì từ release trước
+static void
+modbus_master_schedule_release(modbus_master_schedule_t* sched, uint8_t group, int64_t now, bool rephase) {
+    const modbus_master_group_t* grp = &sched->groups[group];
+    int64_t period_us = (int64_t)sched->period_ms[group] * 1000;
+    uint32_t deadline_ms = grp->deadline_ms ? grp->deadline_ms : sched->period_ms[group];
+    int64_t release = rephase ? now + period_us : sched->release_us[group] + period_us;
+
+    // Chu kỳ tuyệt đối: trễ cả chu kỳ thì bỏ các lần đã lỡ, giữ pha, không poll dồn
+    if (release <= now) {
+        int64_t skipped = (now - release) / period_us + 1;
+        sched->stats[group].overruns += (uint32_t)skipped;
+        release += skipped * period_us;
+    }
+
+    sched->release_us[group] = release;
+    sched->deadline_us[group] = release + (int64_t)deadline_ms * 1000;
+}
+
+// Lần poll (thành công hay lỗi) kết thúc sau deadline; gọi trước khi release ghi đè deadline
+static void
+modbus_master_schedule_check_deadline(modbus_master_schedule_t* sched, uint8_t group, int64_t now) {
+    if (now > sched->deadline_us[group]) {
+        sched->stats[group].missed++;
+    }
+}
+
+// Chu kỳ thực tế và jitter của lần làm mới thành công, trung bình trượt 1/8
+static void
+modbus_master_schedule_account(modbus_master_schedule_t* sched, uint8_t group, int64_t now) {
+    modbus_master_group_stats_t* st = &sched->stats[group];
+
+    if (st->last_us) {
+        int64_t period_us = now - st->last_us;
+        int64_t dev = period_us - (int64_t)sched->period_ms[group] * 1000;
+        uint32_t jitter_us = (uint32_t)(dev < 0 ? -dev : dev);
+
+        if (st->period_us == 0) {
+            st->period_us = (uint32_t)period_us;
+            st->jitter_us = jitter_us;
+        } else {
+            st->period_us = (uint32_t)((int64_t)st->period_us + (period_us - (int64_t)st->period_us) / 8);
+            st->jitter_us = (uint32_t)((int64_t)st->jitter_us + ((int64_t)jitter_us - (int64_t)st->jitter_us) / 8);
+        }
+        if (jitter_us > st->jitter_max_us) {
+            st->jitter_max_us = jitter_us;
+        }
+    }
+    st->last_us = now;
+    st->polls++;
+}
+
+esp_err_t
+modbus_master_schedule_run_once(modbus_master_schedule_t* sched, uint32_t* wait_ms) {
+    if (!sched || !sched->groups) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t now = esp_timer_get_time();
+    int64_t next_release = INT64_MAX;
+    uint8_t num_due = 0;
+
+    // Gom các group đến hạn
+    for (uint8_t i = 0; i < sched->num_groups; i++) {
+        if (sched->release_us[i] > now) {
+            if (sched->release_us[i] < next_release) {
+                next_release = sched->release_us[i];
+            }
+            continue;
+        }
+
+        sched->due_blocks[num_due] = sched->groups[i].block;
+        sched->due_group[num_due] = i;
+        num_due++;
+    }
+
+    if (num_due == 0) {
+        if (wait_ms) {
+            *wait_ms = (uint32_t)((next_release - now + 999) / 1000);
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (wait_ms) {
+        *wait_ms = 0;
+    }
+
+    esp_err_t err = modbus_master_plan_build(&sched->plan, sched->slave_addr, sched->reg_type, sched->due_blocks,
+                                             num_due, sched->max_gap);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Deadline sớm nhất của từng transaction
+    int64_t txn_deadline[MODBUS_MASTER_PLAN_MAX_BLOCKS];
+    for (uint8_t t = 0; t < sched->plan.num_txns; t++) {
+        const modbus_master_txn_t* txn = &sched->plan.txns[t];
+        txn_deadline[t] = INT64_MAX;
+        for (uint8_t k = 0; k < txn->num_blocks; k++) {
+            uint8_t group = sched->due_group[sched->plan.order[txn->first_order + k]];
+            if (sched->deadline_us[group] < txn_deadline[t]) {
+                txn_deadline[t] = sched->deadline_us[group];
+            }
+        }
+    }
+
+    // Transaction chứa group EDF đi trước; trên TCP lấy thêm theo deadline cho đầy pipeline
+    uint8_t depth = modbus_master_pipeline_depth();
+    if (depth > MODBUS_MASTER_BATCH_MAX) {
+        depth = MODBUS_MASTER_BATCH_MAX;
+    }
+    uint8_t txn_index[MODBUS_MASTER_BATCH_MAX];
+    uint8_t num_txns = 0;
+    uint64_t picked = 0;
+    while (num_txns < depth && num_txns < sched->plan.num_txns) {
+        int8_t best = -1;
+        for (uint8_t t = 0; t < sched->plan.num_txns; t++) {
+            if (!(picked & (1ULL << t)) && (best < 0 || txn_deadline[t] < txn_deadline[best])) {
+                best = t;
+            }
+        }
+        picked |= 1ULL << best;
+        txn_index[num_txns++] = (uint8_t)best;
+    }
+
+    uint32_t ok_mask = 0;
+    uint32_t changed_mask = 0;
+    err = modbus_master_plan_execute_txns(&sched->plan, txn_index, num_txns, &ok_mask, &changed_mask);
+
+    // Release lại mọi group trong các transaction, kể cả khi lỗi để không dồn bus
+    now = esp_timer_get_time();
+    uint32_t group_mask = 0;
+    uint32_t group_changed = 0;
+    for (uint8_t i = 0; i < num_txns; i++) {
+        const modbus_master_txn_t* txn = &sched->plan.txns[txn_index[i]];
+        for (uint8_t k = 0; k < txn->num_blocks; k++) {
+            uint8_t due = sched->plan.order[txn->first_order + k];
+            uint8_t group = sched->due_group[due];
+            modbus_master_schedule_check_deadline(sched, group, now);
+            if (ok_mask & (1UL << due)) {
+                modbus_master_schedule_account(sched, group, now);
+                group_mask |= 1UL << group;
+            }
+            modbus_master_schedule_release(sched, group, now, false);
+            if (changed_mask & (1UL << due)) {
+                group_changed |= 1UL << group;
+            }
+        }
+    }
+
+    if (group_mask && sched->callback) {
+        sched->callback(group_mask, group_changed, sched->arg);
+    }
+    return err;
+}
+
+esp_err_t
+modbus_master_schedule_ingest(modbus_master_schedule_t* sched, uint8_t reg_type, uint16_t reg_addr,
+                              const uint16_t* data, uint16_t reg_count) {
+    if (!sched || !data || reg_type != sched->reg_type) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t end = (uint32_t)reg_addr + reg_count;
+    uint32_t group_mask = 0;
+    uint32_t changed_mask = 0;
+
+    // Chỉ nhận group nằm trọn trong vùng đã đọc
+    for (uint8_t i = 0; i < sched->num_groups; i++) {
+        const modbus_master_block_t* blk = &sched->groups[i].block;
+        if (blk->reg_addr < reg_addr || (uint32_t)blk->reg_addr + blk->reg_count > end) {
+            continue;
+        }
+        modbus_master_schedule_check_deadline(sched, i, now);
+        modbus_master_schedule_account(sched, i, now);
+        modbus_master_schedule_release(sched, i, now, true);
+        group_mask |= 1UL << i;
+        if (modbus_master_block_update(blk, &data[blk->reg_addr - reg_addr])) {
+            changed_mask |= 1UL << i;
+        }
+    }
+
+    if (!group_mask) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (sched->callback) {
+        sched->callback(group_mask, changed_mask, sched->arg);
+    }
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_schedule_set_period(modbus_master_schedule_t* sched, uint8_t group, uint32_t period_ms) {
+    if (!sched || group >= sched->num_groups) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const modbus_master_group_t* grp = &sched->groups[group];
+    if (period_ms == 0) {
+        period_ms = grp->period_ms;
+    }
+    if (period_ms == sched->period_ms[group]) {
+        return ESP_OK;
+    }
+
+    // Giữ mốc lần poll trước, chỉ đổi khoảng cách tới lần kế tiếp
+    int64_t last_us = sched->release_us[group] - (int64_t)sched->period_ms[group] * 1000;
+    uint32_t deadline_ms = grp->deadline_ms ? grp->deadline_ms : period_ms;
+
+    sched->period_ms[group] = period_ms;
+    sched->release_us[group] = last_us + (int64_t)period_ms * 1000;
+    sched->deadline_us[group] = sched->release_us[group] + (int64_t)deadline_ms * 1000;
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_schedule_set_max_gap(modbus_master_schedule_t* sched, uint16_t max_gap) {
+    if (!sched) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (max_gap != sched->max_gap) {
+        ESP_LOGI(TAG, "Slave %u: max gap %u -> %u regs", sched->slave_addr, sched->max_gap, max_gap);
+        sched->max_gap = max_gap;
+    }
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_schedule_get_stats(const modbus_master_schedule_t* sched, uint8_t group,
+                                 modbus_master_group_stats_t* stats) {
+    if (!sched || !stats || group >= sched->num_groups) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = sched->stats[group];
+    return ESP_OK;
+}
+
+void
+modbus_master_schedule_reset_stats(modbus_master_schedule_t* sched) {
+    if (sched) {
+        memset(sched->stats, 0, sizeof(sched->stats));
+    }
+}
+
+int64_t
+modbus_master_schedule_next_release(const modbus_master_schedule_t* sched) {
+    int64_t next_release = INT64_MAX;
+    for (uint8_t i = 0; i < sched->num_groups; i++) {
+        if (sched->release_us[i] < next_release) {
+            next_release = sched->release_us[i];
+        }
+    }
+    return next_release;
+}
+
+void
+modbus_master_bus_sched_init(modbus_master_bus_sched_t* bus) {
+    memset(bus, 0, sizeof(*bus));
+}
+
+esp_err_t
+modbus_master_bus_sched_add(modbus_master_bus_sched_t* bus, modbus_master_schedule_t* sched, uint8_t weight) {
+    if (!bus || !sched || weight == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (bus->num_entries >= MODBUS_MASTER_BUS_MAX_SLAVES) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    modbus_master_bus_entry_t* entry = &bus->entries[bus->num_entries++];
+    entry->sched = sched;
+    entry->weight = weight;
+    entry->current = 0;
+
+    ESP_LOGI(TAG, "Slave %u added to bus schedule (weight %u)", sched->slave_addr, weight);
+    return ESP_OK;
+}
+
+// Thời gian bận tích luỹ của manager; 0 khi chưa init (replay)
+static uint64_t
+modbus_master_bus_sched_busy_us(void) {
+    modbus_master_timing_t timing;
+    return modbus_master_get_timing(&timing) == ESP_OK ? timing.busy_us : 0;
+}
+
+// Khép cửa sổ đo tải bus khi đủ dài
+static void
+modbus_master_bus_sched_roll(modbus_master_bus_sched_t* bus, int64_t now) {
+    if (bus->window_start_us == 0) {
+        bus->window_start_us = now;
+        bus->window_busy_mark_us = modbus_master_bus_sched_busy_us();
+        return;
+    }
+
+    int64_t window_us = now - bus->window_start_us;
+    if (window_us < (int64_t)MODBUS_MASTER_BUS_LOAD_WINDOW_MS * 1000) {
+        return;
+    }
+
+    // Lấy hiệu bộ đếm của manager: gồm cả ghi của worker và recovery, không gồm callback/UI
+    uint64_t busy_total = modbus_master_bus_sched_busy_us();
+    int64_t busy_us = busy_total >= bus->window_busy_mark_us ? (int64_t)(busy_total - bus->window_busy_mark_us) : 0;
+    busy_us = busy_us < window_us ? busy_us : window_us;
+    bus->load.window_ms = (uint32_t)(window_us / 1000);
+    bus->load.busy_ms = (uint32_t)(busy_us / 1000);
+    bus->load.slack_ms = (uint32_t)((window_us - busy_us) / 1000);
+    bus->load.load_permille = (uint16_t)(busy_us * 1000 / window_us);
+    bus->load.txns = bus->window_txns;
+
+    bus->window_start_us = now;
+    bus->window_busy_mark_us = busy_total;
+    bus->window_txns = 0;
+}
+
+esp_err_t
+modbus_master_bus_sched_run_once(modbus_master_bus_sched_t* bus, uint32_t* wait_ms, uint8_t* slave_addr) {
+    if (!bus || bus->num_entries == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t now = esp_timer_get_time();
+    modbus_master_bus_sched_roll(bus, now);
+    int64_t next_release = INT64_MAX;
+    int32_t total = 0;
+    modbus_master_bus_entry_t* best = NULL;
+
+    // Smooth weighted round-robin giữa các slave có group đến hạn
+    for (uint8_t i = 0; i < bus->num_entries; i++) {
+        modbus_master_bus_entry_t* entry = &bus->entries[i];
+        int64_t release = modbus_master_schedule_next_release(entry->sched);
+
+        if (release > now) {
+            if (release < next_release) {
+                next_release = release;
+            }
+            continue;
+        }
+
+        entry->current += entry->weight;
+        total += entry->weight;
+        if (!best || entry->current > best->current) {
+            best = entry;
+        }
+    }
+
+    if (!best) {
+        if (wait_ms) {
+            *wait_ms = next_release == INT64_MAX ? 0 : (uint32_t)((next_release - now + 999) / 1000);
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    best->current -= total;
+    if (slave_addr) {
+        *slave_addr = best->sched->slave_addr;
+    }
+
+    esp_err_t err = modbus_master_schedule_run_once(best->sched, wait_ms);
+    bus->window_txns++;
+    return err;
+}
+
+void
+modbus_master_bus_sched_get_load(const modbus_master_bus_sched_t* bus, modbus_master_bus_load_t* load) {
+    if (bus && load) {
+        *load = bus->load;
+    }
+}
+
+esp_err_t
+modbus_master_bus_sched_ingest(modbus_master_bus_sched_t* bus, uint8_t slave_addr, uint8_t reg_type,
+                               uint16_t reg_addr, const uint16_t* data, uint16_t reg_count) {
+    if (!bus) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t result = ESP_ERR_NOT_FOUND;
+    for (uint8_t i = 0; i < bus->num_entries; i++) {
+        modbus_master_schedule_t* sched = bus->entries[i].sched;
+        if (sched->slave_addr == slave_addr && sched->reg_type == reg_type
+            && modbus_master_schedule_ingest(sched, reg_type, reg_addr, data, reg_count) == ESP_OK) {
+            result = ESP_OK;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,444 @@
+#include "modbus_master_tcp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "MODBUS_TCP";
+
+#define TCP_MBAP_LEN 7   // tid(2) + protocol(2) + length(2) + unit(1)
+#define TCP_MAX_ADU  260 // MBAP + 253 byte PDU
+
+typedef struct {
+    uint16_t tid;
+    uint8_t index; // Transaction index in the caller's array
+    int64_t sent_us;
+} tcp_inflight_t;
+
+static struct {
+    int sock;
+    char host[64];
+    uint16_t port;
+    struct sockaddr_storage addr; // Resolved once in modbus_master_tcp_open()
+    socklen_t addr_len;           // 0 = not resolved
+    uint32_t timeout_ms;
+    uint8_t max_inflight;
+    uint16_t next_tid;
+} tcp_ctx = {.sock = -1};
+
+static inline void
+put_u16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline uint16_t
+get_u16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Phân giải tên một lần; reconnect trong lúc giữ bus không phải chờ DNS
+static esp_err_t
+modbus_master_tcp_resolve(void) {
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* res = NULL;
+    char port_str[6];
+
+    snprintf(port_str, sizeof(port_str), "%u", tcp_ctx.port);
+    if (getaddrinfo(tcp_ctx.host, port_str, &hints, &res) != 0 || !res) {
+        ESP_LOGE(TAG, "Cannot resolve %s", tcp_ctx.host);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    memcpy(&tcp_ctx.addr, res->ai_addr, res->ai_addrlen);
+    tcp_ctx.addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return ESP_OK;
+}
+
+// Connect không chặn, chờ tối đa timeout_ms
+static esp_err_t
+modbus_master_tcp_connect(void) {
+    if (tcp_ctx.addr_len == 0 && modbus_master_tcp_resolve() != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int sock = socket(tcp_ctx.addr.ss_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return ESP_FAIL;
+    }
+
+    struct timeval tv = {
+        .tv_sec = tcp_ctx.timeout_ms / 1000,
+        .tv_usec = (tcp_ctx.timeout_ms % 1000) * 1000,
+    };
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int err = 0;
+    if (connect(sock, (struct sockaddr*)&tcp_ctx.addr, tcp_ctx.addr_len) != 0) {
+        err = errno;
+        if (err == EINPROGRESS) {
+            fd_set wfds;
+            FD_ZERO(&wfds);
+            FD_SET(sock, &wfds);
+            socklen_t len = sizeof(err);
+            if (select(sock + 1, NULL, &wfds, NULL, &tv) != 1
+                || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+                err = ETIMEDOUT;
+            }
+        }
+    }
+    if (err != 0) {
+        ESP_LOGE(TAG, "Connect %s:%u failed: errno %d", tcp_ctx.host, tcp_ctx.port, err);
+        close(sock);
+        return ESP_FAIL;
+    }
+    fcntl(sock, F_SETFL, flags);
+
+    tcp_ctx.sock = sock;
+    ESP_LOGI(TAG, "Connected to %s:%u (%u in flight)", tcp_ctx.host, tcp_ctx.port, tcp_ctx.max_inflight);
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_tcp_open(const char* host, uint16_t port, uint32_t timeout_ms, uint8_t max_inflight) {
+    if (!host || timeout_ms == 0 || strlen(host) >= sizeof(tcp_ctx.host)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    modbus_master_tcp_close();
+
+    // Dựng lại transport với cùng server thì giữ địa chỉ đã phân giải
+    port = port ? port : MODBUS_MASTER_TCP_DEFAULT_PORT;
+    if (strcmp(tcp_ctx.host, host) != 0 || tcp_ctx.port != port) {
+        tcp_ctx.addr_len = 0;
+    }
+    snprintf(tcp_ctx.host, sizeof(tcp_ctx.host), "%s", host);
+    tcp_ctx.port = port;
+    tcp_ctx.timeout_ms = timeout_ms;
+    tcp_ctx.max_inflight = max_inflight == 0 ? 1
+                         : max_inflight > MODBUS_MASTER_TCP_MAX_INFLIGHT ? MODBUS_MASTER_TCP_MAX_INFLIGHT
+                                                                          : max_inflight;
+    if (tcp_ctx.addr_len == 0 && modbus_master_tcp_resolve() != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return modbus_master_tcp_connect();
+}
+
+void
+modbus_master_tcp_close(void) {
+    if (tcp_ctx.sock >= 0) {
+        shutdown(tcp_ctx.sock, SHUT_RDWR);
+        close(tcp_ctx.sock);
+        tcp_ctx.sock = -1;
+    }
+}
+
+esp_err_t
+modbus_master_tcp_reconnect(void) {
+    if (tcp_ctx.host[0] == '\0') {
+        return ESP_ERR_INVALID_STATE;
+    }
+    modbus_master_tcp_close();
+    return modbus_master_tcp_connect();
+}
+
+bool
+modbus_master_tcp_is_open(void) {
+    return tcp_ctx.sock >= 0;
+}
+
+uint8_t
+modbus_master_tcp_inflight(void) {
+    return tcp_ctx.sock >= 0 ? tcp_ctx.max_inflight : 0;
+}
+
+// Dựng ADU (MBAP + PDU), trả về 0 nếu function code/số lượng không hợp lệ
+static size_t
+modbus_master_tcp_build(const modbus_master_tcp_txn_t* txn, uint16_t tid, uint8_t* adu) {
+    uint8_t* pdu = adu + TCP_MBAP_LEN;
+    const uint16_t* regs = (const uint16_t*)txn->data;
+    size_t pdu_len;
+
+    pdu[0] = txn->command;
+    put_u16(&pdu[1], txn->reg_addr);
+
+    switch (txn->command) {
+        case 0x01:
+        case 0x02:
+            if (txn->reg_count == 0 || txn->reg_count > 2000) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            pdu_len = 5;
+            break;
+        case 0x03:
+        case 0x04:
+            if (txn->reg_count == 0 || txn->reg_count > 125) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            pdu_len = 5;
+            break;
+        case 0x05:
+        case 0x06:
+            put_u16(&pdu[3], regs[0]);
+            pdu_len = 5;
+            break;
+        case 0x10:
+            if (txn->reg_count == 0 || txn->reg_count > 123) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            pdu[5] = txn->reg_count * 2;
+            for (uint16_t i = 0; i < txn->reg_count; i++) {
+                put_u16(&pdu[6 + 2 * i], regs[i]);
+            }
+            pdu_len = 6 + 2 * txn->reg_count;
+            break;
+        case 0x17:
+            if (txn->reg_count == 0 || txn->reg_count > 125 || txn->wr_count == 0 || txn->wr_count > 121
+                || !txn->wr_data) {
+                return 0;
+            }
+            put_u16(&pdu[3], txn->reg_count);
+            put_u16(&pdu[5], txn->wr_addr);
+            put_u16(&pdu[7], txn->wr_count);
+            pdu[9] = txn->wr_count * 2;
+            for (uint16_t i = 0; i < txn->wr_count; i++) {
+                put_u16(&pdu[10 + 2 * i], txn->wr_data[i]);
+            }
+            pdu_len = 10 + 2 * txn->wr_count;
+            break;
+        default:
+            return 0;
+    }
+
+    put_u16(&adu[0], tid);
+    put_u16(&adu[2], 0);
+    put_u16(&adu[4], pdu_len + 1);
+    adu[6] = txn->unit_id;
+    return TCP_MBAP_LEN + pdu_len;
+}
+
+static esp_err_t
+modbus_master_tcp_parse(modbus_master_tcp_txn_t* txn, const uint8_t* pdu, size_t len) {
+    // Exception (fc | 0x80) tách khỏi frame sai để thống kê riêng
+    if (len < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (pdu[0] != txn->command) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    switch (txn->command) {
+        case 0x01:
+        case 0x02: {
+            size_t bytes = (txn->reg_count + 7) / 8;
+            if (pdu[1] != bytes || len < 2 + bytes) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(txn->data, &pdu[2], bytes);
+            break;
+        }
+        case 0x03:
+        case 0x04:
+        case 0x17: {
+            size_t bytes = txn->reg_count * 2;
+            if (pdu[1] != bytes || len < 2 + bytes) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            uint16_t* regs = (uint16_t*)txn->data;
+            for (uint16_t i = 0; i < txn->reg_count; i++) {
+                regs[i] = get_u16(&pdu[2 + 2 * i]);
+            }
+            break;
+        }
+        default:
+            // Write: server trả lại địa chỉ
+            if (len < 5 || get_u16(&pdu[1]) != txn->reg_addr) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            break;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t
+modbus_master_tcp_send_all(const uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(tcp_ctx.sock, buf, len, 0);
+        if (n <= 0) {
+            return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        }
+        buf += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t
+modbus_master_tcp_recv_all(uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(tcp_ctx.sock, buf, len, 0);
+        if (n == 0) {
+            return ESP_FAIL; // Server đóng kết nối
+        }
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        }
+        buf += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+// Chờ một ADU tới deadline; phần còn lại của frame đã bắt đầu dùng SO_RCVTIMEO
+static esp_err_t
+modbus_master_tcp_recv_adu(uint8_t* adu, size_t* adu_len, int64_t deadline_us) {
+    int64_t wait_us = deadline_us - esp_timer_get_time();
+    if (wait_us < 0) {
+        wait_us = 0;
+    }
+
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(tcp_ctx.sock, &rfds);
+    struct timeval tv = {.tv_sec = wait_us / 1000000, .tv_usec = wait_us % 1000000};
+
+    int ready = select(tcp_ctx.sock + 1, &rfds, NULL, NULL, &tv);
+    if (ready == 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (ready < 0) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = modbus_master_tcp_recv_all(adu, TCP_MBAP_LEN);
+    if (err != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    uint16_t len = get_u16(&adu[4]);
+    if (len < 2 || len > TCP_MAX_ADU - 6) {
+        return ESP_FAIL; // Mất đồng bộ stream
+    }
+    if (modbus_master_tcp_recv_all(&adu[TCP_MBAP_LEN], len - 1) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    *adu_len = 6 + len;
+    return ESP_OK;
+}
+
+esp_err_t
+modbus_master_tcp_transact(modbus_master_tcp_txn_t* txns, uint8_t count) {
+    if (!txns || count == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        txns[i].result = ESP_ERR_INVALID_STATE;
+        txns[i].rtt_us = 0;
+    }
+    if (tcp_ctx.sock < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    tcp_inflight_t inflight[MODBUS_MASTER_TCP_MAX_INFLIGHT];
+    uint8_t num_inflight = 0;
+    uint8_t next = 0;
+    uint8_t done = 0;
+    uint8_t adu[TCP_MAX_ADU];
+    size_t adu_len;
+
+    while (done < count) {
+        // Đẩy request tới khi đầy pipeline
+        while (next < count && num_inflight < tcp_ctx.max_inflight) {
+            modbus_master_tcp_txn_t* txn = &txns[next];
+            uint16_t tid = tcp_ctx.next_tid++;
+
+            adu_len = modbus_master_tcp_build(txn, tid, adu);
+            if (adu_len == 0) {
+                txn->result = ESP_ERR_NOT_SUPPORTED;
+                next++;
+                done++;
+                continue;
+            }
+            if (modbus_master_tcp_send_all(adu, adu_len) != ESP_OK) {
+                goto lost;
+            }
+            inflight[num_inflight++] = (tcp_inflight_t){tid, next, esp_timer_get_time()};
+            next++;
+        }
+        if (num_inflight == 0) {
+            continue;
+        }
+
+        // Request cũ nhất quyết định thời gian chờ
+        uint32_t timeout_ms = txns[inflight[0].index].timeout_ms;
+        int64_t deadline_us = inflight[0].sent_us + (int64_t)(timeout_ms ? timeout_ms : tcp_ctx.timeout_ms) * 1000;
+        esp_err_t err = modbus_master_tcp_recv_adu(adu, &adu_len, deadline_us);
+        if (err == ESP_ERR_TIMEOUT) {
+            txns[inflight[0].index].result = ESP_ERR_TIMEOUT;
+            memmove(&inflight[0], &inflight[1], --num_inflight * sizeof(tcp_inflight_t));
+            done++;
+            continue;
+        }
+        if (err != ESP_OK) {
+            goto lost;
+        }
+
+        // Khớp theo transaction ID; response muộn của request đã bỏ thì bỏ qua
+        uint16_t tid = get_u16(&adu[0]);
+        uint8_t k = 0;
+        while (k < num_inflight && inflight[k].tid != tid) {
+            k++;
+        }
+        if (k == num_inflight || get_u16(&adu[2]) != 0) {
+            ESP_LOGD(TAG, "Discarding response tid=%u", tid);
+            continue;
+        }
+
+        modbus_master_tcp_txn_t* txn = &txns[inflight[k].index];
+        txn->rtt_us = (uint32_t)(esp_timer_get_time() - inflight[k].sent_us);
+        txn->result = adu[6] == txn->unit_id ? modbus_master_tcp_parse(txn, &adu[TCP_MBAP_LEN], adu_len - TCP_MBAP_LEN)
+                                             : ESP_ERR_INVALID_SIZE;
+        memmove(&inflight[k], &inflight[k + 1], (num_inflight - k - 1) * sizeof(tcp_inflight_t));
+        num_inflight--;
+        done++;
+    }
+    goto out;
+
+lost:
+    // Mất kết nối: các transaction chưa xong đều lỗi, recovery sẽ kết nối lại
+    ESP_LOGW(TAG, "Connection lost");
+    modbus_master_tcp_close();
+    for (uint8_t i = 0; i < num_inflight; i++) {
+        txns[inflight[i].index].result = ESP_FAIL;
+    }
+    for (uint8_t i = next; i < count; i++) {
+        txns[i].result = ESP_FAIL;
+    }
+
+out:
+    for (uint8_t i = 0; i < count; i++) {
+        if (txns[i].result != ESP_OK) {
+            return txns[i].result;
+        }
+    }
+    return ESP_OK;
+}
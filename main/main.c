@@ -1,5 +1,15 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app_history.h"
 #include "app_states.h"
+#include "modbus_master_capture.h"
+#include "modbus_master_gateway.h"
 #include "modbus_master_manager.h"
+#include "modbus_master_schedule.h"
+#include "nvs.h"
+#include "nvs_flash.h"
 #include "ui.h"
 #include "ui_support.h"
 
@@ -37,177 +47,717 @@ static SemaphoreHandle_t sem_gui_ready;
 
 // ============================================
 // Modbus Callbacks & Task
-// ============================================// Callback nhận dữ liệu Modbus
-void
-modbus_data_received(uint8_t slave_addr, uint8_t reg_type, uint16_t reg_addr, uint16_t* data, uint16_t length) {
-    // ESP_LOGI(TAG, "Received data from slave %d, type 0x%02X, addr %d:", slave_addr, reg_type, reg_addr);
-    // for (int i = 0; i < length; i++) {
-    //     ESP_LOGI(TAG, "  [%d] = %d", i, data[i]);
-    // }
-}
+// ============================================
 
+// Cách ghép một trường BMS_Data_t từ bảng thanh ghi slot
+#define BMS_FIELD_SIGNED    0x01 // Thanh ghi đơn là int16_t
+#define BMS_FIELD_LOW_FIRST 0x02 // Trường 2 thanh ghi: word thấp đứng trước
+
+typedef struct {
+    uint8_t words;   // 0 = không có trường bắt đầu ở thanh ghi này, 1 hoặc 2
+    uint8_t size;    // sizeof trường đích: 1, 2 hoặc 4
+    uint8_t flags;
+    uint16_t offset; // offsetof trong BMS_Data_t
+    int16_t scale;   // Nhân sau khi ghép, 1 = giữ nguyên đơn vị của BMS
+} bms_field_t;
+
+#define BMS_FIELD(member, nwords, field_flags, field_scale)                                                            \
+    {nwords, sizeof(((BMS_Data_t*)0)->member), field_flags, offsetof(BMS_Data_t, member), field_scale}
+#define BMS_U16(member)    BMS_FIELD(member, 1, 0, 1)
+#define BMS_HI_LO(member)  BMS_FIELD(member, 2, 0, 1)
+
+// Chỉ số là thanh ghi đầu của trường (BatertyRegister_t); thêm trường = thêm một dòng
+static const bms_field_t bms_fields[TOTAL_BAT_REGISTERS] = {
+    [BAT_REG_BMS_STATE] = BMS_U16(bms_state),
+    [BAT_REG_CTRL_REQUEST] = BMS_U16(ctrl_request),
+    [BAT_REG_CTRL_RESPONSE] = BMS_U16(ctrl_response),
+    [BAT_REG_FET_CTRL_PIN] = BMS_U16(fet_ctrl_pin),
+    [BAT_REG_FET_STATUS] = BMS_U16(fet_status),
+    [BAT_REG_ALARM_BITS] = BMS_U16(alarm_bits),
+    [BAT_REG_FAULTS] = BMS_U16(faults),
+    [BAT_REG_PACK_VOLT] = BMS_U16(pack_volt),
+    [BAT_REG_STACK_VOLT] = BMS_U16(stack_volt),
+    [BAT_REG_PACK_CURRENT_HIGH] = BMS_HI_LO(pack_current),
+    [BAT_REG_ID_VOLT] = BMS_U16(ld_volt),
+    [BAT_REG_TEMP1_HIGH] = BMS_HI_LO(temp1),
+    [BAT_REG_TEMP2_HIGH] = BMS_HI_LO(temp2),
+    [BAT_REG_TEMP3_HIGH] = BMS_HI_LO(temp3),
+    [BAT_REG_CELL1] = BMS_U16(cell_volt[0]),
+    [BAT_REG_CELL2] = BMS_U16(cell_volt[1]),
+    [BAT_REG_CELL3] = BMS_U16(cell_volt[2]),
+    [BAT_REG_CELL4] = BMS_U16(cell_volt[3]),
+    [BAT_REG_CELL5] = BMS_U16(cell_volt[4]),
+    [BAT_REG_CELL6] = BMS_U16(cell_volt[5]),
+    [BAT_REG_CELL7] = BMS_U16(cell_volt[6]),
+    [BAT_REG_CELL8] = BMS_U16(cell_volt[7]),
+    [BAT_REG_CELL9] = BMS_U16(cell_volt[8]),
+    [BAT_REG_CELL10] = BMS_U16(cell_volt[9]),
+    [BAT_REG_CELL11] = BMS_U16(cell_volt[10]),
+    [BAT_REG_CELL12] = BMS_U16(cell_volt[11]),
+    [BAT_REG_CELL13] = BMS_U16(cell_volt[12]),
+    [BAT_REG_SAFETY_A] = BMS_U16(safety_a),
+    [BAT_REG_SAFETY_B] = BMS_U16(safety_b),
+    [BAT_REG_SAFETY_C] = BMS_U16(safety_c),
+    [BAT_REG_ACCU_INT_HIGH] = BMS_HI_LO(accu_int),
+    [BAT_REG_ACCU_FRAC_HIGH] = BMS_HI_LO(accu_frac),
+    [BAT_REG_ACCU_TIME_HIGH] = BMS_HI_LO(accu_time),
+    [BAT_REG_PIN_PERCENT] = BMS_U16(pin_percent),
+    [BAT_REG_PERCENT_TARGET] = BMS_U16(percent_target),
+    [BAT_REG_CELL_RESISTANCE] = BMS_U16(cell_resistance),
+    [BAT_REG_SOC_PERCENT] = BMS_U16(soc_percent),
+    [BAT_REG_SOH_VALUE] = BMS_U16(soh_value),
+    [BAT_REG_CAPACITY] = BMS_U16(capacity),
+    [BAT_REG_SINGLE_PARALLEL] = BMS_U16(single_parallel),
+};
+
+_Static_assert(TOTAL_BAT_REGISTERS <= 64, "dirty mask is one bit per BMS register");
+
+#define BMS_REG_MASK(first, count) ((((uint64_t)1 << (count)) - 1) << (first))
+
+// Giải mã các trường có thanh ghi nằm trong dirty (bit = BatertyRegister_t)
 static void
-modbus_battery_sync_data(app_state_hsm_t* me, uint16_t* dat, uint8_t slot_index) {
-    me->bms_data[slot_index].bms_state = dat[0];
-    me->bms_data[slot_index].ctrl_request = dat[1];
-    me->bms_data[slot_index].ctrl_response = dat[2];
-    me->bms_data[slot_index].fet_ctrl_pin = dat[3];
-    me->bms_data[slot_index].fet_status = dat[4];
-    me->bms_data[slot_index].alarm_bits = dat[5];
-    me->bms_data[slot_index].faults = dat[6];
-
-    me->bms_data[slot_index].pack_volt = dat[7];
-    me->bms_data[slot_index].stack_volt = dat[8];
-    me->bms_data[slot_index].cell_volt[0] = dat[18];
-    me->bms_data[slot_index].cell_volt[1] = dat[19];
-    me->bms_data[slot_index].cell_volt[2] = dat[20];
-    me->bms_data[slot_index].cell_volt[3] = dat[21];
-    me->bms_data[slot_index].cell_volt[4] = dat[22];
-    me->bms_data[slot_index].cell_volt[5] = dat[23];
-    me->bms_data[slot_index].cell_volt[6] = dat[24];
-    me->bms_data[slot_index].cell_volt[7] = dat[25];
-    me->bms_data[slot_index].cell_volt[8] = dat[26];
-    me->bms_data[slot_index].cell_volt[9] = dat[27];
-    me->bms_data[slot_index].cell_volt[10] = dat[28];
-    me->bms_data[slot_index].cell_volt[11] = dat[29];
-    me->bms_data[slot_index].cell_volt[12] = dat[33];
-
-    me->bms_data[slot_index].ld_volt = dat[11];
-    me->bms_data[slot_index].pack_current = dat[9] << 16 | dat[10];
-    me->bms_data[slot_index].temp1 = dat[12] << 16 | dat[13];
-    me->bms_data[slot_index].temp2 = dat[12] << 16 | dat[13];
-    me->bms_data[slot_index].temp3 = dat[14] << 16 | dat[15];
-
-    me->bms_data[slot_index].capacity = dat[48];
-    me->bms_data[slot_index].soc_percent = dat[46];
-    me->bms_data[slot_index].soh_value = dat[47];
-    me->bms_data[slot_index].pin_percent = dat[43];
-    me->bms_data[slot_index].percent_target = dat[44];
-    me->bms_data[slot_index].safety_a = dat[34];
-    me->bms_data[slot_index].safety_b = dat[35];
-    me->bms_data[slot_index].safety_c = dat[36];
-
-    me->bms_data[slot_index].accu_int = dat[37] << 16 | dat[38];
-    me->bms_data[slot_index].accu_frac = dat[39] << 16 | dat[40];
-    me->bms_data[slot_index].accu_time = dat[41] << 16 | dat[42];
-
-    me->bms_data[slot_index].cell_resistance = dat[45];
-    me->bms_data[slot_index].single_parallel = dat[49];
+modbus_battery_sync_data(app_state_hsm_t* me, const uint16_t* dat, uint8_t slot_index, uint64_t dirty) {
+    uint8_t* bms = (uint8_t *)&me->bms_data[slot_index];
+
+    for (uint8_t reg = 0; reg < TOTAL_BAT_REGISTERS; reg++) {
+        const bms_field_t* f = &bms_fields[reg];
+        if (!f->words || !(dirty & BMS_REG_MASK(reg, f->words))) {
+            continue;
+        }
+
+        int32_t value;
+        if (f->words == 2) {
+            uint16_t hi = dat[reg + ((f->flags & BMS_FIELD_LOW_FIRST) ? 1 : 0)];
+            uint16_t lo = dat[reg + ((f->flags & BMS_FIELD_LOW_FIRST) ? 0 : 1)];
+            value = (int32_t)((uint32_t)hi << 16 | lo);
+        } else {
+            value = (f->flags & BMS_FIELD_SIGNED) ? (int16_t)dat[reg] : dat[reg];
+        }
+        value *= f->scale;
+
+        if (f->size == 1) {
+            bms[f->offset] = (uint8_t)value;
+        } else if (f->size == 2) {
+            uint16_t v16 = (uint16_t)value;
+            memcpy(&bms[f->offset], &v16, sizeof(v16));
+        } else {
+            memcpy(&bms[f->offset], &value, sizeof(value));
+        }
+    }
 }
 
 static void
-modbus_bms_information_sync_data(app_state_hsm_t* me, uint16_t* dat) {
-    me->bms_info.slot_state[IDX_SLOT_1] = dat[0];
-    me->bms_info.slot_state[IDX_SLOT_2] = dat[1];
-    me->bms_info.slot_state[IDX_SLOT_3] = dat[2];
-    me->bms_info.slot_state[IDX_SLOT_4] = dat[3];
-    me->bms_info.slot_state[IDX_SLOT_5] = dat[4];
-
-    me->bms_info.swap_state = dat[5];
-    me->bms_info.manual_swap_request= dat[6];
-    me->bms_info.complete_swap = dat[7];
+modbus_bms_information_sync_data(BMS_Information_t* info, uint16_t* dat) {
+    info->slot_state[IDX_SLOT_1] = dat[0];
+    info->slot_state[IDX_SLOT_2] = dat[1];
+    info->slot_state[IDX_SLOT_3] = dat[2];
+    info->slot_state[IDX_SLOT_4] = dat[3];
+    info->slot_state[IDX_SLOT_5] = dat[4];
+
+    info->swap_state = dat[5];
+    info->manual_swap_request= dat[6];
+    info->complete_swap = dat[7];
 }
 
 
 #define USE_MODBUS_MASTER_DEBUG 0
-void
-modbus_poll_task(void* arg) {
-    // ✅ MỖI SLOT CÓ BUFFER RIÊNG
-    uint16_t slot1_regs[60];
-    uint16_t slot2_regs[60];
-    uint16_t slot3_regs[60];
-    uint16_t slot4_regs[60];
-    uint16_t slot5_regs[60];
-    uint16_t station_regs[60];
-    
-    uint8_t consecutive_errors = 0;
-    bool need_reset = false;
+#define MODBUS_SLAVE_TURNAROUND_US 2000 // Thời gian phản hồi ước lượng của slave khi chưa đo được
+#define MODBUS_GAP_CHECK_MS        1000 // Chu kỳ xem lại baud/turnaround để tính lại max_gap
+
+// ✅ MỖI TRẠM CÓ BUFFER, LỊCH POLL VÀ TRỌNG SỐ RIÊNG
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t weight;
+    uint16_t slot_regs[TOTAL_SLOT][MB_SLOT1_NUMBER_OF_REGS];
+    uint16_t station_regs[MB_COMMON_NUMBER_OF_REGS];
+    modbus_master_group_t groups[MODBUS_MASTER_SCHEDULE_MAX_GROUPS];
+    modbus_master_schedule_t sched;
+    _Atomic uint32_t force_mask; // Group coi như đã đổi ở lần đọc kế tiếp (sau khi kết nối lại)
+    app_extra_station_t* extra;  // Trạm phụ: ô trong device.extra, NULL với trạm chính
+} modbus_station_t;
+
+static modbus_station_t modbus_stations[APP_MODBUS_MAX_STATIONS];
+static uint8_t modbus_num_stations;
+
+// Danh sách trạm phụ "id[:weight],...", nạp lúc khởi động bởi modbus_stations_load()
+#define MODBUS_STATIONS_NVS_NAMESPACE "modbus"
+#define MODBUS_STATIONS_NVS_KEY       "stations"
+static char modbus_extra_stations[64];
+
+// Baud và turnaround đã dùng để tính max_gap hiện tại
+static uint32_t modbus_gap_baudrate;
+static uint32_t modbus_gap_turnaround_us;
+
+#define POLL_TAG_STATION TOTAL_SLOT
+
+// Các slot cách đều nhau trong bảng thanh ghi
+#define POLL_SLOT_BASE(slot) (MB_SLOT1_START_REG + (slot) * (MB_SLOT2_START_REG - MB_SLOT1_START_REG))
+
+// Buffer đích được gán theo từng trạm trong modbus_station_add()
+#define POLL_SLOT_GROUP(name, slot, first, last, period_ms)                                                            \
+    {name, {POLL_SLOT_BASE(slot) + (first), (last) - (first) + 1, NULL}, period_ms, 0, slot}
+
+#define POLL_SLOT_GROUPS(slot)                                                                                         \
+    POLL_SLOT_GROUP("pack", slot, BAT_REG_BMS_STATE, BAT_REG_ID_VOLT, 1000),                                           \
+    POLL_SLOT_GROUP("temp", slot, BAT_REG_TEMP1_HIGH, BAT_REG_TEMP3_LOW, 5000),                                        \
+    POLL_SLOT_GROUP("cell", slot, BAT_REG_CELL1, BAT_REG_SAFETY_C, 2000),                                              \
+    POLL_SLOT_GROUP("accu", slot, BAT_REG_ACCU_INT_HIGH, BAT_REG_ACCU_TIME_LOW, 10000),                                \
+    POLL_SLOT_GROUP("soc", slot, BAT_REG_PIN_PERCENT, BAT_REG_BMS_STATE_2, 5000)
+
+#define POLL_STATION_GROUP(name, first, last, period_ms, deadline_ms)                                                  \
+    {name, {(first), (last) - (first) + 1, NULL}, period_ms, deadline_ms, POLL_TAG_STATION}
+
+// Mỗi nhóm thanh ghi có chu kỳ riêng: swap state 10 Hz, accumulator 0.1 Hz
+static const modbus_master_group_t poll_groups[] = {
+    POLL_STATION_GROUP("station", MB_COMMON_SWAP_STATE_REG, MB_COMMON_E_STOP_REG, 100, 100),
+    POLL_STATION_GROUP("slot_state", MB_COMMON_SLOT_1_STATE_REG, MB_COMMON_SLOT_5_STATE_REG, 500, 0),
+    POLL_SLOT_GROUPS(IDX_SLOT_1),
+    POLL_SLOT_GROUPS(IDX_SLOT_2),
+    POLL_SLOT_GROUPS(IDX_SLOT_3),
+    POLL_SLOT_GROUPS(IDX_SLOT_4),
+    POLL_SLOT_GROUPS(IDX_SLOT_5),
+};
+
+#define POLL_NUM_GROUPS         (sizeof(poll_groups) / sizeof(poll_groups[0]))
+#define POLL_NUM_STATION_GROUPS 2 // station, slot_state
+
+#if CONFIG_HMI_HISTORY
+// Lịch sử: 1 s x 10 phút, 10 s x 6 giờ, 1 phút x N ngày
+static const app_history_tier_t history_tiers[] = {
+    {.period_s = 1, .points = 600},
+    {.period_s = 10, .points = 2160},
+    {.period_s = 60, .points = 1440 * CONFIG_HMI_HISTORY_DAYS},
+};
+
+// Bucket tier 0 (cộng 1, 0 = chưa ghi) đã có mẫu của từng slot: group về dày hơn không được tính nhiều lần
+static uint32_t history_bucket[TOTAL_SLOT];
+#endif
+#define POLL_SLOT_KINDS         5 // pack, temp, cell, accu, soc
+#define POLL_VIEW_CHECK_MS      100
+
+// Chu kỳ poll (ms) theo màn hình đang xem, 0 = chu kỳ mặc định trong poll_groups
+typedef struct {
+    uint32_t station;
+    uint32_t slot_state;
+    uint32_t slot_focus[POLL_SLOT_KINDS]; // Slot đang hiển thị ở màn hình detail
+    uint32_t slot_other[POLL_SLOT_KINDS];
+} modbus_poll_profile_t;
+
+static const modbus_poll_profile_t poll_profiles[TOTAL_POLL_VIEW] = {
+    // Trạng thái trạm (nút nhấn, lỗi, xác nhận lệnh) luôn 100 ms ở mọi màn hình, chỉ nhóm slot chậm lại
+    [APP_POLL_VIEW_DEFAULT] = {0},
+    // Tổng quan: điện áp, % pin và trạng thái swap, cập nhật màn hình mỗi giây
+    [APP_POLL_VIEW_MAIN] = {100, 1000, {0}, {2000, 30000, 30000, 60000, 5000}},
+    // Slot đang xem đọc đủ và nhanh, các slot khác chỉ giữ tổng quan
+    [APP_POLL_VIEW_DETAIL] = {100, 1000, {500, 2000, 1000, 5000, 2000}, {5000, 30000, 30000, 60000, 10000}},
+    // Đang swap: trạng thái trạm nhanh nhất, dữ liệu pin chậm lại
+    [APP_POLL_VIEW_PROCESS] = {100, 250, {0}, {2000, 30000, 30000, 60000, 5000}},
+};
 
-    while (1) {
-        // ===== KIỂM TRA CẦN RESET =====
-        if (need_reset) {
-            // ESP_LOGW(TAG, "🔄 Resetting Modbus stack...");
-            modbus_master_reset();
-            need_reset = false;
-            consecutive_errors = 0;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            continue;
+static void
+modbus_poll_groups_updated(uint32_t group_mask, uint32_t changed_mask, void* arg) {
+    modbus_station_t* st = (modbus_station_t *)arg;
+    uint64_t slot_dirty[TOTAL_SLOT] = {0};
+    bool station = false;
+
+    // Trạm phụ: chỉ có nhóm trạng thái trạm, màn hình cài đặt đọc qua snapshot
+    if (st->extra) {
+        if (!group_mask) {
+            return;
+        }
+        changed_mask |= atomic_fetch_and(&st->force_mask, ~group_mask) & group_mask;
+        if (changed_mask) {
+            modbus_bms_information_sync_data(&st->extra->bms_info, st->station_regs);
         }
+        st->extra->info_rx.time_us = esp_timer_get_time();
+        st->extra->info_rx.seq++;
+        app_station_publish(&device);
+        return;
+    }
 
-        // ===== SLOT 1 =====
-        esp_err_t err = modbus_master_read_holding_registers(APP_MODBUS_SLAVE_ID, MB_SLOT1_START_REG, MB_SLOT1_NUMBER_OF_REGS, slot1_regs);
-        if (err == ESP_OK) {
-            modbus_battery_sync_data(&device, slot1_regs, IDX_SLOT_1);
-            consecutive_errors = 0;
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_1_DATA, NULL);
-        } else {
-            consecutive_errors++;
+    // Block nào nhận được thì đóng dấu thời gian, kể cả khi giá trị không đổi
+    uint32_t rx_blocks = 0;
+    for (uint8_t i = 0; i < POLL_NUM_GROUPS; i++) {
+        if (group_mask & (1UL << i)) {
+            rx_blocks |= 1UL << poll_groups[i].tag;
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    if (!rx_blocks) {
+        return;
+    }
 
-        // ===== SLOT 2 =====
-        err = modbus_master_read_holding_registers(APP_MODBUS_SLAVE_ID, MB_SLOT2_START_REG, MB_SLOT2_NUMBER_OF_REGS, slot2_regs);
-        if (err == ESP_OK) {
-            modbus_battery_sync_data(&device, slot2_regs, IDX_SLOT_2);
-            consecutive_errors = 0;
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_2_DATA, NULL);
+    // Vừa kết nối lại: giá trị có thể y như trước khi mất nhưng màn hình đã bị xoá, giải mã lại hết
+    changed_mask |= atomic_fetch_and(&st->force_mask, ~group_mask) & group_mask;
+
+    // Chỉ giải mã và báo HSM khi thanh ghi thực sự thay đổi
+    for (uint8_t i = 0; i < POLL_NUM_GROUPS; i++) {
+        if (!(changed_mask & (1UL << i))) {
+            continue;
+        }
+        if (poll_groups[i].tag == POLL_TAG_STATION) {
+            station = true;
         } else {
-            consecutive_errors++;
+            const modbus_master_block_t* blk = &poll_groups[i].block;
+            slot_dirty[poll_groups[i].tag] |= BMS_REG_MASK(blk->reg_addr - POLL_SLOT_BASE(poll_groups[i].tag),
+                                                           blk->reg_count);
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+    }
 
-        // ===== SLOT 3 =====
-        err = modbus_master_read_holding_registers(APP_MODBUS_SLAVE_ID, MB_SLOT3_START_REG, MB_SLOT3_NUMBER_OF_REGS, slot3_regs);
-        if (err == ESP_OK) {
-            modbus_battery_sync_data(&device, slot3_regs, IDX_SLOT_3);
-            consecutive_errors = 0;
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_3_DATA, NULL);
-        } else {
-            consecutive_errors++;
+    for (uint8_t slot = 0; slot < TOTAL_SLOT; slot++) {
+        if (slot_dirty[slot]) {
+            modbus_battery_sync_data(&device, st->slot_regs[slot], slot, slot_dirty[slot]);
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    if (station) {
+        modbus_bms_information_sync_data(&device.bms_info, st->station_regs);
+    }
 
-        // ===== SLOT 4 =====
-        err = modbus_master_read_holding_registers(APP_MODBUS_SLAVE_ID, MB_SLOT4_START_REG, MB_SLOT4_NUMBER_OF_REGS, slot4_regs);
-        if (err == ESP_OK) {
-            modbus_battery_sync_data(&device, slot4_regs, IDX_SLOT_4);
-            consecutive_errors = 0;
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_4_DATA, NULL);
-        } else {
-            consecutive_errors++;
+    int64_t now_us = esp_timer_get_time();
+    for (uint8_t tag = 0; tag <= POLL_TAG_STATION; tag++) {
+        if (rx_blocks & (1UL << tag)) {
+            app_block_rx_t* rx = tag == POLL_TAG_STATION ? &device.info_rx : &device.slot_rx[tag];
+            rx->time_us = now_us;
+            rx->seq++;
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+    }
 
-        // ===== SLOT 5 =====
-        err = modbus_master_read_holding_registers(APP_MODBUS_SLAVE_ID, MB_SLOT5_START_REG, MB_SLOT5_NUMBER_OF_REGS, slot5_regs);
-        if (err == ESP_OK) {
-            modbus_battery_sync_data(&device, slot5_regs, IDX_SLOT_5);
-            consecutive_errors = 0;
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_5_DATA, NULL);
-        } else {
-            consecutive_errors++;
+#if CONFIG_HMI_HISTORY
+    // Mỗi slot một mẫu cho mỗi chu kỳ tier 0, lấy ở group đầu tiên về trong chu kỳ
+    uint32_t bucket = (uint32_t)(now_us / 1000000 / history_tiers[0].period_s) + 1;
+    for (uint8_t slot = 0; slot < TOTAL_SLOT; slot++) {
+        if ((rx_blocks & (1UL << slot)) && device.bms_info.slot_state[slot] == BMS_SLOT_CONNECTED
+            && history_bucket[slot] != bucket) {
+            history_bucket[slot] = bucket;
+            app_history_append(slot, &device.bms_data[slot], now_us);
+        }
+    }
+#endif
+
+    // Một lần publish cho cả loạt: UI không thấy điện áp mới cạnh dòng điện cũ
+    app_station_publish(&device);
+    for (uint8_t slot = 0; slot < TOTAL_SLOT; slot++) {
+        if (slot_dirty[slot]) {
+            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_1_DATA + slot, NULL);
+        }
+    }
+    if (station) {
+        hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_STATION_STATE_DATA, NULL);
+    }
+}
+
+// Turnaround đo trên dây (EWMA của manager), chưa có mẫu nào thì dùng ước lượng
+static void
+modbus_plan_gap_inputs(uint32_t* baudrate, uint32_t* turnaround_us) {
+    modbus_master_timing_t timing = {0};
+    modbus_master_get_timing(&timing);
+    *baudrate = modbus_master_get_baudrate();
+    *baudrate = *baudrate ? *baudrate : APP_MODBUS_BAUDRATE;
+    *turnaround_us = timing.turnaround_us ? timing.turnaround_us : MODBUS_SLAVE_TURNAROUND_US;
+}
+
+// Tính lại max_gap của mọi trạm khi baud đổi hoặc turnaround lệch quá 25% so với lần tính trước
+static void
+modbus_plan_gap_refresh(void) {
+    uint32_t baudrate;
+    uint32_t turnaround_us;
+    modbus_plan_gap_inputs(&baudrate, &turnaround_us);
+
+    uint32_t drift = turnaround_us > modbus_gap_turnaround_us ? turnaround_us - modbus_gap_turnaround_us
+                                                               : modbus_gap_turnaround_us - turnaround_us;
+    if (baudrate == modbus_gap_baudrate && drift * 4 <= modbus_gap_turnaround_us) {
+        return;
+    }
+
+    modbus_gap_baudrate = baudrate;
+    modbus_gap_turnaround_us = turnaround_us;
+    uint16_t max_gap = modbus_master_plan_gap_for_baud(baudrate, turnaround_us);
+    for (uint8_t i = 0; i < modbus_num_stations; i++) {
+        modbus_master_schedule_set_max_gap(&modbus_stations[i].sched, max_gap);
+    }
+}
+
+static esp_err_t
+modbus_station_add(uint8_t slave_addr, uint8_t weight) {
+    if (slave_addr == 0 || weight == 0 || modbus_num_stations >= APP_MODBUS_MAX_STATIONS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    modbus_station_t* st = &modbus_stations[modbus_num_stations];
+    memset(st, 0, sizeof(*st));
+    st->slave_addr = slave_addr;
+    st->weight = weight;
+
+    // Trạm phụ chỉ đọc các nhóm trạng thái trạm (đứng đầu poll_groups), dữ liệu slot không ai dùng
+    uint8_t num_groups = POLL_NUM_GROUPS;
+    if (slave_addr != APP_MODBUS_SLAVE_ID) {
+        if (device.num_extra >= APP_MAX_EXTRA_STATIONS) {
+            return ESP_ERR_INVALID_ARG;
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+        st->extra = &device.extra[device.num_extra];
+        num_groups = POLL_NUM_STATION_GROUPS;
+    }
 
-        // ===== STATION STATE =====
-        err = modbus_master_read_holding_registers(APP_MODBUS_SLAVE_ID, MB_COMMON_START_REG, MB_COMMON_NUMBER_OF_REGS, station_regs);
-        if (err == ESP_OK) {
-            modbus_bms_information_sync_data(&device, station_regs);
-            consecutive_errors = 0;
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_STATION_STATE_DATA, NULL);
+    for (uint8_t i = 0; i < num_groups; i++) {
+        modbus_master_group_t* grp = &st->groups[i];
+        *grp = poll_groups[i];
+        if (grp->tag == POLL_TAG_STATION) {
+            grp->block.data = &st->station_regs[grp->block.reg_addr - MB_COMMON_START_REG];
         } else {
-            consecutive_errors++;
+            grp->block.data = &st->slot_regs[grp->tag][grp->block.reg_addr - POLL_SLOT_BASE(grp->tag)];
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
+    }
 
-        // ===== XỬ LÝ LỖI =====
-        if (consecutive_errors >= 10) {
-            // ESP_LOGE(TAG, "⚠️  Too many errors (%d) - will reset stack", consecutive_errors);
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_NOTCONNECTED, NULL);
-            need_reset = true;
-        } else if (consecutive_errors > 0) {
-            hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_DATA, NULL);
+    uint32_t baudrate;
+    uint32_t turnaround_us;
+    modbus_plan_gap_inputs(&baudrate, &turnaround_us);
+    modbus_gap_baudrate = baudrate;
+    modbus_gap_turnaround_us = turnaround_us;
+    uint16_t max_gap = modbus_master_plan_gap_for_baud(baudrate, turnaround_us);
+    esp_err_t err = modbus_master_schedule_init(&st->sched, slave_addr, 0x03, st->groups, num_groups, max_gap,
+                                                modbus_poll_groups_updated, st);
+    if (err == ESP_OK) {
+        if (st->extra) {
+            memset(st->extra, 0, sizeof(*st->extra));
+            st->extra->slave_addr = slave_addr;
+            device.num_extra++;
+        }
+        modbus_num_stations++;
+    }
+    return err;
+}
+
+// NVS giữ baud đã chọn và danh sách trạm phụ
+static bool
+modbus_nvs_init(void) {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "NVS unavailable (%s), Modbus settings not stored", esp_err_to_name(err));
+    }
+    return err == ESP_OK;
+}
+
+// Danh sách trạm phụ từ NVS nếu đã được ghi, không thì lấy mặc định trong menuconfig
+static void
+modbus_stations_load(bool nvs_ok) {
+    nvs_handle_t nvs;
+    size_t len = sizeof(modbus_extra_stations);
+
+    strlcpy(modbus_extra_stations, CONFIG_HMI_MODBUS_EXTRA_STATIONS, sizeof(modbus_extra_stations));
+    if (!nvs_ok || nvs_open(MODBUS_STATIONS_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = nvs_get_str(nvs, MODBUS_STATIONS_NVS_KEY, modbus_extra_stations, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Modbus station list unreadable (%s), using default", esp_err_to_name(err));
         }
+        strlcpy(modbus_extra_stations, CONFIG_HMI_MODBUS_EXTRA_STATIONS, sizeof(modbus_extra_stations));
+    }
+}
+
+#if CONFIG_HMI_MODBUS_BAUD_NEGOTIATE
+// Chọn tốc độ nhanh nhất trạm chính chịu được, lưu trong NVS nên không cần nạp lại firmware
+static void
+modbus_baud_negotiate(bool nvs_ok) {
+    static const uint32_t rates[] = {921600, 460800, 230400, APP_MODBUS_BAUDRATE};
+
+    // Chỉ trạm chính được kiểm tra: trạm phụ có thể không theo được tốc độ mới
+    if (modbus_extra_stations[0] != '\0') {
+        ESP_LOGW(TAG, "Extra Modbus stations configured, staying at %d baud", APP_MODBUS_BAUDRATE);
+        return;
+    }
+
+    modbus_master_baud_config_t cfg = {
+        .rates = rates,
+        .num_rates = sizeof(rates) / sizeof(rates[0]),
+        .slave_addr = APP_MODBUS_SLAVE_ID,
+        .probe_reg = MB_COMMON_SWAP_STATE_REG,
+        .nvs_namespace = nvs_ok ? "modbus" : NULL,
+    };
+    modbus_master_baud_negotiate(&cfg);
+}
+#endif
+
+// Danh sách trạm phụ dạng "id[:weight],...", trạm chính luôn được poll nên bỏ qua nếu lặp lại
+static void
+modbus_stations_parse(const char* list) {
+    while (list && *list) {
+        char* end;
+        long id = strtol(list, &end, 10);
+        long weight = 1;
+        if (end == list) {
+            break;
+        }
+        if (*end == ':') {
+            weight = strtol(end + 1, &end, 10);
+        }
+        if (id < 1 || id > 247 || id == APP_MODBUS_SLAVE_ID || weight < 1 || weight > 255
+            || modbus_station_add((uint8_t)id, (uint8_t)weight) != ESP_OK) {
+            ESP_LOGW(TAG, "Ignoring Modbus station %ld:%ld", id, weight);
+        }
+        list = (*end == ',') ? end + 1 : NULL;
+    }
+}
+
+// Gọi sau khi nhả bus, từ task vừa chạy transaction, khi slave mất/có lại kết nối
+static void
+modbus_link_changed(uint8_t slave_addr, bool connected) {
+    for (uint8_t i = 0; i < modbus_num_stations && connected; i++) {
+        if (modbus_stations[i].slave_addr == slave_addr) {
+            atomic_store(&modbus_stations[i].force_mask, (1UL << POLL_NUM_GROUPS) - 1);
+        }
+    }
+    if (slave_addr != APP_MODBUS_SLAVE_ID) {
+        ESP_LOGW(TAG, "Station %u %s", slave_addr, connected ? "connected" : "not connected");
+        return;
+    }
+    hsm_dispatch((hsm_t *)&device, connected ? HEVT_MODBUS_CONNECTED : HEVT_MODBUS_NOTCONNECTED, NULL);
+}
+
+#if USE_MODBUS_MASTER_DEBUG
+// Đọc frame Modbus từ ring, xử lý cả loạt mỗi lần được đánh thức, không giữ bus
+static void
+modbus_frame_trace_task(void* arg) {
+    static modbus_master_reader_t reader;
+    static modbus_master_frame_t frame;
+
+    modbus_master_reader_register(&reader, NULL);
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (modbus_master_reader_next(&reader, &frame)) {
+            ESP_LOGI(TAG, "Frame #%lu: slave %u, type 0x%02X, addr %u, %u regs", (unsigned long)frame.seq,
+                     frame.slave_addr, frame.reg_type, frame.reg_addr, frame.reg_count);
+        }
+        if (reader.dropped) {
+            ESP_LOGW(TAG, "Frame trace dropped %lu frames", (unsigned long)reader.dropped);
+            reader.dropped = 0;
+        }
+    }
+}
+#endif
+
+#if CONFIG_HMI_MODBUS_SNIFF || CONFIG_HMI_MODBUS_REPLAY
+// Response của master khác (PLC) trên bus hoặc từ capture: cập nhật group như khi tự poll
+static void
+modbus_bus_ingest(uint8_t slave_addr, uint8_t reg_type, uint16_t reg_addr, const uint16_t* data, uint16_t reg_count,
+               void* arg) {
+    modbus_master_bus_sched_ingest((modbus_master_bus_sched_t *)arg, slave_addr, reg_type, reg_addr, data, reg_count);
+}
+#endif
+
+#if CONFIG_HMI_MODBUS_REPLAY
+extern const char modbus_capture_txt[] asm("_binary_modbus_capture_txt_start");
+
+// Phát lại capture qua giải mã/HSM/UI, không cần trạm thật
+static void
+modbus_replay_task(void* arg) {
+    static modbus_master_bus_sched_t replay_bus;
+
+    modbus_master_bus_sched_init(&replay_bus);
+    for (uint8_t i = 0; i < modbus_num_stations; i++) {
+        modbus_master_bus_sched_add(&replay_bus, &modbus_stations[i].sched, modbus_stations[i].weight);
+    }
+    modbus_link_changed(APP_MODBUS_SLAVE_ID, true);
+
+    while (modbus_master_replay(modbus_capture_txt, CONFIG_HMI_MODBUS_REPLAY_SPEED, modbus_bus_ingest, &replay_bus)
+           == ESP_OK) {
+    }
+    ESP_LOGE(TAG, "Modbus capture holds no responses");
+    vTaskDelete(NULL);
+}
+#endif
+
+#if CONFIG_HMI_MODBUS_CAPTURE_KB > 0
+// Lệnh một ký tự trên console: 'd' in capture, 'c' xoá capture
+static void
+modbus_capture_console_task(void* arg) {
+    while (1) {
+        int c = fgetc(stdin);
+        if (c == 'd') {
+            modbus_master_capture_dump();
+        } else if (c == 'c') {
+            modbus_master_capture_clear();
+        } else if (c == EOF) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+}
+#endif
+
+#if CONFIG_HMI_MODBUS_GATEWAY
+#define MODBUS_GATEWAY_AGE_REG 2000 // Tuổi dữ liệu (x100 ms) của từng block, theo thứ tự bảng dưới
+
+#define GATEWAY_SLOT_BLOCK(slot) {POLL_SLOT_BASE(slot) + BAT_REG_BMS_STATE, BAT_REG_BMS_STATE_2 - BAT_REG_BMS_STATE + 1}
+
+// SCADA/laptop đọc bảng thanh ghi của trạm chính từ bộ nhớ HMI thay vì chen vào bus RS485
+static void
+modbus_gateway_start(void) {
+    static const modbus_master_gateway_block_t blocks[] = {
+        GATEWAY_SLOT_BLOCK(IDX_SLOT_1),
+        GATEWAY_SLOT_BLOCK(IDX_SLOT_2),
+        GATEWAY_SLOT_BLOCK(IDX_SLOT_3),
+        GATEWAY_SLOT_BLOCK(IDX_SLOT_4),
+        GATEWAY_SLOT_BLOCK(IDX_SLOT_5),
+        {MB_COMMON_SLOT_1_STATE_REG, MB_COMMON_E_STOP_REG - MB_COMMON_SLOT_1_STATE_REG + 1},
+    };
+
+    // Không có chân mặc định: GPIO 17/18 là LCD DATA3/DATA2 trên board này
+    if (CONFIG_HMI_MODBUS_GATEWAY_UART_TX_PIN < 0 || CONFIG_HMI_MODBUS_GATEWAY_UART_RX_PIN < 0) {
+        ESP_LOGE(TAG, "      Modbus gateway FAILED: set HMI_MODBUS_GATEWAY_UART_TX_PIN/RX_PIN in menuconfig");
+        return;
+    }
+
+    modbus_master_gateway_config_t cfg = {
+        .unit_id = CONFIG_HMI_MODBUS_GATEWAY_UNIT_ID,
+        .source_addr = APP_MODBUS_SLAVE_ID,
+        .blocks = blocks,
+        .num_blocks = sizeof(blocks) / sizeof(blocks[0]),
+        .age_reg_addr = MODBUS_GATEWAY_AGE_REG,
+        // Firmware không dựng mạng nên chỉ có RTU trên UART thứ hai
+        .link = MODBUS_MASTER_GATEWAY_RTU,
+        .uart_port = CONFIG_HMI_MODBUS_GATEWAY_UART_NUM,
+        .tx_pin = CONFIG_HMI_MODBUS_GATEWAY_UART_TX_PIN,
+        .rx_pin = CONFIG_HMI_MODBUS_GATEWAY_UART_RX_PIN,
+        .rts_pin = CONFIG_HMI_MODBUS_GATEWAY_UART_RTS_PIN,
+        .baudrate = CONFIG_HMI_MODBUS_GATEWAY_UART_BAUDRATE,
+    };
+
+    esp_err_t err = modbus_master_gateway_start(&cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "      Modbus gateway FAILED: %s", esp_err_to_name(err));
+    }
+}
+#endif
+
+// Đổi chu kỳ group của trạm chính theo màn hình; trạm phụ giữ chu kỳ mặc định
+static void
+modbus_poll_profile_apply(app_poll_view_t view, uint8_t focus_slot) {
+    const modbus_poll_profile_t* prof = &poll_profiles[view];
+
+    for (uint8_t s = 0; s < modbus_num_stations; s++) {
+        modbus_station_t* st = &modbus_stations[s];
+        if (st->slave_addr != APP_MODBUS_SLAVE_ID) {
+            continue;
+        }
+        for (uint8_t i = 0; i < POLL_NUM_GROUPS; i++) {
+            uint32_t period_ms;
+            if (i == 0) {
+                period_ms = prof->station;
+            } else if (i == 1) {
+                period_ms = prof->slot_state;
+            } else {
+                uint8_t kind = (i - POLL_NUM_STATION_GROUPS) % POLL_SLOT_KINDS;
+                bool focus = view == APP_POLL_VIEW_DETAIL && poll_groups[i].tag == focus_slot;
+                period_ms = focus ? prof->slot_focus[kind] : prof->slot_other[kind];
+            }
+            modbus_master_schedule_set_period(&st->sched, i, period_ms);
+        }
+    }
+    ESP_LOGI(TAG, "Modbus poll profile %d (slot %u)", view, focus_slot + 1);
+}
+
+#if USE_MODBUS_MASTER_DEBUG
+#define POLL_REPORT_MS 10000
+
+// Tải bus và chu kỳ thực tế của từng group trạm chính
+static void
+modbus_poll_report(const modbus_master_bus_sched_t* bus) {
+    modbus_master_bus_load_t load;
+    modbus_master_bus_sched_get_load(bus, &load);
+    ESP_LOGI(TAG, "Bus load %u.%u%%, slack %lu/%lu ms, %lu polls", load.load_permille / 10, load.load_permille % 10,
+             (unsigned long)load.slack_ms, (unsigned long)load.window_ms, (unsigned long)load.txns);
+
+    const modbus_master_schedule_t* sched = &modbus_stations[0].sched;
+    for (uint8_t i = 0; i < sched->num_groups; i++) {
+        modbus_master_group_stats_t st;
+        modbus_master_schedule_get_stats(sched, i, &st);
+        ESP_LOGI(TAG, "  %-10s slot %u: %lu/%lu ms, jitter %lu (max %lu) us, missed %lu, overruns %lu",
+                 sched->groups[i].name, sched->groups[i].tag + 1, (unsigned long)(st.period_us / 1000),
+                 (unsigned long)sched->period_ms[i], (unsigned long)st.jitter_us, (unsigned long)st.jitter_max_us,
+                 (unsigned long)st.missed, (unsigned long)st.overruns);
+    }
+
+#if CONFIG_HMI_HISTORY
+    app_history_stats_t hist;
+    app_history_get_stats(&hist);
+    ESP_LOGI(TAG, "History %u KB, %lu samples, buckets %lu/%lu/%lu, overwritten %lu", (unsigned)(hist.bytes / 1024),
+             (unsigned long)hist.samples, (unsigned long)hist.used[0], (unsigned long)hist.used[1],
+             (unsigned long)hist.used[2], (unsigned long)hist.overwritten);
+#endif
+}
+#endif
+
+void
+modbus_poll_task(void* arg) {
+    static modbus_master_bus_sched_t poll_bus;
+    app_poll_view_t applied_view = TOTAL_POLL_VIEW;
+    uint8_t applied_slot = 0;
+    int64_t next_gap_check_us = esp_timer_get_time() + MODBUS_GAP_CHECK_MS * 1000LL;
+#if USE_MODBUS_MASTER_DEBUG
+    int64_t next_report_us = esp_timer_get_time() + POLL_REPORT_MS * 1000LL;
+#endif
+
+    modbus_master_bus_sched_init(&poll_bus);
+    for (uint8_t i = 0; i < modbus_num_stations; i++) {
+        modbus_master_bus_sched_add(&poll_bus, &modbus_stations[i].sched, modbus_stations[i].weight);
+    }
+
+    while (1) {
+        // ===== PROFILE THEO MÀN HÌNH HSM ĐANG HIỂN THỊ =====
+        app_poll_view_t view = device.poll_view;
+        uint8_t slot = view == APP_POLL_VIEW_DETAIL ? (uint8_t)device.present_slot_display : 0;
+        if (view != applied_view || slot != applied_slot) {
+            modbus_poll_profile_apply(view, slot);
+            applied_view = view;
+            applied_slot = slot;
+        }
+        if (esp_timer_get_time() >= next_gap_check_us) {
+            modbus_plan_gap_refresh();
+            next_gap_check_us = esp_timer_get_time() + MODBUS_GAP_CHECK_MS * 1000LL;
+        }
+#if USE_MODBUS_MASTER_DEBUG
+        if (esp_timer_get_time() >= next_report_us) {
+            modbus_poll_report(&poll_bus);
+            next_report_us += POLL_REPORT_MS * 1000LL;
+        }
+#endif
+
+        // ===== ROUND-ROBIN CÓ TRỌNG SỐ GIỮA CÁC TRẠM, EDF TRONG MỖI TRẠM =====
+        // Release theo mốc tuyệt đối, wait_ms tính tới mốc kế nên độ trễ bus không làm trôi chu kỳ
+        uint32_t wait_ms = 0;
+        uint8_t slave_addr = 0;
+        esp_err_t err = modbus_master_bus_sched_run_once(&poll_bus, &wait_ms, &slave_addr);
+        if (err == ESP_ERR_NOT_FOUND) {
+            // Thức dậy đủ sớm để bắt kịp khi đổi màn hình
+            if (wait_ms > POLL_VIEW_CHECK_MS) {
+                wait_ms = POLL_VIEW_CHECK_MS;
+            }
+#if CONFIG_HMI_MODBUS_SNIFF
+            // Nghe PLC tới khi có group cũ cần tự poll
+            err = modbus_master_sniff(wait_ms ? wait_ms : 1, modbus_bus_ingest, &poll_bus);
+            if (err == ESP_OK || err == ESP_ERR_TIMEOUT) {
+                continue;
+            }
+#endif
+            vTaskDelay(pdMS_TO_TICKS(wait_ms ? wait_ms : 1));
+            continue;
+        }
+
+        // Manager tự giữ khoảng nghỉ t3.5 giữa các frame và tự khôi phục link
+        // (resync -> retry -> dựng lại controller). Trạm offline trả lỗi ngay
+        // không chiếm bus, group của nó được hẹn lại sau một chu kỳ.
+        if (err == ESP_OK || slave_addr != APP_MODBUS_SLAVE_ID
+            || modbus_master_get_link_state(slave_addr) == MODBUS_MASTER_LINK_OFFLINE) {
+            continue;
+        }
+
+        // ===== XỬ LÝ LỖI =====
+        hsm_dispatch((hsm_t *)&device, HEVT_MODBUS_GET_SLOT_DATA, NULL);
     }
 }
 
@@ -397,6 +947,9 @@ touch_controller_init(esp_lcd_touch_handle_t* tp_out) {
     return ESP_OK;
 }
 
+// Nút SquareLine chưa có hàm sự kiện, gắn ở app_main() để không sửa file UI sinh tự động
+static void fnscrmainsettingbuttonclicked(lv_event_t* e);
+
 // ============================================
 // Main Application
 // ============================================
@@ -619,6 +1172,9 @@ app_main(void) {
     if (ui_lock(-1)) {
         ui_init();
 
+        lv_obj_add_event_cb(ui_scrmainsettingbutton, fnscrmainsettingbuttonclicked, LV_EVENT_CLICKED, NULL);
+        lv_obj_add_event_cb(ui_scrsettingbackbutton, fnbacktomainbutton, LV_EVENT_CLICKED, NULL);
+
         // // Register event callbacks
         // lv_obj_add_event_cb(ui_ibtMainToSetting, fnMainSetting, LV_EVENT_CLICKED, NULL);
         // lv_obj_add_event_cb(ui_ibtSettingBackToMain, fnSettingBackToMain, LV_EVENT_CLICKED, NULL);
@@ -658,11 +1214,17 @@ app_main(void) {
 
     // ✅ IN RA ĐỊA CHỈ BMS_DATA ARRAY
     modbus_master_config_t modbus_cfg = {
+#if CONFIG_HMI_MODBUS_NATIVE_RTU
+        .transport = MODBUS_MASTER_TRANSPORT_RTU_NATIVE,
+#else
+        .transport = MODBUS_MASTER_TRANSPORT_RTU,
+#endif
         .uart_port = APP_IO_UART_NUM,
         .tx_pin = APP_IO_UART_TX_PIN,
         .rx_pin = APP_IO_UART_RX_PIN,
         .rts_pin = APP_IO_UART_RTS_PIN,
-        .baudrate = 115200,
+        .baudrate = APP_MODBUS_BAUDRATE,
+        .duty_cycle = 0,
     };
 
     ESP_LOGI(TAG, "  📦 BMS_DATA ARRAY ADDRESSES");
@@ -672,18 +1234,57 @@ app_main(void) {
     }
     ESP_LOGI(TAG, "===========================================");
 
+#if CONFIG_HMI_HISTORY
+    esp_err_t history_ret = app_history_init(history_tiers, sizeof(history_tiers) / sizeof(history_tiers[0]));
+    if (history_ret != ESP_OK) {
+        ESP_LOGE(TAG, "      History disabled: %s", esp_err_to_name(history_ret));
+    }
+#endif
+
+#if CONFIG_HMI_MODBUS_REPLAY
+    // Bench: dữ liệu lấy từ capture nhúng thay cho bus RS485
+    esp_err_t modbus_ret = ESP_OK;
+    modbus_stations_load(modbus_nvs_init());
+    modbus_station_add(APP_MODBUS_SLAVE_ID, APP_MODBUS_SLAVE_WEIGHT);
+    modbus_stations_parse(modbus_extra_stations);
+    xTaskCreate(modbus_replay_task, "modbus_replay", 4096, NULL, 4, NULL);
+    ESP_LOGI(TAG, "      Modbus replaying capture (speed x%d)", CONFIG_HMI_MODBUS_REPLAY_SPEED);
+#else
     esp_err_t modbus_ret = modbus_master_init(&modbus_cfg);
     if (modbus_ret == ESP_OK) {
-        modbus_master_register_callback(modbus_data_received);
+        modbus_master_register_link_callback(modbus_link_changed);
+        bool nvs_ok = modbus_nvs_init();
+        modbus_stations_load(nvs_ok);
+#if CONFIG_HMI_MODBUS_BAUD_NEGOTIATE
+        modbus_baud_negotiate(nvs_ok);
+#endif
+
+        modbus_station_add(APP_MODBUS_SLAVE_ID, APP_MODBUS_SLAVE_WEIGHT);
+        modbus_stations_parse(modbus_extra_stations);
+        ESP_LOGI(TAG, "      Modbus stations: %u", modbus_num_stations);
         ESP_LOGI(TAG, "      Modbus initialized");
         
         vTaskDelay(pdMS_TO_TICKS(500)); // ✅ ĐỢI modbus stack ready
         
         xTaskCreate(modbus_poll_task, "modbus_poll", 4096, NULL, 4, NULL);
+#if USE_MODBUS_MASTER_DEBUG
+        xTaskCreate(modbus_frame_trace_task, "modbus_trace", 3072, NULL, 2, NULL);
+#endif
+#if CONFIG_HMI_MODBUS_CAPTURE_KB > 0
+        if (modbus_master_capture_start(CONFIG_HMI_MODBUS_CAPTURE_KB * 1024) == ESP_OK) {
+            xTaskCreate(modbus_capture_console_task, "modbus_cap", 3072, NULL, 1, NULL);
+        }
+#endif
         ESP_LOGI(TAG, "      Modbus task created");
     } else {
         ESP_LOGE(TAG, "      Modbus FAILED: %s", esp_err_to_name(modbus_ret));
     }
+#endif
+#if CONFIG_HMI_MODBUS_GATEWAY
+    if (modbus_ret == ESP_OK) {
+        modbus_gateway_start();
+    }
+#endif
     // ========================================
     // System Startup Complete
     // ========================================
@@ -732,6 +1333,10 @@ void fnscrmainmanualbuttonclicked(lv_event_t * e) {
     ESP_LOGI(TAG, "Main Goto Manual 1 Screen");
     hsm_dispatch((hsm_t *)&device, HEVT_TRANS_MAIN_TO_MANUAL1, NULL);
 }    
+static void fnscrmainsettingbuttonclicked(lv_event_t * e) {
+    ESP_LOGI(TAG, "Main Goto Setting Screen");
+    hsm_dispatch((hsm_t *)&device, HEVT_TRANS_MAIN_TO_SETTING, NULL);
+}
 
 // Detail Screen
 void fnscrdetailbatterybuttonclicked(lv_event_t * e) {
@@ -748,6 +1353,10 @@ void fnscrdetailbacktomainbuttonclicked(lv_event_t * e) {
     ESP_LOGI(TAG, "Detail Goto Main Screen");
     hsm_dispatch((hsm_t *)&device, HEVT_TRANS_DETAIL_TO_MAIN, NULL);
 }    
+
+// Cử chỉ chạy trong task LVGL, đọc ảnh trạm đã publish thay vì bản làm việc của task poll
+static app_station_snapshot_t gesture_snap;
+
 void fnscrdetailnextslotgasture(lv_event_t * e) {
     ESP_LOGI(TAG, "Detail Next Slot Data");
     if(++device.present_slot_display > TOTAL_SLOT - 1) {
@@ -758,13 +1367,16 @@ void fnscrdetailnextslotgasture(lv_event_t * e) {
     lv_obj_set_style_opa(ui_scrdetaildataslotvalue2, LV_OPA_TRANSP, 0);
     lv_obj_set_style_opa(ui_scrdetaildataslotvalue3, LV_OPA_TRANSP, 0);
 
+    app_station_read(&device, &gesture_snap);
     scrdetaildataslottitlelabel_update(device.present_slot_display);
     scrdetaildataslotvalue_update(
-                        &device.bms_data[device.present_slot_display],
-                        device.bms_info.slot_state[device.present_slot_display]);
+                        &gesture_snap.bms_data[device.present_slot_display],
+                        gesture_snap.bms_info.slot_state[device.present_slot_display],
+                        app_station_slot_age_ms(&gesture_snap, device.present_slot_display, esp_timer_get_time())
+                            > BMS_DATA_STALE_MS);
     scrdetailslotssttcontainer_update(
-                        device.bms_info.slot_state,
-                        device.bms_data,
+                        gesture_snap.bms_info.slot_state,
+                        gesture_snap.bms_data,
                         device.present_slot_display);
 }
 void fnscrdetailbackslotgasture(lv_event_t * e) {
@@ -777,13 +1389,16 @@ void fnscrdetailbackslotgasture(lv_event_t * e) {
     lv_obj_set_style_opa(ui_scrdetaildataslotvalue2, LV_OPA_TRANSP, 0);
     lv_obj_set_style_opa(ui_scrdetaildataslotvalue3, LV_OPA_TRANSP, 0);
 
+    app_station_read(&device, &gesture_snap);
     scrdetaildataslottitlelabel_update(device.present_slot_display);
     scrdetaildataslotvalue_update(
-                        &device.bms_data[device.present_slot_display],
-                        device.bms_info.slot_state[device.present_slot_display]);
+                        &gesture_snap.bms_data[device.present_slot_display],
+                        gesture_snap.bms_info.slot_state[device.present_slot_display],
+                        app_station_slot_age_ms(&gesture_snap, device.present_slot_display, esp_timer_get_time())
+                            > BMS_DATA_STALE_MS);
     scrdetailslotssttcontainer_update(
-                        device.bms_info.slot_state,
-                        device.bms_data,
+                        gesture_snap.bms_info.slot_state,
+                        gesture_snap.bms_data,
                         device.present_slot_display);
 }
 